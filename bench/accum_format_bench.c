@@ -0,0 +1,142 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Emulates the running mean of renderer.glsl on the CPU to compare the
+// precision of the accumulation formats against a double precision reference.
+// The packed format stores the same floats as vec3, only without padding.
+// Nothing runs on a device here: the traffic column is computed from the bytes
+// per pixel (every batch reads and writes each pixel once), the render log
+// reports the same estimate for real renders.
+
+#define VEC3_BYTES 16
+#define PACKED_BYTES 12
+#define HALF_BYTES 8
+
+#define WIDTH 4096
+#define ITERATIONS 1000
+#define BATCH_SIZE 4
+
+static uint32_t rngState = 1;
+
+static float rand_float(void) {
+    rngState = rngState * 1664525u + 1013904223u;
+    return (float)(rngState >> 8) / (float)(1u << 24);
+}
+
+static uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof x);
+    uint32_t sign = (x >> 16) & 0x8000;
+    int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if (exp >= 31) return sign | 0x7c00;
+    if (exp <= 0) {
+        if (exp < -10) return sign;
+        mant |= 0x800000;
+        uint32_t shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t mid = 1u << (shift - 1);
+        if (rest > mid || (rest == mid && (half & 1))) half++;
+        return sign | half;
+    }
+
+    uint32_t half = sign | (uint32_t)exp << 10 | mant >> 13;
+    uint32_t rest = mant & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++;
+    return half;
+}
+
+static float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+
+    float f;
+    if (exp == 0) {
+        f = ldexpf((float)mant, -24);
+        return sign ? -f : f;
+    }
+
+    uint32_t x = sign | (uint32_t)(exp - 15 + 127) << 23 | mant << 13;
+    memcpy(&f, &x, sizeof f);
+    return f;
+}
+
+static int to_byte(double v) {
+    int b = (int)(v * 255);
+    return b < 0 ? 0 : b > 255 ? 255 : b;
+}
+
+int main(void) {
+    static double reference[WIDTH];
+    static float full[WIDTH];
+    static uint16_t half[WIDTH];
+
+    // a dark gradient, where banding is easiest to see
+    for (uint32_t iter = BATCH_SIZE; iter <= ITERATIONS; iter += BATCH_SIZE) {
+        for (int x = 0; x < WIDTH; x++) {
+            float value = (float)x / WIDTH * 0.25f;
+            float color = 0.0f;
+            for (int i = 0; i < BATCH_SIZE; i++) {
+                color += value * 2.0f * rand_float();
+            }
+
+            uint32_t old = iter - BATCH_SIZE;
+            reference[x] = (reference[x] * old + color) / iter;
+            full[x] = (full[x] * (float)old + color) / (float)iter;
+            float h = half_to_float(half[x]);
+            half[x] = float_to_half((h * (float)old + color) / (float)iter);
+        }
+    }
+
+    double fullMax = 0, halfMax = 0, fullSum = 0, halfSum = 0;
+    int fullBytes = 0, halfBytes = 0;
+    for (int x = 0; x < WIDTH; x++) {
+        double fullErr = fabs(full[x] - reference[x]);
+        double halfErr = fabs(half_to_float(half[x]) - reference[x]);
+        fullMax = fmax(fullMax, fullErr);
+        halfMax = fmax(halfMax, halfErr);
+        fullSum += fullErr;
+        halfSum += halfErr;
+        fullBytes += to_byte(full[x]) != to_byte(reference[x]);
+        halfBytes += to_byte(half_to_float(half[x])) != to_byte(reference[x]);
+    }
+
+    printf(
+        "%d pixels, %d iterations, %d per dispatch\n",
+        WIDTH,
+        ITERATIONS,
+        BATCH_SIZE
+    );
+    printf("format   bytes  traffic*  max error  mean error  8 bit diffs\n");
+    printf(
+        "vec3     %-5d  %.2fx     %.2e   %.2e    %d\n",
+        VEC3_BYTES,
+        1.0,
+        fullMax,
+        fullSum / WIDTH,
+        fullBytes
+    );
+    printf(
+        "packed   %-5d  %.2fx     %.2e   %.2e    %d\n",
+        PACKED_BYTES,
+        (double)PACKED_BYTES / VEC3_BYTES,
+        fullMax,
+        fullSum / WIDTH,
+        fullBytes
+    );
+    printf(
+        "half     %-5d  %.2fx     %.2e   %.2e    %d\n",
+        HALF_BYTES,
+        (double)HALF_BYTES / VEC3_BYTES,
+        halfMax,
+        halfSum / WIDTH,
+        halfBytes
+    );
+    printf("* computed from the bytes per pixel, not measured\n");
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "image/png.h"
+#include "image/qoi.h"
+#include "logger/logger.h"
+#include "stb/stb_image_write.h"
+
+// Encodes a render-like image (smooth shading, hard edges and some sampling
+// noise) at 4K and 8K with stb and the renderer's own encoders, and reports
+// their throughput and compression ratio. The png encoder runs on one thread
+// and on one thread per core.
+
+#define RUNS 3
+
+static uint32_t rngState = 1;
+
+static uint32_t rand_u32(void) {
+    rngState = rngState * 1664525u + 1013904223u;
+    return rngState;
+}
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static unsigned char* make_image(uvec2 size) {
+    unsigned char* image = malloc((size_t)size.x * size.y * 4);
+    for (uint y = 0; y < size.y; y++) {
+        for (uint x = 0; x < size.x; x++) {
+            unsigned char* p = image + ((size_t)y * size.x + x) * 4;
+            float u = (float)x / size.x, v = (float)y / size.y;
+            bool box = (x / (size.x / 8) + y / (size.y / 6)) % 3 == 0;
+            float shade = box ? 0.8f : 0.3f + 0.5f * sinf(u * 3.0f) * v;
+            int noise = (int)(rand_u32() >> 29) - 4;
+            for (int c = 0; c < 3; c++) {
+                int value = (int)(shade * (200 + c * 20)) + noise;
+                p[c] = value < 0 ? 0 : value > 255 ? 255 : value;
+            }
+            p[3] = 255;
+        }
+    }
+    return image;
+}
+
+static void count_bytes(void* context, void* data, int size) {
+    *(size_t*)context += (size_t)size;
+}
+
+typedef enum {
+    ENCODER_STB_BMP,
+    ENCODER_STB_PNG,
+    ENCODER_PNG_SINGLE,
+    ENCODER_PNG,
+    ENCODER_QOI,
+    ENCODER_COUNT,
+} Encoder;
+
+static size_t encode(Encoder encoder, const unsigned char* image, uvec2 size) {
+    size_t outSize = 0;
+    unsigned char* data = NULL;
+    switch (encoder) {
+        case ENCODER_STB_BMP:
+            stbi_write_bmp_to_func(
+                count_bytes,
+                &outSize,
+                size.x,
+                size.y,
+                4,
+                image
+            );
+            break;
+        case ENCODER_STB_PNG:
+            stbi_write_png_to_func(
+                count_bytes,
+                &outSize,
+                size.x,
+                size.y,
+                4,
+                image,
+                size.x * 4
+            );
+            break;
+        case ENCODER_PNG_SINGLE:
+            data = png_encode(image, size, 1, &outSize);
+            break;
+        case ENCODER_PNG: data = png_encode(image, size, 0, &outSize); break;
+        case ENCODER_QOI: data = qoi_encode(image, size, &outSize); break;
+        default: break;
+    }
+    free(data);
+    return outSize;
+}
+
+int main(void) {
+    const char* names[] = {"stb bmp", "stb png", "png 1t", "png", "qoi"};
+    const uvec2 sizes[] = {{{3840, 2160}}, {{7680, 4320}}};
+    set_log_level(MC_LOG_LEVEL_WARN);
+
+    printf("encoder    size   MB/s     ratio\n");
+    for (int s = 0; s < 2; s++) {
+        uvec2 size = sizes[s];
+        unsigned char* image = make_image(size);
+        double raw = (double)size.x * size.y * 4;
+
+        for (int e = 0; e < ENCODER_COUNT; e++) {
+            double best = INFINITY;
+            size_t outSize = 0;
+            for (int run = 0; run < RUNS; run++) {
+                double start = get_time();
+                outSize = encode((Encoder)e, image, size);
+                double time = get_time() - start;
+                if (time < best) best = time;
+            }
+
+            printf(
+                "%-10s %s   %-8.1f %.3f\n",
+                names[e],
+                s == 0 ? "4K" : "8K",
+                raw / best / 1e6,
+                (double)outSize / raw
+            );
+        }
+
+        free(image);
+    }
+
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "lua/lua_extra.h"
+
+#define CALLS 1000000
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// pushes the same arguments that scene:set() receives from the voxel placer
+static void push_set_args(lua_State* L, int sceneIdx, int posIdx) {
+    lua_pushvalue(L, sceneIdx);
+    lua_pushvalue(L, posIdx);
+    lua_pushinteger(L, 1);
+}
+
+int main(void) {
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+
+    int scene = 0;
+    lua_push_f(L, "{_scene: u}", &scene);
+    int sceneIdx = lua_gettop(L);
+    lua_push_f(L, "{1: f, 2: f, 3: f}", 1.0, 2.0, 3.0);
+    int posIdx = lua_gettop(L);
+
+    char* fmt = "i; {1: f, 2: f, 3: f}; {_scene: u}";
+    LuaFormat* format = lua_format_compile(L, fmt);
+
+    int materialID;
+    float x, y, z;
+    void* scenePtr;
+
+    double start = get_time();
+    for (int i = 0; i < CALLS; i++) {
+        push_set_args(L, sceneIdx, posIdx);
+        lua_pop_f(L, fmt, &materialID, &x, &y, &z, &scenePtr);
+    }
+    double parsed = get_time() - start;
+
+    start = get_time();
+    for (int i = 0; i < CALLS; i++) {
+        push_set_args(L, sceneIdx, posIdx);
+        lua_pop_fc(L, format, &materialID, &x, &y, &z, &scenePtr);
+    }
+    double compiled = get_time() - start;
+
+    printf("format: \"%s\", %d calls\n", fmt, CALLS);
+    printf("lua_pop_f:  %.1f ns/call\n", parsed / CALLS * 1e9);
+    printf("lua_pop_fc: %.1f ns/call\n", compiled / CALLS * 1e9);
+    printf("speedup:    %.2fx\n", parsed / compiled);
+
+    lua_format_destroy(L, format);
+    lua_close(L);
+    return 0;
+}
\ No newline at end of file
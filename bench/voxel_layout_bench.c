@@ -0,0 +1,186 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "logger/logger.h"
+#include "world/scene.h"
+
+// Traces random rays through the same scenes stored in each voxel layout and
+// format and reports a simulated L1 hit rate and the actual tracing
+// throughput.
+
+#define SCENE_SIZE 256
+#define RAYS 200000
+
+// direct mapped, 64 byte lines, 32 KiB
+#define CACHE_LINES 512
+#define LINE_SIZE 64
+
+static uint32_t rngState;
+
+static float rand_float(void) {
+    rngState = rngState * 1664525u + 1013904223u;
+    return (float)(rngState >> 8) / (float)(1u << 24);
+}
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// a terrain with thin pillars, or (sparse) small cubes floating in 32^3 cells
+static bool solid(uint x, uint y, uint z, bool sparse) {
+    if (sparse) {
+        uint cell = (z / 32 * 8 + y / 32) * 8 + x / 32;
+        uint hash = cell * 2654435761u;
+        return hash >> 30 == 0 && x % 32 < 6 && y % 32 < 6 && z % 32 < 6;
+    }
+
+    float h = 40 + 20 * sinf(x * 0.05f) * cosf(y * 0.07f);
+    return z < h || (x % 37 == 0 && y % 41 == 0);
+}
+
+static void fill_scene(Scene* scene, bool sparse) {
+    for (uint z = 0; z < SCENE_SIZE; z++) {
+        for (uint y = 0; y < SCENE_SIZE; y++) {
+            for (uint x = 0; x < SCENE_SIZE; x++) {
+                if (solid(x, y, z, sparse)) {
+                    scene_set(scene, (uvec3){{x, y, z}}, 1);
+                }
+            }
+        }
+    }
+}
+
+typedef struct {
+    uint64_t steps;
+    uint64_t hits;
+    uint64_t tags[CACHE_LINES];
+} CacheStats;
+
+// voxel traversal (same as traverse in the render shader), returns the number
+// of steps taken
+static uint trace(
+    Scene* scene,
+    uint voxelBytes,
+    float* origin,
+    float* dir,
+    CacheStats* stats
+) {
+    int pos[3];
+    int step[3];
+    float tDelta[3];
+    float tMax[3];
+
+    for (int i = 0; i < 3; i++) {
+        pos[i] = (int)floorf(origin[i]);
+        step[i] = dir[i] < 0 ? -1 : 1;
+        tDelta[i] = fabsf(1.0f / dir[i]);
+        float next = dir[i] < 0 ? origin[i] - pos[i] : pos[i] + 1 - origin[i];
+        tMax[i] = next * tDelta[i];
+    }
+
+    uint steps = 0;
+    while (true) {
+        int axis = tMax[0] < tMax[1] ? (tMax[0] < tMax[2] ? 0 : 2)
+                                     : (tMax[1] < tMax[2] ? 1 : 2);
+        tMax[axis] += tDelta[axis];
+        pos[axis] += step[axis];
+        steps++;
+
+        if (pos[0] < 0 || pos[1] < 0 || pos[2] < 0 || pos[0] >= SCENE_SIZE
+            || pos[1] >= SCENE_SIZE || pos[2] >= SCENE_SIZE)
+            return steps;
+
+        uvec3 p = {{pos[0], pos[1], pos[2]}};
+        if (stats != NULL) {
+            uint64_t index = scene_voxel_index(scene, p);
+            uint64_t line = index * voxelBytes / LINE_SIZE;
+            uint64_t* tag = &stats->tags[line % CACHE_LINES];
+            stats->hits += *tag == line + 1;
+            *tag = line + 1;
+            stats->steps++;
+        }
+
+        if (scene_get(scene, p) != 0) return steps;
+    }
+}
+
+static void random_ray(float* origin, float* dir, bool sparse) {
+    for (int i = 0; i < 3; i++) origin[i] = rand_float() * SCENE_SIZE;
+    if (!sparse) origin[2] = 60 + rand_float() * (SCENE_SIZE - 60);
+
+    float len;
+    do {
+        for (int i = 0; i < 3; i++) dir[i] = rand_float() * 2 - 1;
+        len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+    } while (len < 0.1f || len > 1.0f);
+    for (int i = 0; i < 3; i++) dir[i] /= len;
+}
+
+static void run(VoxelLayout layout, VoxelFormat format, bool sparse) {
+    const char* layoutNames[] = {"linear", "morton", "brick"};
+    const char* formatNames[] = {"r32", "r16", "r8"};
+    const uint formatBytes[] = {4, 2, 1};
+    static CacheStats stats;
+
+    SceneCreateInfo info = {
+        .size = {{SCENE_SIZE, SCENE_SIZE, SCENE_SIZE}},
+        .layout = layout,
+        .format = format,
+    };
+    Scene* scene = scene_create(NULL, info);
+    fill_scene(scene, sparse);
+
+    float origin[3], dir[3];
+    stats = (CacheStats){0};
+    rngState = 1;
+    for (int i = 0; i < RAYS; i++) {
+        random_ray(origin, dir, sparse);
+        trace(scene, formatBytes[format], origin, dir, &stats);
+    }
+
+    // the same rays again, without the cache model
+    uint64_t steps = 0;
+    rngState = 1;
+    double start = get_time();
+    for (int i = 0; i < RAYS; i++) {
+        random_ray(origin, dir, sparse);
+        steps += trace(scene, formatBytes[format], origin, dir, NULL);
+    }
+    double time = get_time() - start;
+
+    printf(
+        "%-8s %-6s %6.2f%%      %.1f\n",
+        layoutNames[layout],
+        formatNames[format],
+        100.0 * (double)stats.hits / (double)stats.steps,
+        (double)steps / time / 1e6
+    );
+
+    scene_destroy(scene);
+}
+
+int main(void) {
+    set_log_level(MC_LOG_LEVEL_WARN);
+
+    for (int sparse = 0; sparse < 2; sparse++) {
+        printf(
+            "%d^3 %s scene, %d rays in random directions\n",
+            SCENE_SIZE,
+            sparse ? "sparse" : "terrain",
+            RAYS
+        );
+        printf("layout   format L1 hit rate  Msteps/s\n");
+        for (int layout = 0; layout < 3; layout++) {
+            for (int format = 0; format < 3; format++) {
+                run((VoxelLayout)layout, (VoxelFormat)format, sparse);
+            }
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
\ No newline at end of file
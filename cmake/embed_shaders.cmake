@@ -0,0 +1,68 @@
+# Writes OUTPUT, a C file with the SPIR-V of the shaders listed in MANIFEST
+# (one "name|source|wgX|wgY|macroName|macroValue|spirv" per line) and the GLSL
+# sources they were compiled from, see src/renderer/embedded_shaders.h
+
+# keep the empty macro fields
+cmake_policy(SET CMP0007 NEW)
+
+file(STRINGS ${MANIFEST} entries)
+
+set(sources "")
+set(arrays "")
+set(table "")
+set(index 0)
+
+foreach (entry IN LISTS entries)
+    string(REPLACE "|" ";" fields "${entry}")
+    list(GET fields 0 name)
+    list(GET fields 1 source)
+    list(GET fields 2 wgX)
+    list(GET fields 3 wgY)
+    list(GET fields 4 macroName)
+    list(GET fields 5 macroValue)
+    list(GET fields 6 spirv)
+
+    # every source is embedded once, with a terminator
+    list(FIND sources ${source} sourceIndex)
+    if (sourceIndex EQUAL -1)
+        list(LENGTH sources sourceIndex)
+        list(APPEND sources ${source})
+        file(READ ${source} hex HEX)
+        string(REGEX REPLACE "(..)" "0x\\1," bytes "${hex}")
+        string(
+                APPEND arrays
+                "static const unsigned char source${sourceIndex}[] = "
+                "{${bytes}0x00};\n"
+        )
+    endif ()
+
+    file(READ ${spirv} hex HEX)
+    string(REGEX REPLACE "(..)" "0x\\1," bytes "${hex}")
+    string(
+            APPEND arrays
+            "static const unsigned char spirv${index}[] = {${bytes}};\n"
+    )
+
+    if (macroName STREQUAL "")
+        set(macro "NULL, NULL")
+    else ()
+        set(macro "\"${macroName}\", \"${macroValue}\"")
+    endif ()
+    string(
+            APPEND table
+            "    {\"${name}\", (const char*)source${sourceIndex}, "
+            "{{${wgX}, ${wgY}}}, ${macro}, "
+            "spirv${index}, sizeof spirv${index}},\n"
+    )
+
+    math(EXPR index "${index} + 1")
+endforeach ()
+
+file(
+        WRITE ${OUTPUT}
+        "// generated by cmake/embed_shaders.cmake, do not edit\n"
+        "#include \"renderer/embedded_shaders.h\"\n\n"
+        "${arrays}\n"
+        "const EmbeddedShader embeddedShaders[] = {\n${table}};\n\n"
+        "const uint embeddedShaderCount = ${index};\n"
+)
@@ -0,0 +1,77 @@
+#version 430
+
+layout (local_size_x = WORKGROUP_SIZE_X, local_size_y = WORKGROUP_SIZE_Y) in;
+
+ivec2 glPos = ivec2(gl_GlobalInvocationID.xy);
+ivec2 glSize = ivec2(gl_NumWorkGroups.xy * gl_WorkGroupSize.xy);
+
+//============================================================================//
+// buffers
+//============================================================================//
+
+layout (std430, binding = 0) readonly buffer buff0 {
+    uint stepWidth;
+    float colorPhi;
+    float normalPhi;
+    float albedoPhi;
+};
+
+layout (std430, binding = 1) readonly buffer buff1 {
+    vec3 inImage[];
+};
+
+layout (std430, binding = 2) writeonly buffer buff2 {
+    vec3 outImage[];
+};
+
+layout (std430, binding = 3) readonly buffer buff3 {
+    vec3 albedoImage[];
+};
+
+layout (std430, binding = 4) readonly buffer buff4 {
+    vec3 normalImage[];
+};
+
+//============================================================================//
+// main
+//============================================================================//
+
+// one pass of the edge-avoiding a-trous wavelet filter (5x5 B3 spline kernel)
+const float kernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+float edge_weight(vec3 a, vec3 b, float phi) {
+    vec3 d = a - b;
+    return exp(-dot(d, d) / phi);
+}
+
+void main() {
+    int idx = glPos.y * glSize.x + glPos.x;
+
+    vec3 color = inImage[idx];
+    vec3 albedo = albedoImage[idx];
+    vec3 normal = normalImage[idx];
+
+    vec3 sum = vec3(0);
+    float weightSum = 0;
+
+    for (int dy = -2; dy <= 2; dy++) {
+        for (int dx = -2; dx <= 2; dx++) {
+            ivec2 pos = glPos + ivec2(dx, dy) * int(stepWidth);
+            if (any(lessThan(pos, ivec2(0))) || any(greaterThanEqual(pos, glSize)))
+            continue;
+
+            int i = pos.y * glSize.x + pos.x;
+            vec3 c = inImage[i];
+
+            float w = kernel[abs(dx)] * kernel[abs(dy)]
+                * edge_weight(color, c, colorPhi)
+                * edge_weight(normal, normalImage[i], normalPhi)
+                * edge_weight(albedo, albedoImage[i], albedoPhi);
+
+            sum += c * w;
+            weightSum += w;
+        }
+    }
+
+    outImage[idx] = sum / weightSum;
+}
\ No newline at end of file
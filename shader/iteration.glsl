@@ -3,10 +3,20 @@
 layout (std430, binding = 0) coherent buffer buff0 {
     uint maxRayDepth;
     uint iteration;
-    float seed;
+    uint seed;
+    uint writeAOVs;
+    uvec2 imageSize;
+    uint bandOffset;
+    uint cachePrimary;
+    uint batchSize;
+    uint resolve;
+    uint lodBounce;
+    float lodDistance;
+    uint preview;
+    uint firstIteration;
 };
 
 void main() {
-    iteration += 1;
-    seed = fract(sin(dot(vec2(iteration) * seed, vec2(12.98, 78.23))) * 43758.54);
+    // the seed stays fixed, each sample derives its own from its index
+    iteration += batchSize;
 }
\ No newline at end of file
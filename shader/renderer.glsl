@@ -12,6 +12,33 @@ ivec2 glSize = ivec2(gl_NumWorkGroups.xy * gl_WorkGroupSize.xy);
 #define EPSILON 0.00001
 #define PI 3.14159
 
+// traverse_grid model IDs for the scene grid itself and its level of detail
+#define NO_MODEL 0xffffffffu
+#define LOD_GRID 0xfffffffeu
+
+// marks hit materials that are level of detail cells instead of material IDs
+#define LOD_MATERIAL 0x80000000u
+
+// accumulation buffer formats, the renderer picks one with ACCUM_FORMAT
+#define ACCUM_VEC3 0   // vec3, padded to 16 bytes
+#define ACCUM_PACKED 1 // 3 tightly packed floats, 12 bytes
+#define ACCUM_HALF 2   // 4 half floats, 8 bytes
+
+#ifndef ACCUM_FORMAT
+#define ACCUM_FORMAT ACCUM_VEC3
+#endif
+
+// voxel buffer layouts, must match coord_to_index in scene.c
+#define VOXEL_LAYOUT_LINEAR 0 // rows along x, then y, then z
+#define VOXEL_LAYOUT_MORTON 1 // z-order curve
+#define VOXEL_LAYOUT_BRICK 2  // 8x8x8 bricks
+#define VOXEL_LAYOUT_DAG 3    // sparse voxel dag, see dag.h
+
+// voxel formats, narrow voxels are packed into the uints from the lowest byte
+#define VOXEL_FORMAT_R32 0
+#define VOXEL_FORMAT_R16 1
+#define VOXEL_FORMAT_R8 2
+
 //============================================================================//
 // structs
 //============================================================================//
@@ -32,23 +59,55 @@ struct Hit {
     uint material;
 };
 
+struct CameraView {
+    vec3 pos;
+    vec3 dir;
+};
+
+struct Instance {
+    ivec4 offset; // lowest corner (xyz) and model ID (w)
+    ivec4 rot[3]; // rows of the world to model rotation
+    uvec4 size;   // size of the rotated model (xyz)
+};
+
 //============================================================================//
 // buffers
 //============================================================================//
 
 layout (std430, binding = 0) readonly buffer buff0 {
-    uint maxRayDepth;
+    uint dynMaxRayDepth;
     uint iteration;
-    float seed;
+    uint seed;
+    uint writeAOVs;
+    uvec2 imageSize;
+    uint bandOffset;
+    uint cachePrimary;
+    uint batchSize;
+    uint resolve;
+    uint lodBounce;
+    float lodDistance;
+    uint preview;
+    uint firstIteration;
 };
 
 layout (std430, binding = 1) coherent buffer buff1 {
+#if ACCUM_FORMAT == ACCUM_PACKED
+    float img[];
+#elif ACCUM_FORMAT == ACCUM_HALF
+    uvec2 img[];
+#else
     vec3 img[];
+#endif
 };
 
 layout (std430, binding = 2) readonly buffer buff2 {
-    uvec3 sceneSize;
-    Material bg;
+    uvec3 dynSceneSize;
+    Material dynBg;
+    uint dynVoxelLayout;
+    uint lodLevel;
+    uint dynVoxelFormat;
+    uint dagRoot;
+    uint dagLevels;
 };
 
 layout (std430, binding = 3) readonly buffer buff3 {
@@ -60,20 +119,126 @@ layout (std430, binding = 4) readonly buffer buff4 {
 };
 
 layout (std430, binding = 5) readonly buffer buff5 {
-    vec3 cameraPos;
-    vec3 cameraDir;
     vec2 cameraSensorSize;
     float cameraFocalLegnth;
+    uint cameraViewCount;
+    CameraView cameraViews[];
+};
+
+layout (std430, binding = 6) writeonly buffer buff6 {
+    vec3 albedoImg[];
+};
+
+layout (std430, binding = 7) writeonly buffer buff7 {
+    vec3 normalImg[];
+};
+
+layout (std430, binding = 8) coherent buffer buff8 {
+    uvec2 primaryHits[];
+};
+
+layout (std430, binding = 9) writeonly buffer buff9 {
+    vec3 resolvedImg[];
+};
+
+// size (xyz) and first voxel (w) of each model
+layout (std430, binding = 10) readonly buffer buff10 {
+    uvec4 models[];
+};
+
+layout (std430, binding = 11) readonly buffer buff11 {
+    uint modelVoxels[];
+};
+
+layout (std430, binding = 12) readonly buffer buff12 {
+    Instance instances[];
+};
+
+// a grid over the scene, gridData holds the first instance of each cell (plus
+// one past the last cell) followed by the instance indices
+layout (std430, binding = 13) readonly buffer buff13 {
+    uvec4 gridInfo; // cell counts (xyz) and cell size (w)
+    uint gridData[];
+};
+
+// the level of detail cells, packed as (rgb color | coverage, emission bits)
+layout (std430, binding = 14) readonly buffer buff14 {
+    uvec2 lodCells[];
 };
 
+//============================================================================//
+// scene constants
+//============================================================================//
+
+// specialized variants of this shader have these baked in, the generic one
+// reads them from the buffers
+
+#ifdef SCENE_SIZE
+const uvec3 sceneSize = SCENE_SIZE;
+#else
+#define sceneSize dynSceneSize
+#endif
+
+#ifdef MAX_RAY_DEPTH
+const uint maxRayDepth = MAX_RAY_DEPTH;
+#else
+#define maxRayDepth dynMaxRayDepth
+#endif
+
+#ifdef BG_COLOR
+const Material bg = Material(BG_COLOR, BG_PROPERTIES);
+#else
+#define bg dynBg
+#endif
+
+#ifdef VOXEL_LAYOUT
+const uint voxelLayout = VOXEL_LAYOUT;
+#else
+#define voxelLayout dynVoxelLayout
+#endif
+
+#ifdef VOXEL_FORMAT
+const uint voxelFormat = VOXEL_FORMAT;
+#else
+#define voxelFormat dynVoxelFormat
+#endif
+
+// the dispatch may only cover a band of the image
+ivec2 pixelPos = glPos + ivec2(0, bandOffset);
+
+// the views of the camera are stacked vertically, each one is rendered like a
+// separate image of viewSize
+ivec2 viewSize = ivec2(imageSize.x, imageSize.y / cameraViewCount);
+uint view = uint(pixelPos.y / viewSize.y);
+ivec2 viewPos = pixelPos - ivec2(0, view * viewSize.y);
+vec3 cameraPos = cameraViews[view].pos;
+vec3 cameraDir = cameraViews[view].dir;
+
+// a dispatch renders the batchSize samples up to and including `iteration`
+uint sampleIndex = iteration - batchSize + 1;
+
 //============================================================================//
 // rng
 //============================================================================//
 
-float prev = seed;
+float prev;
+
+uint hash_uint(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// restarts the sequence of a sample, the samples of a pixel only depend on the
+// global seed and their index within the whole render (so a render can be
+// split between processes by iteration ranges)
+void seed_sample(uint index) {
+    uint h = hash_uint(seed ^ hash_uint(firstIteration + index));
+    prev = float((h >> 8u) + 1u) / 16777216.0;
+}
 
 float rand() {
-    prev = fract(sin(dot(vec2(glPos) * prev, vec2(12.98, 78.23))) * 43758.54);
+    prev = fract(sin(dot(vec2(pixelPos) * prev, vec2(12.98, 78.23))) * 43758.54);
     return prev;
 }
 
@@ -97,20 +262,138 @@ vec2 rotate(vec2 v, float a) {
     return vec2(v.x * c - v.y * s, v.x * s + v.y * c);
 }
 
-bool in_scene_bounds(ivec3 pos) {
-    return all(lessThanEqual(ivec3(0), pos)) && all(lessThan(pos, sceneSize));
+bool in_bounds(ivec3 pos, uvec3 size) {
+    return all(lessThanEqual(ivec3(0), pos)) && all(lessThan(pos, size));
 }
 
-bool in_scene_bounds(vec3 pos) {
-    return all(lessThanEqual(vec3(0), pos)) && all(lessThan(pos, sceneSize));
+bool in_bounds(vec3 pos, uvec3 size) {
+    return all(lessThanEqual(vec3(0), pos)) && all(lessThan(pos, size));
 }
 
 Ray create_ray(vec3 origin, vec3 dir) {
     return Ray(origin, normalize(dir) + EPSILON);
 }
 
+// spreads the low 10 bits of v out so that there are 2 zero bits between each
+uint part_by_2(uint v) {
+    v &= 0x3ff;
+    v = (v | v << 16) & 0x030000ff;
+    v = (v | v << 8) & 0x0300f00f;
+    v = (v | v << 4) & 0x030c30c3;
+    v = (v | v << 2) & 0x09249249;
+    return v;
+}
+
+uint load_voxel(uint idx) {
+    if (voxelFormat == VOXEL_FORMAT_R8) {
+        return (voxels[idx >> 2] >> ((idx & 3) << 3)) & 0xff;
+    }
+    if (voxelFormat == VOXEL_FORMAT_R16) {
+        return (voxels[idx >> 1] >> ((idx & 1) << 4)) & 0xffff;
+    }
+    return voxels[idx];
+}
+
+// descends from the root into the octant of pos on every level, the entries of
+// the bottom level are material IDs, the scene is empty until it was built
+uint get_dag_voxel(uvec3 pos) {
+    if (dagLevels == 0) return 0;
+    uint node = dagRoot;
+    for (uint level = dagLevels - 1; level > 0; level--) {
+        uvec3 bit = (pos >> level) & 1;
+        node = voxels[node * 8 + (bit.z << 2 | bit.y << 1 | bit.x)];
+        if (node == 0) return 0;
+    }
+    uvec3 bit = pos & 1;
+    return voxels[node * 8 + (bit.z << 2 | bit.y << 1 | bit.x)];
+}
+
 uint get_voxel(uvec3 pos) {
-    return voxels[(pos.z * sceneSize.y + pos.y) * sceneSize.x + pos.x];
+    if (voxelLayout == VOXEL_LAYOUT_DAG) {
+        return get_dag_voxel(pos);
+    }
+
+    if (voxelLayout == VOXEL_LAYOUT_MORTON) {
+        return load_voxel(part_by_2(pos.x) | part_by_2(pos.y) << 1 | part_by_2(pos.z) << 2);
+    }
+
+    if (voxelLayout == VOXEL_LAYOUT_BRICK) {
+        uvec3 bricks = (sceneSize + 7) / 8;
+        uvec3 brick = pos >> 3;
+        uvec3 local = pos & 7;
+        uint brickIndex = (brick.z * bricks.y + brick.y) * bricks.x + brick.x;
+        return load_voxel(brickIndex << 9 | local.z << 6 | local.y << 3 | local.x);
+    }
+
+#ifdef SCENE_SHIFT_X
+    // power of two scene sizes turn the index multiplies into shifts
+    return load_voxel(pos.z << SCENE_SHIFT_XY | pos.y << SCENE_SHIFT_X | pos.x);
+#else
+    return load_voxel((pos.z * sceneSize.y + pos.y) * sceneSize.x + pos.x);
+#endif
+}
+
+uint get_model_voxel(uint model, uvec3 pos) {
+    uvec4 m = models[model];
+    return modelVoxels[m.w + (pos.z * m.y + pos.y) * m.x + pos.x];
+}
+
+// coarse cells are hit with a probability of their coverage
+uint get_lod_voxel(uvec3 pos, uvec3 size) {
+    uint idx = (pos.z * size.y + pos.y) * size.x + pos.x;
+    float coverage = unpackUnorm4x8(lodCells[idx].x).a;
+    return coverage > 0 && rand() < coverage ? idx | LOD_MATERIAL : 0;
+}
+
+Material get_material(uint id) {
+    if ((id & LOD_MATERIAL) == 0) return materials[id];
+    uvec2 cell = lodCells[id & ~LOD_MATERIAL];
+    float emission = uintBitsToFloat(cell.y);
+    return Material(unpackUnorm4x8(cell.x).rgb, vec3(emission, 0, 0));
+}
+
+void write_aovs(Hit hit) {
+    int idx = glPos.y * glSize.x + glPos.x;
+    bool miss = hit.norm == ivec3(0);
+    albedoImg[idx] = miss ? bg.color : materials[hit.material].color;
+    normalImg[idx] = vec3(hit.norm);
+}
+
+// primary hits are packed as (dist, normal axis | normal sign | material)
+uvec2 pack_hit(Hit hit) {
+    ivec3 a = abs(hit.norm);
+    uint axis = uint(a.x + a.y * 2 + a.z * 3);
+    uint negative = uint(hit.norm.x + hit.norm.y + hit.norm.z < 0);
+    return uvec2(floatBitsToUint(hit.dist), axis | negative << 2 | hit.material << 3);
+}
+
+Hit unpack_hit(uvec2 packed) {
+    uint axis = packed.y & 3;
+    ivec3 norm = ivec3(equal(uvec3(1, 2, 3), uvec3(axis)));
+    if ((packed.y & 4) != 0) norm = -norm;
+    return Hit(uintBitsToFloat(packed.x), norm, packed.y >> 3);
+}
+
+vec3 load_accum(int idx) {
+#if ACCUM_FORMAT == ACCUM_PACKED
+    return vec3(img[idx * 3], img[idx * 3 + 1], img[idx * 3 + 2]);
+#elif ACCUM_FORMAT == ACCUM_HALF
+    return vec3(unpackHalf2x16(img[idx].x), unpackHalf2x16(img[idx].y).x);
+#else
+    return img[idx];
+#endif
+}
+
+void store_accum(int idx, vec3 color) {
+#if ACCUM_FORMAT == ACCUM_PACKED
+    img[idx * 3] = color.r;
+    img[idx * 3 + 1] = color.g;
+    img[idx * 3 + 2] = color.b;
+#elif ACCUM_FORMAT == ACCUM_HALF
+    img[idx] = uvec2(packHalf2x16(color.rg), packHalf2x16(vec2(color.b, 0)));
+#else
+    img[idx] = color;
+#endif
 }
 
 //============================================================================//
@@ -118,7 +401,7 @@ uint get_voxel(uvec3 pos) {
 //============================================================================//
 
 Ray generate_first_ray() {
-    vec2 pos = (vec2(glPos - glSize / 2) / vec2(glSize)) * cameraSensorSize;
+    vec2 pos = (vec2(viewPos - viewSize / 2) / vec2(viewSize)) * cameraSensorSize;
     pos = rotate(pos, cameraDir.z);
 
     vec3 dir = vec3(pos, cameraFocalLegnth);
@@ -128,12 +411,12 @@ Ray generate_first_ray() {
     return create_ray(cameraPos, dir);
 }
 
-float ray_scene_intersection(Ray ray) {
-    if (in_scene_bounds(ray.origin)) return 0;
+float ray_box_intersection(Ray ray, uvec3 size) {
+    if (in_bounds(ray.origin, size)) return 0;
 
     vec3 dirInv = 1.0 / ray.dir;
     vec3 tBottom = dirInv * (vec3(0) - ray.origin);
-    vec3 tTop = dirInv * (sceneSize - ray.origin);
+    vec3 tTop = dirInv * (size - ray.origin);
 
     vec3 tMin = min(tTop, tBottom);
     vec3 tMax = max(tTop, tBottom);
@@ -145,8 +428,11 @@ float ray_scene_intersection(Ray ray) {
     return dHigh > max(dLow, 0.0) ? dLow : -1;
 }
 
-Hit traverse(Ray ray) {
-    float d = ray_scene_intersection(ray);
+// traverses the scene grid (NO_MODEL), its level of detail (LOD_GRID) or the
+// grid of a model
+Hit traverse_grid(Ray ray, uvec3 size, uint model) {
+    float d = ray_box_intersection(ray, size);
+    if (d < 0) return Hit(0, ivec3(0), 0);
     ray.origin += ray.dir * d * (1 - EPSILON);
 
     ivec3 pos = ivec3(floor(ray.origin));
@@ -180,9 +466,13 @@ Hit traverse(Ray ray) {
             }
         }
 
-        if (!in_scene_bounds(pos)) return Hit(0, ivec3(0), 0);
+        if (!in_bounds(pos, size)) return Hit(0, ivec3(0), 0);
 
-        uint materialID = get_voxel(uvec3(pos));
+        uint materialID = model == NO_MODEL
+            ? get_voxel(uvec3(pos))
+            : model == LOD_GRID
+            ? get_lod_voxel(uvec3(pos), size)
+            : get_model_voxel(model, uvec3(pos));
 
         if (materialID != 0) {
             float dist = length((tMax - tDelta) * vec3(mask)) + d;
@@ -192,12 +482,142 @@ Hit traverse(Ray ray) {
     }
 }
 
+vec3 to_model(Instance instance, vec3 v) {
+    return vec3(
+        dot(vec3(instance.rot[0].xyz), v),
+        dot(vec3(instance.rot[1].xyz), v),
+        dot(vec3(instance.rot[2].xyz), v)
+    );
+}
+
+Hit traverse_instance(Ray ray, Instance instance) {
+    // rotate around the centers of the placed and the original model
+    uvec4 model = models[instance.offset.w];
+    vec3 center = vec3(instance.offset.xyz) + vec3(instance.size.xyz) / 2;
+    Ray local = Ray(
+        to_model(instance, ray.origin - center) + vec3(model.xyz) / 2,
+        to_model(instance, ray.dir)
+    );
+
+    Hit hit = traverse_grid(local, model.xyz, uint(instance.offset.w));
+
+    // back to world space with the transposed rotation
+    hit.norm = hit.norm.x * instance.rot[0].xyz
+             + hit.norm.y * instance.rot[1].xyz
+             + hit.norm.z * instance.rot[2].xyz;
+    return hit;
+}
+
+// walks the instance grid and returns the closest of hit and the instance hits
+Hit traverse_instances(Ray ray, Hit hit) {
+    uvec3 cells = gridInfo.xyz;
+    if (cells.x == 0) return hit;
+
+    float cellSize = float(gridInfo.w);
+    Ray cellRay = Ray(ray.origin / cellSize, ray.dir);
+    float d = ray_box_intersection(cellRay, cells);
+    if (d < 0) return hit;
+    vec3 origin = cellRay.origin + cellRay.dir * d * (1 - EPSILON);
+
+    // unlike traverse_grid, the first cell is visited as well
+    ivec3 pos = clamp(ivec3(floor(origin)), ivec3(0), ivec3(cells) - 1);
+    ivec3 step = ivec3(sign(ray.dir));
+    vec3 tDelta = abs(length(ray.dir) / ray.dir);
+    vec3 tMax = (sign(ray.dir) * (pos - origin) + (sign(ray.dir) * 0.5) + 0.5) * tDelta;
+    uint cellCount = cells.x * cells.y * cells.z;
+
+    while (in_bounds(pos, cells)) {
+        uint cell = (pos.z * cells.y + pos.y) * cells.x + pos.x;
+        for (uint i = gridData[cell]; i < gridData[cell + 1]; i++) {
+            Hit h = traverse_instance(ray, instances[gridData[cellCount + 1 + i]]);
+            bool closer = hit.norm == ivec3(0) || h.dist < hit.dist;
+            if (h.norm != ivec3(0) && closer) hit = h;
+        }
+
+        // instances in later cells can't be closer than the end of this one
+        float exit = (d + min(tMax.x, min(tMax.y, tMax.z))) * cellSize;
+        if (hit.norm != ivec3(0) && hit.dist <= exit) return hit;
+
+        if (tMax.x < tMax.y && tMax.x < tMax.z) {
+            tMax.x += tDelta.x;
+            pos.x += step.x;
+        } else if (tMax.y < tMax.z) {
+            tMax.y += tDelta.y;
+            pos.y += step.y;
+        } else {
+            tMax.z += tDelta.z;
+            pos.z += step.z;
+        }
+    }
+
+    return hit;
+}
+
+Hit traverse_lod(Ray ray) {
+    uint scale = 1u << lodLevel;
+    uvec3 size = (sceneSize + scale - 1) >> lodLevel;
+    Hit hit = traverse_grid(Ray(ray.origin / scale, ray.dir), size, LOD_GRID);
+    hit.dist *= scale;
+    return hit;
+}
+
+// rays after lodBounce bounces or further than lodDistance from the camera
+// only contribute diffuse light, they can trace the coarse level instead
+bool use_lod(int bounce, Ray ray) {
+    if (lodLevel == 0 || bounce == 0) return false;
+    if (lodBounce != 0 && bounce >= lodBounce) return true;
+    return lodDistance > 0 && distance(ray.origin, cameraPos) > lodDistance;
+}
+
+Hit traverse(Ray ray, bool lod) {
+    Hit hit = lod ? traverse_lod(ray) : traverse_grid(ray, sceneSize, NO_MODEL);
+    return traverse_instances(ray, hit);
+}
+
+// primary rays are the same every iteration, with cachePrimary they are only
+// traced once
+Hit primary_hit(Ray ray) {
+    if (cachePrimary == 0) return traverse(ray, false);
+
+    int idx = glPos.y * glSize.x + glPos.x;
+    if (sampleIndex == 1) {
+        Hit hit = traverse(ray, false);
+        primaryHits[idx] = pack_hit(hit);
+        return hit;
+    }
+    return unpack_hit(primaryHits[idx]);
+}
+
+// previews shade the primary hit directly instead of tracing paths: emitters
+// glow, everything else gets its color under the background light (white for
+// dark backgrounds), dimmed where the surface faces away from the camera
+vec3 get_preview_color(Ray ray) {
+    Hit hit = primary_hit(ray);
+    if (writeAOVs != 0 && sampleIndex == 1) write_aovs(hit);
+
+    vec3 light = bg.properties.x > 0 ? bg.color * bg.properties.x : vec3(1);
+    if (hit.norm == ivec3(0)) return bg.color * bg.properties.x;
+
+    Material material = get_material(hit.material);
+    if (material.properties.x > 0)
+    return material.color * material.properties.x;
+
+    float facing = abs(dot(vec3(hit.norm), normalize(ray.dir)));
+    return material.color * light * (0.25 + 0.75 * facing);
+}
+
 vec3 get_color(Ray ray) {
+    if (preview != 0) return get_preview_color(ray);
+
     vec3 throughput = vec3(1, 1, 1);
 
     for (int i = 0; i < maxRayDepth; i++) {
-        Hit hit = traverse(ray);
-        Material material = materials[hit.material];
+        Hit hit = i == 0 ? primary_hit(ray) : traverse(ray, use_lod(i, ray));
+
+        Material material = get_material(hit.material);
+
+        // primary rays are the same every iteration, so the first one is enough
+        if (i == 0 && writeAOVs != 0 && sampleIndex == 1) write_aovs(hit);
 
         if (hit.norm == ivec3(0))
         return bg.color * bg.properties.x * throughput;
@@ -221,8 +641,22 @@ vec3 get_color(Ray ray) {
 //============================================================================//
 
 void main() {
-    vec3 color = get_color(generate_first_ray());
-    vec3 oldColor = img[glPos.y * glSize.x + glPos.x];
-    vec3 newColor = (oldColor * (iteration - 1) + color) / iteration;
-    img[glPos.y * glSize.x + glPos.x] = newColor;
+    int idx = glPos.y * glSize.x + glPos.x;
+
+    // converts the accumulated image into plain vec3s for the later passes
+    if (resolve != 0) {
+        resolvedImg[idx] = load_accum(idx);
+        return;
+    }
+
+    vec3 color = vec3(0);
+    for (uint i = 0; i < batchSize; i++, sampleIndex++) {
+        seed_sample(sampleIndex - 1);
+        color += get_color(generate_first_ray());
+    }
+
+    // the first batch doesn't need to read the (uninitialized) old image
+    vec3 oldColor = iteration == batchSize ? vec3(0) : load_accum(idx);
+    vec3 newColor = (oldColor * (iteration - batchSize) + color) / iteration;
+    store_accum(idx, newColor);
 }
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "logger/logger.h"
+
+static const char* configFormat
+    = "{"
+      "    output_file: s,"
+      "    output_format: s,"
+      "    logger: l,"
+      "    log_level: i,"
+      "    device_selector: l,"
+      "    renderer: {"
+      "        renderer_code: s,"
+      "        iteration_code: s,"
+      "        output_code: s,"
+      "        denoise_code: s,"
+      "        workgroup_size: {1: i, 2: i},"
+      "        workgroup_cache: s,"
+      "        image_size: {1: i, 2: i},"
+      "        iterations: i,"
+      "        first_iteration: i,"
+      "        seed: i,"
+      "        time_budget_ms: i,"
+      "        target_noise: f,"
+      "        samples_per_dispatch: i,"
+      "        max_depth: i,"
+      "        denoise_passes: i,"
+      "        denoise_on_cpu: b,"
+      "        cache_primary: b,"
+      "        specialize: b,"
+      "        accumulation_format: s,"
+      "        stream_target: s,"
+      "        stream_interval: f,"
+      "        stream_iterations: i,"
+      "        partial_file: s,"
+      "        lod_bounce: i,"
+      "        lod_distance: f"
+      "    },"
+      "    scene: {"
+      "        size: {1: i, 2: i, 3: i},"
+      "        bg: {color: {1: f, 2: f, 3: f}, emission: f},"
+      "        layout: s,"
+      "        voxel_format: s,"
+      "        lod_level: i,"
+      "        release_host_copy: b,"
+      "        generator: s,"
+      "        generator_readback: b,"
+      "        voxel_placer: l"
+      "    },"
+      "    camera: {"
+      "        sensor_size: {1: f, 2: f},"
+      "        focal_length: f,"
+      "        position: {1: f, 2: f, 3: f},"
+      "        rotation: {1: f, 2: f, 3: f}"
+      "    }"
+      "}";
+
+// a workgroup size of "auto" is turned into 0x0, which the renderer tunes
+static void replace_auto_workgroup_size(lua_State* l) {
+    if (lua_getfield(l, -1, "renderer") == LUA_TTABLE) {
+        lua_getfield(l, -1, "workgroup_size");
+        bool isAuto = lua_type(l, -1) == LUA_TSTRING
+                   && strcmp(lua_tostring(l, -1), "auto") == 0;
+        lua_pop(l, 1);
+
+        if (isAuto) {
+            lua_push_f(l, "{1: i, 2: i}", 0, 0);
+            lua_setfield(l, -2, "workgroup_size");
+        }
+    }
+    lua_pop(l, 1);
+}
+
+// camera views are a list of {position, rotation} tables or "cubemap" (six
+// views from the camera position along the world axes), they are parsed here
+// and removed so that the rest of the config keeps a fixed format
+static bool parse_camera_views(lua_State* l, CameraCreateInfo* info) {
+    static const float cubemapRotations[6][2] = {
+        {0, 0}, {90, 0}, {180, 0}, {270, 0}, {0, 90}, {0, -90},
+    };
+
+    int top = lua_gettop(l);
+    if (lua_getfield(l, -1, "camera") != LUA_TTABLE) {
+        lua_settop(l, top);
+        return true;
+    }
+    int camera = lua_gettop(l);
+    int type = lua_getfield(l, camera, "views");
+    int views = lua_gettop(l);
+
+    bool res = true;
+    if (type == LUA_TSTRING && strcmp(lua_tostring(l, -1), "cubemap") == 0) {
+        vec3 pos = {0};
+        lua_getfield(l, camera, "position");
+        res = lua_pop_f(l, "{1: f, 2: f, 3: f}", &pos.x, &pos.y, &pos.z);
+
+        info->viewCount = 6;
+        info->views = malloc(sizeof *info->views * info->viewCount);
+        for (uint i = 0; i < info->viewCount; i++) {
+            info->views[i] = (CameraViewInfo){
+                .pos = pos,
+                .rot = {cubemapRotations[i][0], cubemapRotations[i][1], 0},
+            };
+        }
+    } else if (type == LUA_TTABLE) {
+        info->viewCount = lua_rawlen(l, views);
+        info->views = calloc(info->viewCount, sizeof *info->views);
+        for (uint i = 0; i < info->viewCount && res; i++) {
+            CameraViewInfo* view = &info->views[i];
+            lua_rawgeti(l, views, i + 1);
+            res = lua_pop_f(
+                l,
+                "{position: {1: f, 2: f, 3: f}, rotation: {1: f, 2: f, 3: f}}",
+                &view->pos.x,
+                &view->pos.y,
+                &view->pos.z,
+                &view->rot.x,
+                &view->rot.y,
+                &view->rot.z
+            );
+            lua_settop(l, views);
+        }
+    } else if (type != LUA_TNIL) {
+        ERROR("camera views must be a list of views or \"cubemap\"");
+        res = false;
+    }
+
+    lua_pushnil(l);
+    lua_setfield(l, camera, "views");
+    lua_settop(l, top);
+    return res;
+}
+
+#define NAME_COUNT(names) (sizeof names / sizeof *names)
+
+// indexed by AccumFormat
+static const char* accumFormatNames[] = {"vec3", "packed", "half"};
+
+// indexed by ImageFormat
+static const char* imageFormatNames[] = {"bmp", "png", "qoi"};
+
+// indexed by VoxelLayout
+static const char* voxelLayoutNames[] = {"linear", "morton", "brick", "dag"};
+
+// indexed by VoxelFormat
+static const char* voxelFormatNames[] = {"r32", "r16", "r8"};
+
+static bool parse_name(
+    const char* name,
+    const char** names,
+    uint nameCount,
+    int* value,
+    const char* what
+) {
+    for (uint i = 0; i < nameCount; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *value = (int)i;
+            return true;
+        }
+    }
+
+    ERROR("unknown %s \"%s\"", what, name);
+    return false;
+}
+
+bool config_parse(lua_State* l, Config* config) {
+    // zeroed so that padding is deterministic (scenes are hashed)
+    memset(config, 0, sizeof *config);
+    config->logFunction = LUA_NOREF;
+    config->deviceFunction = LUA_NOREF;
+    config->sceneDataFunction = LUA_NOREF;
+
+    RenderSettings* renderSettings = &config->renderSettings;
+    SceneCreateInfo* sceneCreateInfo = &config->sceneCreateInfo;
+    CameraCreateInfo* cameraCreateInfo = &config->cameraCreateInfo;
+
+    bool viewsRes = true;
+    if (lua_istable(l, -1)) {
+        replace_auto_workgroup_size(l);
+        viewsRes = parse_camera_views(l, cameraCreateInfo);
+    }
+
+    char* outputFormat = NULL;
+    char* accumFormat = NULL;
+    char* voxelLayout = NULL;
+    char* voxelFormat = NULL;
+    bool res = lua_pop_f(
+        l,
+        (char*)configFormat,
+        &config->outputFile,
+        &outputFormat,
+        &config->logFunction,
+        &config->logLevel,
+        &config->deviceFunction,
+        &renderSettings->rendererCode,
+        &renderSettings->iterationCode,
+        &renderSettings->outputCode,
+        &renderSettings->denoiseCode,
+        &renderSettings->wgSize.x,
+        &renderSettings->wgSize.y,
+        &renderSettings->wgCacheFile,
+        &renderSettings->imageSize.x,
+        &renderSettings->imageSize.y,
+        &renderSettings->iterations,
+        &renderSettings->firstIteration,
+        &renderSettings->seed,
+        &renderSettings->timeBudgetMs,
+        &renderSettings->targetNoise,
+        &renderSettings->batchSize,
+        &renderSettings->maxRayDepth,
+        &renderSettings->denoisePasses,
+        &renderSettings->denoiseOnCpu,
+        &renderSettings->cachePrimary,
+        &renderSettings->specialize,
+        &accumFormat,
+        &renderSettings->streamTarget,
+        &renderSettings->streamInterval,
+        &renderSettings->streamIterations,
+        &renderSettings->partialFile,
+        &renderSettings->lodBounce,
+        &renderSettings->lodDistance,
+        &sceneCreateInfo->size.x,
+        &sceneCreateInfo->size.y,
+        &sceneCreateInfo->size.z,
+        &sceneCreateInfo->bg.color.r,
+        &sceneCreateInfo->bg.color.g,
+        &sceneCreateInfo->bg.color.b,
+        &sceneCreateInfo->bg.properties.x,
+        &voxelLayout,
+        &voxelFormat,
+        &sceneCreateInfo->lodLevel,
+        &sceneCreateInfo->releaseHostCopy,
+        &sceneCreateInfo->generator,
+        &sceneCreateInfo->generatorReadback,
+        &config->sceneDataFunction,
+        &cameraCreateInfo->sensorSize.x,
+        &cameraCreateInfo->sensorSize.y,
+        &cameraCreateInfo->focalLength,
+        &cameraCreateInfo->pos.x,
+        &cameraCreateInfo->pos.y,
+        &cameraCreateInfo->pos.z,
+        &cameraCreateInfo->rot.x,
+        &cameraCreateInfo->rot.y,
+        &cameraCreateInfo->rot.z
+    );
+
+    int format = 0;
+    int accum = 0;
+    int layout = 0;
+    int voxel = 0;
+    res = res && viewsRes;
+    res = res
+       && parse_name(
+           outputFormat,
+           imageFormatNames,
+           NAME_COUNT(imageFormatNames),
+           &format,
+           "output format"
+       );
+    res = res
+       && parse_name(
+           accumFormat,
+           accumFormatNames,
+           NAME_COUNT(accumFormatNames),
+           &accum,
+           "accumulation format"
+       );
+    res = res
+       && parse_name(
+           voxelLayout,
+           voxelLayoutNames,
+           NAME_COUNT(voxelLayoutNames),
+           &layout,
+           "voxel layout"
+       );
+    res = res
+       && parse_name(
+           voxelFormat,
+           voxelFormatNames,
+           NAME_COUNT(voxelFormatNames),
+           &voxel,
+           "voxel format"
+       );
+
+    // an empty generator means the voxel placer builds the voxels
+    if (sceneCreateInfo->generator && sceneCreateInfo->generator[0] == '\0') {
+        free(sceneCreateInfo->generator);
+        sceneCreateInfo->generator = NULL;
+    }
+
+    config->outputFormat = (ImageFormat)format;
+    renderSettings->accumFormat = (AccumFormat)accum;
+    sceneCreateInfo->layout = (VoxelLayout)layout;
+    sceneCreateInfo->format = (VoxelFormat)voxel;
+    free(outputFormat);
+    free(accumFormat);
+    free(voxelLayout);
+    free(voxelFormat);
+    return res;
+}
+
+void config_free(lua_State* l, Config* config) {
+    free(config->outputFile);
+    free(config->renderSettings.rendererCode);
+    free(config->renderSettings.iterationCode);
+    free(config->renderSettings.outputCode);
+    free(config->renderSettings.denoiseCode);
+    free(config->renderSettings.wgCacheFile);
+    free(config->renderSettings.streamTarget);
+    free(config->renderSettings.partialFile);
+    free(config->sceneCreateInfo.generator);
+    free(config->cameraCreateInfo.views);
+
+    luaL_unref(l, LUA_REGISTRYINDEX, config->logFunction);
+    luaL_unref(l, LUA_REGISTRYINDEX, config->deviceFunction);
+    luaL_unref(l, LUA_REGISTRYINDEX, config->sceneDataFunction);
+
+    memset(config, 0, sizeof *config);
+    config->logFunction = LUA_NOREF;
+    config->deviceFunction = LUA_NOREF;
+    config->sceneDataFunction = LUA_NOREF;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "image/image_writer.h"
+#include "lua/lua_extra.h"
+#include "renderer/renderer.h"
+
+typedef struct {
+    char* outputFile;                  ///< The file to write the image to
+    ImageFormat outputFormat;          ///< The format to write the image in
+    int logFunction;                   ///< The log function (registry index)
+    int logLevel;                      ///< The minimum log level
+    int deviceFunction;                ///< The device selector (registry index)
+    int sceneDataFunction;             ///< The voxel placer (registry index)
+    RenderSettings renderSettings;     ///< The render settings
+    SceneCreateInfo sceneCreateInfo;   ///< The scene settings
+    CameraCreateInfo cameraCreateInfo; ///< The camera settings
+} Config;
+
+/**
+ * @brief Pop a config table from a lua_State
+ * @param l The lua_State with the config table on top of the stack
+ * @param config The config to fill in
+ * @return true if the config was parsed successfully, false otherwise
+ */
+bool config_parse(lua_State* l, Config* config);
+
+/**
+ * @brief Free the strings and function references held by a config
+ * @param l The lua_State the config was parsed from
+ * @param config The config to free
+ */
+void config_free(lua_State* l, Config* config);
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "job_queue.h"
+#include "logger/logger.h"
+
+typedef struct {
+    Job job;
+    unsigned long order;
+} QueuedJob;
+
+struct JobQueue {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    QueuedJob* jobs;
+    int jobCount;
+    int jobCapacity;
+    unsigned long nextOrder;
+    bool closed;
+    FILE* stream;
+    pthread_t reader;
+    bool readerStarted;
+};
+
+JobQueue* job_queue_create(void) {
+    JobQueue* queue = malloc(sizeof *queue);
+    *queue = (JobQueue){.jobCapacity = 8};
+    queue->jobs = malloc(sizeof *queue->jobs * queue->jobCapacity);
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    return queue;
+}
+
+void job_queue_destroy(JobQueue* queue) {
+    CHECK_NULL(queue)
+    // a reader that is still waiting for input is stopped, one that finished
+    // is unaffected
+    if (queue->readerStarted) {
+        pthread_cancel(queue->reader);
+        pthread_join(queue->reader, NULL);
+    }
+    for (int i = 0; i < queue->jobCount; i++) free(queue->jobs[i].job.jobFile);
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->cond);
+    free(queue->jobs);
+    free(queue);
+}
+
+void job_queue_push(JobQueue* queue, int priority, const char* jobFile) {
+    CHECK_NULL(queue)
+    CHECK_NULL(jobFile)
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->jobCount == queue->jobCapacity) {
+        queue->jobCapacity *= 2;
+        queue->jobs = realloc(
+            queue->jobs,
+            sizeof *queue->jobs * queue->jobCapacity
+        );
+    }
+
+    queue->jobs[queue->jobCount++] = (QueuedJob){
+        .job = {.priority = priority, .jobFile = strdup(jobFile)},
+        .order = queue->nextOrder++,
+    };
+
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+bool job_queue_pop(JobQueue* queue, Job* job) {
+    CHECK_NULL(queue, false)
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->jobCount == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+
+    if (queue->jobCount == 0) {
+        pthread_mutex_unlock(&queue->mutex);
+        return false;
+    }
+
+    // queues are short, a linear search is plenty
+    int best = 0;
+    for (int i = 1; i < queue->jobCount; i++) {
+        QueuedJob* a = &queue->jobs[i];
+        QueuedJob* b = &queue->jobs[best];
+        if (a->job.priority > b->job.priority
+            || (a->job.priority == b->job.priority && a->order < b->order)) {
+            best = i;
+        }
+    }
+
+    *job = queue->jobs[best].job;
+    queue->jobs[best] = queue->jobs[--queue->jobCount];
+
+    pthread_mutex_unlock(&queue->mutex);
+    return true;
+}
+
+void job_queue_close(JobQueue* queue) {
+    CHECK_NULL(queue)
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static void free_line(void* line) {
+    free(*(char**)line);
+}
+
+static void* job_queue_reader(void* arg) {
+    JobQueue* queue = arg;
+    char* line = NULL;
+    size_t lineSize = 0;
+
+    // only cancelled while waiting for input, never while logging or holding
+    // the queue mutex
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_cleanup_push(free_line, &line);
+    while (true) {
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        ssize_t length = getline(&line, &lineSize, queue->stream);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (length == -1) break;
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        int priority;
+        int fileStart;
+        if (sscanf(line, "%d %n", &priority, &fileStart) != 1
+            || line[fileStart] == '\0') {
+            if (line[0] != '\0') WARN("invalid job \"%s\"", line);
+            continue;
+        }
+
+        INFO("queued job \"%s\" (priority %d)", line + fileStart, priority);
+        job_queue_push(queue, priority, line + fileStart);
+    }
+    pthread_cleanup_pop(true);
+
+    job_queue_close(queue);
+    return NULL;
+}
+
+bool job_queue_start_reader(JobQueue* queue, FILE* stream) {
+    CHECK_NULL(queue, false)
+    CHECK_NULL(stream, false)
+
+    queue->stream = stream;
+    if (pthread_create(&queue->reader, NULL, job_queue_reader, queue) != 0) {
+        return false;
+    }
+    queue->readerStarted = true;
+    return true;
+}
\ No newline at end of file
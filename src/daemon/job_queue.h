@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct {
+    int priority;  ///< Jobs with a higher priority are run first
+    char* jobFile; ///< The job file, "-" for the base config as is
+} Job;
+
+typedef struct JobQueue JobQueue;
+
+/**
+ * @brief Create a new (empty) job queue
+ * @return A new job queue
+ */
+JobQueue* job_queue_create(void);
+
+/**
+ * @brief Destroy a job queue, a reader thread that is still waiting for input
+ * is stopped
+ * @param queue The job queue to destroy
+ */
+void job_queue_destroy(JobQueue* queue);
+
+/**
+ * @brief Add a job to a queue
+ * @param queue The queue to add the job to
+ * @param priority The priority of the job
+ * @param jobFile The job file (copied)
+ */
+void job_queue_push(JobQueue* queue, int priority, const char* jobFile);
+
+/**
+ * @brief Take the job with the highest priority from a queue (the oldest one
+ * if there are several), waiting for one if the queue is empty
+ * @param queue The queue to take the job from
+ * @param job The job (the job file must be freed by the caller)
+ * @return true if a job was taken, false if the queue is empty and closed
+ */
+bool job_queue_pop(JobQueue* queue, Job* job);
+
+/**
+ * @brief Close a queue, job_queue_pop returns false once it is empty
+ * @param queue The queue to close
+ */
+void job_queue_close(JobQueue* queue);
+
+/**
+ * @brief Start a thread that reads jobs from a stream, one per line in the
+ * form "<priority> <job file>", and closes the queue at the end of the stream
+ * @param queue The queue to add the jobs to
+ * @param stream The stream to read from
+ * @return true if the thread was started, false otherwise
+ */
+bool job_queue_start_reader(JobQueue* queue, FILE* stream);
\ No newline at end of file
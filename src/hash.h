@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_INIT 0xcbf29ce484222325ull
+
+/**
+ * @brief Hash a block of memory with 64 bit FNV-1a
+ * @param hash The hash to continue from (HASH_INIT for a new hash)
+ * @param data The data to hash
+ * @param size The size of the data in bytes
+ * @return The updated hash
+ */
+static inline uint64_t hash_bytes(
+    uint64_t hash,
+    const void* data,
+    size_t size
+) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
\ No newline at end of file
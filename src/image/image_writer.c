@@ -0,0 +1,112 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "image_writer.h"
+#include "logger/logger.h"
+#include "png.h"
+#include "qoi.h"
+#include "stb/stb_image_write.h"
+
+struct ImageWriter {
+    char* fileName;
+    unsigned char* image;
+    uvec2 size;
+    ImageFormat format;
+    bool res;
+    pthread_t thread;
+};
+
+static bool write_file(const char* fileName, const void* data, size_t size) {
+    FILE* file = fopen(fileName, "wb");
+    if (file == NULL) return false;
+    bool res = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && res;
+}
+
+bool image_write(
+    const char* fileName,
+    const unsigned char* image,
+    uvec2 size,
+    ImageFormat format
+) {
+    CHECK_NULL(fileName, false)
+    CHECK_NULL(image, false)
+
+    double start = mc_get_time();
+    unsigned char* data = NULL;
+    size_t dataSize = 0;
+    bool res;
+
+    switch (format) {
+        case IMAGE_FORMAT_PNG:
+            data = png_encode(image, size, 0, &dataSize);
+            res = data && write_file(fileName, data, dataSize);
+            break;
+        case IMAGE_FORMAT_QOI:
+            data = qoi_encode(image, size, &dataSize);
+            res = data && write_file(fileName, data, dataSize);
+            break;
+        default:
+            res = stbi_write_bmp(fileName, size.x, size.y, 4, image) != 0;
+            break;
+    }
+    free(data);
+
+    if (res) {
+        DEBUG("wrote \"%s\" in %.3fs", fileName, mc_get_time() - start);
+    } else {
+        ERROR("failed to write \"%s\"", fileName);
+    }
+    return res;
+}
+
+static void* image_writer_thread(void* arg) {
+    ImageWriter* writer = arg;
+    writer->res = image_write(
+        writer->fileName,
+        writer->image,
+        writer->size,
+        writer->format
+    );
+    return NULL;
+}
+
+ImageWriter* image_writer_start(
+    const char* fileName,
+    unsigned char* image,
+    uvec2 size,
+    ImageFormat format
+) {
+    CHECK_NULL(fileName, NULL)
+    CHECK_NULL(image, NULL)
+
+    ImageWriter* writer = malloc(sizeof *writer);
+    *writer = (ImageWriter){
+        .fileName = strdup(fileName),
+        .image = image,
+        .size = size,
+        .format = format,
+    };
+
+    if (pthread_create(&writer->thread, NULL, image_writer_thread, writer)
+        != 0) {
+        ERROR("failed to start image writer");
+        free(writer->fileName);
+        free(writer->image);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+bool image_writer_finish(ImageWriter* writer) {
+    CHECK_NULL(writer, false)
+    pthread_join(writer->thread, NULL);
+    bool res = writer->res;
+    free(writer->fileName);
+    free(writer->image);
+    free(writer);
+    return res;
+}
\ No newline at end of file
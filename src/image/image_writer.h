@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "vector.h"
+
+typedef enum {
+    IMAGE_FORMAT_BMP, ///< Uncompressed (stb)
+    IMAGE_FORMAT_PNG, ///< Compressed on every core
+    IMAGE_FORMAT_QOI, ///< Compressed on one core, faster than PNG
+} ImageFormat;
+
+typedef struct ImageWriter ImageWriter;
+
+/**
+ * @brief Encode and write an RGBA image
+ * @param fileName The file to write to
+ * @param image The image to write (4 bytes per pixel)
+ * @param size The size of the image
+ * @param format The format to write the image in
+ * @return true on success
+ */
+bool image_write(
+    const char* fileName,
+    const unsigned char* image,
+    uvec2 size,
+    ImageFormat format
+);
+
+/**
+ * @brief Start encoding and writing an RGBA image on a background thread
+ * @param fileName The file to write to
+ * @param image The image to write (4 bytes per pixel), the writer takes
+ * ownership of it
+ * @param size The size of the image
+ * @param format The format to write the image in
+ * @return A new image writer, NULL on failure (the image is freed)
+ */
+ImageWriter* image_writer_start(
+    const char* fileName,
+    unsigned char* image,
+    uvec2 size,
+    ImageFormat format
+);
+
+/**
+ * @brief Wait for an image writer to finish and destroy it
+ * @param writer The image writer
+ * @return true if the image was written successfully
+ */
+bool image_writer_finish(ImageWriter* writer);
\ No newline at end of file
@@ -0,0 +1,747 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logger/logger.h"
+#include "png.h"
+
+#define PNG_BPP 4 // RGBA
+#define PNG_MIN_STRIP_ROWS 16
+#define PNG_MAX_THREADS 64
+
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_MIN_MATCH 4
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_BLOCK_TOKENS 65536 // each block gets its own huffman codes
+#define DEFLATE_LIT_CODES 286
+#define DEFLATE_DIST_CODES 30
+#define DEFLATE_CL_CODES 19
+#define DEFLATE_MAX_BITS 15
+#define DEFLATE_MAX_CL_BITS 7
+
+#define ADLER_BASE 65521
+#define ADLER_BLOCK 5552 // the most bytes before the sums can overflow
+
+// a huffman code, bit reversed since deflate packs codes starting with their
+// most significant bit
+typedef struct {
+    uint16_t code;
+    uint8_t length;
+} HuffCode;
+
+// the part of the image one thread filters and compresses, its output is a
+// complete IDAT chunk that ends on a byte boundary so that the chunks can be
+// concatenated
+typedef struct {
+    const unsigned char* image;
+    uvec2 size;
+    uint firstRow;
+    uint rowCount;
+    bool last;
+    unsigned char* chunk; ///< NULL on failure
+    size_t chunkSize;
+    uint32_t adler;  ///< The adler32 of the filtered rows
+    size_t dataSize; ///< The size of the filtered rows
+} PngStrip;
+
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    uint64_t bits;
+    uint count;
+} BitWriter;
+
+// the code lengths of a dynamic block, run length encoded
+typedef struct {
+    uint litCount;
+    uint distCount;
+    uint clCount;
+    uint8_t clLengths[DEFLATE_CL_CODES];
+    HuffCode clCodes[DEFLATE_CL_CODES];
+    uint16_t rle[DEFLATE_LIT_CODES + DEFLATE_DIST_CODES]; ///< symbol | extra<<8
+    uint rleCount;
+} DynamicHeader;
+
+typedef struct {
+    uint32_t freq;
+    uint16_t symbol;
+} HuffLeaf;
+
+static const uint16_t lengthBase[29] = {
+    3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+    31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const uint8_t lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+    2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const uint16_t distBase[30] = {
+    1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+    33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+    1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577,
+};
+static const uint8_t distExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+    6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+// the order in which the code length code lengths are stored
+static const uint8_t clOrder[DEFLATE_CL_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+static HuffCode fixedLitCodes[288];
+static HuffCode fixedDistCodes[DEFLATE_DIST_CODES];
+static uint8_t lengthSymbols[DEFLATE_MAX_MATCH + 1];
+static uint8_t distSymbols[512]; // see dist_symbol
+static uint32_t crcTable[256];
+static pthread_once_t tablesOnce = PTHREAD_ONCE_INIT;
+
+static uint reverse_bits(uint v, uint length) {
+    uint r = 0;
+    for (uint i = 0; i < length; i++) r = r << 1 | (v >> i & 1);
+    return r;
+}
+
+// distances up to 256 are looked up directly, larger ones by their upper
+// bits (all their codes have at least 7 extra bits)
+static uint dist_symbol(uint dist) {
+    uint d = dist - 1;
+    return distSymbols[d < 256 ? d : 256 + (d >> 7)];
+}
+
+static void init_tables(void) {
+    for (uint i = 0; i < 288; i++) {
+        uint code, length;
+        if (i < 144) {
+            code = 0x30 + i;
+            length = 8;
+        } else if (i < 256) {
+            code = 0x190 + i - 144;
+            length = 9;
+        } else if (i < 280) {
+            code = i - 256;
+            length = 7;
+        } else {
+            code = 0xc0 + i - 280;
+            length = 8;
+        }
+        fixedLitCodes[i] = (HuffCode){reverse_bits(code, length), length};
+    }
+
+    for (uint i = 0; i < 30; i++) {
+        fixedDistCodes[i] = (HuffCode){reverse_bits(i, 5), 5};
+        uint end = distBase[i] + (1u << distExtra[i]);
+        for (uint dist = distBase[i]; dist < end; dist++) {
+            uint d = dist - 1;
+            distSymbols[d < 256 ? d : 256 + (d >> 7)] = i;
+        }
+    }
+
+    // 258 has its own code, the one before only goes up to 257
+    for (uint i = 0; i < 29; i++) {
+        uint end = i == 28 ? DEFLATE_MAX_MATCH + 1 : lengthBase[i + 1];
+        for (uint len = lengthBase[i]; len < end; len++) lengthSymbols[len] = i;
+    }
+
+    for (uint i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320 ^ c >> 1 : c >> 1;
+        crcTable[i] = c;
+    }
+}
+
+static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size) {
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = crcTable[(crc ^ data[i]) & 0xff] ^ crc >> 8;
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const unsigned char* data, size_t size) {
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        size_t block = size < ADLER_BLOCK ? size : ADLER_BLOCK;
+        size -= block;
+        while (block--) {
+            a += *data++;
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+    return b << 16 | a;
+}
+
+// the adler32 of two concatenated buffers, from their adler32s
+static uint32_t adler32_combine(
+    uint32_t adler1,
+    uint32_t adler2,
+    size_t size2
+) {
+    uint32_t rem = size2 % ADLER_BASE;
+    uint32_t a1 = adler1 & 0xffff, b1 = adler1 >> 16;
+    uint32_t a2 = adler2 & 0xffff, b2 = adler2 >> 16;
+    uint32_t a = (a1 + a2 + ADLER_BASE - 1) % ADLER_BASE;
+    uint32_t b = (uint32_t)(((uint64_t)rem * a1 + b1 + b2 + ADLER_BASE - rem)
+                            % ADLER_BASE);
+    return b << 16 | a;
+}
+
+static void put_u32(unsigned char* out, uint32_t v) {
+    out[0] = v >> 24;
+    out[1] = v >> 16;
+    out[2] = v >> 8;
+    out[3] = v;
+}
+
+static void put_bits(BitWriter* w, uint value, uint length) {
+    w->bits |= (uint64_t)value << w->count;
+    w->count += length;
+    while (w->count >= 8) {
+        w->data[w->size++] = w->bits;
+        w->bits >>= 8;
+        w->count -= 8;
+    }
+}
+
+static void align_bits(BitWriter* w) {
+    if (w->count > 0) put_bits(w, 0, 8 - w->count);
+}
+
+static void put_code(BitWriter* w, HuffCode code) {
+    put_bits(w, code.code, code.length);
+}
+
+static uint32_t read_u32(const unsigned char* data) {
+    uint32_t v;
+    memcpy(&v, data, sizeof v);
+    return v;
+}
+
+static int compare_leaves(const void* a, const void* b) {
+    uint32_t fa = ((const HuffLeaf*)a)->freq, fb = ((const HuffLeaf*)b)->freq;
+    return (fa > fb) - (fa < fb);
+}
+
+// huffman code lengths with the two queue method (leaves sorted by frequency
+// and internal nodes, which are created in order of frequency), returns false
+// if a code is longer than maxLength
+static bool huffman_lengths(
+    const uint32_t* freqs,
+    uint count,
+    uint maxLength,
+    uint8_t* lengths
+) {
+    HuffLeaf leaves[DEFLATE_LIT_CODES];
+    uint n = 0;
+    for (uint i = 0; i < count; i++) {
+        lengths[i] = 0;
+        if (freqs[i] > 0) leaves[n++] = (HuffLeaf){freqs[i], i};
+    }
+
+    // a single code still gets a sibling, incomplete codes are not allowed
+    // everywhere
+    if (n == 0) return true;
+    if (n == 1) {
+        lengths[leaves[0].symbol] = 1;
+        lengths[leaves[0].symbol == 0 ? 1 : 0] = 1;
+        return true;
+    }
+    qsort(leaves, n, sizeof *leaves, compare_leaves);
+
+    uint32_t freq[DEFLATE_LIT_CODES * 2];
+    uint16_t parent[DEFLATE_LIT_CODES * 2];
+    uint16_t depth[DEFLATE_LIT_CODES * 2];
+    for (uint i = 0; i < n; i++) freq[i] = leaves[i].freq;
+
+    uint leaf = 0, node = n;
+    for (uint next = n; next < n * 2 - 1; next++) {
+        uint pick[2];
+        for (uint k = 0; k < 2; k++) {
+            bool useLeaf
+                = leaf < n && (node >= next || freq[leaf] <= freq[node]);
+            pick[k] = useLeaf ? leaf++ : node++;
+        }
+        freq[next] = freq[pick[0]] + freq[pick[1]];
+        parent[pick[0]] = parent[pick[1]] = next;
+    }
+
+    // parents always come after their children
+    depth[n * 2 - 2] = 0;
+    for (int i = (int)n * 2 - 3; i >= 0; i--) depth[i] = depth[parent[i]] + 1;
+    for (uint i = 0; i < n; i++) {
+        if (depth[i] > maxLength) return false;
+        lengths[leaves[i].symbol] = depth[i];
+    }
+    return true;
+}
+
+// flattens the frequencies until the codes fit, which costs a little
+// compression in the rare blocks that need it
+static void build_lengths(
+    const uint32_t* freqs,
+    uint count,
+    uint maxLength,
+    uint8_t* lengths
+) {
+    uint32_t scaled[DEFLATE_LIT_CODES];
+    memcpy(scaled, freqs, sizeof *freqs * count);
+    while (!huffman_lengths(scaled, count, maxLength, lengths)) {
+        for (uint i = 0; i < count; i++) {
+            if (scaled[i] > 0) scaled[i] = scaled[i] >> 1 | 1;
+        }
+    }
+}
+
+// canonical codes from their lengths
+static void build_codes(const uint8_t* lengths, uint count, HuffCode* codes) {
+    uint lengthCounts[DEFLATE_MAX_BITS + 1] = {0};
+    for (uint i = 0; i < count; i++) lengthCounts[lengths[i]]++;
+    lengthCounts[0] = 0;
+
+    uint next[DEFLATE_MAX_BITS + 1];
+    uint code = 0;
+    for (uint bits = 1; bits <= DEFLATE_MAX_BITS; bits++) {
+        code = (code + lengthCounts[bits - 1]) << 1;
+        next[bits] = code;
+    }
+
+    for (uint i = 0; i < count; i++) {
+        uint length = lengths[i];
+        uint16_t reversed = length ? reverse_bits(next[length]++, length) : 0;
+        codes[i] = (HuffCode){reversed, length};
+    }
+}
+
+static void put_rle(DynamicHeader* header, uint symbol, uint extra) {
+    header->rle[header->rleCount++] = symbol | extra << 8;
+}
+
+// run length encodes the code lengths and builds the code length code,
+// returns the size of the header in bits
+static size_t build_header(
+    const uint8_t* litLengths,
+    const uint8_t* distLengths,
+    DynamicHeader* header
+) {
+    static const uint clExtra[DEFLATE_CL_CODES]
+        = {[16] = 2, [17] = 3, [18] = 7};
+
+    *header = (DynamicHeader){
+        .litCount = DEFLATE_LIT_CODES,
+        .distCount = DEFLATE_DIST_CODES,
+        .clCount = DEFLATE_CL_CODES,
+    };
+    while (header->litCount > 257 && !litLengths[header->litCount - 1]) {
+        header->litCount--;
+    }
+    while (header->distCount > 1 && !distLengths[header->distCount - 1]) {
+        header->distCount--;
+    }
+
+    uint8_t lengths[DEFLATE_LIT_CODES + DEFLATE_DIST_CODES];
+    uint n = header->litCount + header->distCount;
+    memcpy(lengths, litLengths, header->litCount);
+    memcpy(lengths + header->litCount, distLengths, header->distCount);
+
+    for (uint i = 0; i < n;) {
+        uint v = lengths[i];
+        uint run = 1;
+        while (i + run < n && lengths[i + run] == v) run++;
+
+        if (v == 0 && run >= 3) {
+            uint r = run < 138 ? run : 138;
+            if (r >= 11) put_rle(header, 18, r - 11);
+            else put_rle(header, 17, r - 3);
+            i += r;
+        } else if (v != 0 && run >= 4) {
+            uint r = run - 1 < 6 ? run - 1 : 6;
+            put_rle(header, v, 0);
+            put_rle(header, 16, r - 3);
+            i += r + 1;
+        } else {
+            put_rle(header, v, 0);
+            i++;
+        }
+    }
+
+    uint32_t clFreqs[DEFLATE_CL_CODES] = {0};
+    for (uint i = 0; i < header->rleCount; i++) {
+        clFreqs[header->rle[i] & 0xff]++;
+    }
+    build_lengths(
+        clFreqs,
+        DEFLATE_CL_CODES,
+        DEFLATE_MAX_CL_BITS,
+        header->clLengths
+    );
+    build_codes(header->clLengths, DEFLATE_CL_CODES, header->clCodes);
+    while (header->clCount > 4
+           && !header->clLengths[clOrder[header->clCount - 1]]) {
+        header->clCount--;
+    }
+
+    size_t bits = 5 + 5 + 4 + 3 * header->clCount;
+    for (uint i = 0; i < DEFLATE_CL_CODES; i++) {
+        bits += clFreqs[i] * (header->clLengths[i] + clExtra[i]);
+    }
+    return bits;
+}
+
+static void put_header(BitWriter* w, DynamicHeader* header) {
+    put_bits(w, header->litCount - 257, 5);
+    put_bits(w, header->distCount - 1, 5);
+    put_bits(w, header->clCount - 4, 4);
+    for (uint i = 0; i < header->clCount; i++) {
+        put_bits(w, header->clLengths[clOrder[i]], 3);
+    }
+
+    for (uint i = 0; i < header->rleCount; i++) {
+        uint symbol = header->rle[i] & 0xff;
+        uint extra = header->rle[i] >> 8;
+        put_code(w, header->clCodes[symbol]);
+        if (symbol == 16) put_bits(w, extra, 2);
+        else if (symbol == 17) put_bits(w, extra, 3);
+        else if (symbol == 18) put_bits(w, extra, 7);
+    }
+}
+
+// tokens are literals (< 256) or matches (length << 16 | distance)
+static void put_block(
+    BitWriter* w,
+    const uint32_t* tokens,
+    uint count,
+    bool final
+) {
+    uint32_t litFreqs[DEFLATE_LIT_CODES] = {0};
+    uint32_t distFreqs[DEFLATE_DIST_CODES] = {0};
+    for (uint i = 0; i < count; i++) {
+        uint32_t token = tokens[i];
+        if (token < 256) {
+            litFreqs[token]++;
+        } else {
+            litFreqs[257 + lengthSymbols[token >> 16]]++;
+            distFreqs[dist_symbol(token & 0xffff)]++;
+        }
+    }
+    litFreqs[256] = 1; // end of block
+
+    uint8_t litLengths[DEFLATE_LIT_CODES];
+    uint8_t distLengths[DEFLATE_DIST_CODES];
+    build_lengths(litFreqs, DEFLATE_LIT_CODES, DEFLATE_MAX_BITS, litLengths);
+    build_lengths(distFreqs, DEFLATE_DIST_CODES, DEFLATE_MAX_BITS, distLengths);
+
+    DynamicHeader header;
+    size_t dynamicBits = build_header(litLengths, distLengths, &header);
+    size_t fixedBits = 0;
+    for (uint i = 0; i < DEFLATE_LIT_CODES; i++) {
+        dynamicBits += litFreqs[i] * litLengths[i];
+        fixedBits += litFreqs[i] * fixedLitCodes[i].length;
+    }
+    for (uint i = 0; i < DEFLATE_DIST_CODES; i++) {
+        dynamicBits += distFreqs[i] * distLengths[i];
+        fixedBits += distFreqs[i] * 5;
+    }
+
+    // small blocks are cheaper with the fixed codes, which also bounds the
+    // output size to 9 bits per byte
+    HuffCode dynamicLit[DEFLATE_LIT_CODES];
+    HuffCode dynamicDist[DEFLATE_DIST_CODES];
+    const HuffCode* litCodes = fixedLitCodes;
+    const HuffCode* distCodes = fixedDistCodes;
+    put_bits(w, final, 1);
+    if (dynamicBits < fixedBits) {
+        put_bits(w, 2, 2);
+        put_header(w, &header);
+        build_codes(litLengths, DEFLATE_LIT_CODES, dynamicLit);
+        build_codes(distLengths, DEFLATE_DIST_CODES, dynamicDist);
+        litCodes = dynamicLit;
+        distCodes = dynamicDist;
+    } else {
+        put_bits(w, 1, 2);
+    }
+
+    for (uint i = 0; i < count; i++) {
+        uint32_t token = tokens[i];
+        if (token < 256) {
+            put_code(w, litCodes[token]);
+            continue;
+        }
+
+        uint length = token >> 16, dist = token & 0xffff;
+        uint len = lengthSymbols[length];
+        put_code(w, litCodes[257 + len]);
+        put_bits(w, length - lengthBase[len], lengthExtra[len]);
+
+        uint d = dist_symbol(dist);
+        put_code(w, distCodes[d]);
+        put_bits(w, dist - distBase[d], distExtra[d]);
+    }
+    put_code(w, litCodes[256]);
+}
+
+// greedy matches from a single entry hash table, strips that are not the last
+// end with an empty stored block to get back to a byte boundary
+static void deflate_strip(
+    BitWriter* w,
+    const unsigned char* data,
+    size_t size,
+    bool last,
+    uint32_t* table,
+    uint32_t* tokens
+) {
+    memset(table, 0, sizeof *table << DEFLATE_HASH_BITS);
+
+    size_t i = 0;
+    do {
+        uint count = 0;
+        while (count < DEFLATE_BLOCK_TOKENS && i < size) {
+            if (i + DEFLATE_MIN_MATCH > size) {
+                tokens[count++] = data[i++];
+                continue;
+            }
+
+            uint32_t v = read_u32(data + i);
+            uint hash = (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+            size_t candidate = table[hash]; // position + 1, 0 if empty
+            table[hash] = i + 1;
+
+            if (candidate == 0 || i + 1 - candidate > DEFLATE_WINDOW
+                || read_u32(data + candidate - 1) != v) {
+                tokens[count++] = data[i++];
+                continue;
+            }
+
+            size_t start = candidate - 1;
+            size_t max = size - i;
+            if (max > DEFLATE_MAX_MATCH) max = DEFLATE_MAX_MATCH;
+            size_t length = DEFLATE_MIN_MATCH;
+            while (length < max && data[start + length] == data[i + length]) {
+                length++;
+            }
+            tokens[count++] = length << 16 | (i - start);
+            i += length;
+        }
+        put_block(w, tokens, count, last && i == size);
+    } while (i < size);
+
+    if (!last) {
+        put_bits(w, 0, 3);
+        align_bits(w);
+        put_bits(w, 0x0000, 16);
+        put_bits(w, 0xffff, 16);
+    }
+    align_bits(w);
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+static int predict(uint type, int a, int b, int c) {
+    switch (type) {
+        case 1: return a;
+        case 2: return b;
+        case 3: return (a + b) / 2;
+        case 4: return paeth(a, b, c);
+        default: return 0;
+    }
+}
+
+// picks the filter with the smallest sum of absolute (signed) values, the
+// usual heuristic, all of them are tried in a single pass over the row
+static void filter_row(
+    const unsigned char* row,
+    const unsigned char* prev,
+    size_t stride,
+    unsigned char* out
+) {
+    uint sums[5] = {0};
+    for (size_t i = 0; i < stride; i++) {
+        int a = i >= PNG_BPP ? row[i - PNG_BPP] : 0;
+        int b = prev[i];
+        int c = i >= PNG_BPP ? prev[i - PNG_BPP] : 0;
+        int x = row[i];
+        sums[0] += abs((signed char)x);
+        sums[1] += abs((signed char)(x - a));
+        sums[2] += abs((signed char)(x - b));
+        sums[3] += abs((signed char)(x - (a + b) / 2));
+        sums[4] += abs((signed char)(x - paeth(a, b, c)));
+    }
+
+    uint type = 0;
+    for (uint i = 1; i < 5; i++) {
+        if (sums[i] < sums[type]) type = i;
+    }
+
+    out[0] = type;
+    for (size_t i = 0; i < stride; i++) {
+        int a = i >= PNG_BPP ? row[i - PNG_BPP] : 0;
+        int c = i >= PNG_BPP ? prev[i - PNG_BPP] : 0;
+        out[i + 1] = row[i] - predict(type, a, prev[i], c);
+    }
+}
+
+static void* encode_strip(void* arg) {
+    PngStrip* strip = arg;
+    size_t stride = (size_t)strip->size.x * PNG_BPP;
+    strip->dataSize = (stride + 1) * strip->rowCount;
+
+    unsigned char* filtered = malloc(strip->dataSize);
+    unsigned char* zeroRow = calloc(stride, 1); // above the first row
+    uint32_t* table = malloc(sizeof *table << DEFLATE_HASH_BITS);
+    uint32_t* tokens = malloc(sizeof *tokens * DEFLATE_BLOCK_TOKENS);
+    // blocks are at most 9 bits per byte, plus the chunk around them
+    size_t capacity = strip->dataSize + strip->dataSize / 8 + 64;
+    unsigned char* chunk = malloc(capacity);
+
+    if (filtered && zeroRow && table && tokens && chunk) {
+        for (uint y = 0; y < strip->rowCount; y++) {
+            uint row = strip->firstRow + y;
+            const unsigned char* prev
+                = row > 0 ? strip->image + (row - 1) * stride : zeroRow;
+            filter_row(
+                strip->image + row * stride,
+                prev,
+                stride,
+                filtered + y * (stride + 1)
+            );
+        }
+        strip->adler = adler32(filtered, strip->dataSize);
+
+        // chunk length and type, then the zlib header for the first strip
+        BitWriter w = {.data = chunk, .size = 8};
+        memcpy(chunk + 4, "IDAT", 4);
+        if (strip->firstRow == 0) {
+            put_bits(&w, 0x78, 8);
+            put_bits(&w, 0x01, 8);
+        }
+        deflate_strip(
+            &w,
+            filtered,
+            strip->dataSize,
+            strip->last,
+            table,
+            tokens
+        );
+
+        put_u32(chunk, w.size - 8);
+        put_u32(chunk + w.size, crc32(0, chunk + 4, w.size - 4));
+        strip->chunk = chunk;
+        strip->chunkSize = w.size + 4;
+        chunk = NULL;
+    }
+
+    free(filtered);
+    free(zeroRow);
+    free(table);
+    free(tokens);
+    free(chunk);
+    return NULL;
+}
+
+static unsigned char* put_chunk(
+    unsigned char* out,
+    const char* type,
+    const unsigned char* data,
+    uint size
+) {
+    put_u32(out, size);
+    memcpy(out + 4, type, 4);
+    if (size > 0) memcpy(out + 8, data, size);
+    put_u32(out + 8 + size, crc32(0, out + 4, size + 4));
+    return out + 12 + size;
+}
+
+static uint strip_count(uvec2 size, uint threadCount) {
+    if (threadCount == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cores > 0 ? (uint)cores : 1;
+    }
+    if (threadCount > PNG_MAX_THREADS) threadCount = PNG_MAX_THREADS;
+
+    uint maxStrips = size.y / PNG_MIN_STRIP_ROWS;
+    if (threadCount > maxStrips) threadCount = maxStrips;
+    return threadCount > 0 ? threadCount : 1;
+}
+
+unsigned char* png_encode(
+    const unsigned char* image,
+    uvec2 size,
+    uint threadCount,
+    size_t* outSize
+) {
+    pthread_once(&tablesOnce, init_tables);
+
+    uint stripCount = strip_count(size, threadCount);
+    DEBUG("encoding png in %d strips", stripCount);
+
+    PngStrip strips[PNG_MAX_THREADS];
+    pthread_t threads[PNG_MAX_THREADS];
+    bool started[PNG_MAX_THREADS];
+    for (uint i = 0; i < stripCount; i++) {
+        uint firstRow = size.y * i / stripCount;
+        strips[i] = (PngStrip){
+            .image = image,
+            .size = size,
+            .firstRow = firstRow,
+            .rowCount = size.y * (i + 1) / stripCount - firstRow,
+            .last = i == stripCount - 1,
+        };
+        // a strip that can't get its own thread is encoded right away
+        started[i]
+            = pthread_create(&threads[i], NULL, encode_strip, &strips[i]) == 0;
+        if (!started[i]) encode_strip(&strips[i]);
+    }
+
+    bool res = true;
+    size_t chunksSize = 0;
+    uint32_t adler = 1;
+    for (uint i = 0; i < stripCount; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+        res = res && strips[i].chunk;
+        chunksSize += strips[i].chunkSize;
+        adler = i == 0
+                  ? strips[i].adler
+                  : adler32_combine(adler, strips[i].adler, strips[i].dataSize);
+    }
+
+    // signature, IHDR, the strips, the adler32 in its own IDAT and IEND
+    size_t totalSize = 8 + 25 + chunksSize + 16 + 12;
+    unsigned char* data = res ? malloc(totalSize) : NULL;
+
+    if (data) {
+        unsigned char* out = data;
+        memcpy(out, "\x89PNG\r\n\x1a\n", 8);
+
+        unsigned char header[13] = {0};
+        put_u32(header, size.x);
+        put_u32(header + 4, size.y);
+        header[8] = 8; // bit depth
+        header[9] = 6; // RGBA
+        out = put_chunk(out + 8, "IHDR", header, sizeof header);
+
+        for (uint i = 0; i < stripCount; i++) {
+            memcpy(out, strips[i].chunk, strips[i].chunkSize);
+            out += strips[i].chunkSize;
+        }
+
+        unsigned char trailer[4];
+        put_u32(trailer, adler);
+        out = put_chunk(out, "IDAT", trailer, sizeof trailer);
+        put_chunk(out, "IEND", NULL, 0);
+        *outSize = totalSize;
+    }
+
+    for (uint i = 0; i < stripCount; i++) free(strips[i].chunk);
+    return data;
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "vector.h"
+
+/**
+ * @brief Encode an RGBA image as PNG, the rows are split into strips that are
+ * filtered and compressed in parallel (greedy matching with dynamic huffman
+ * codes per block, which trades some size for speed)
+ * @param image The image to encode (4 bytes per pixel)
+ * @param size The size of the image
+ * @param threadCount The number of threads to use, 0 for one per core
+ * @param outSize Set to the size of the encoded image
+ * @return The encoded image (must be freed by the caller), NULL on failure
+ */
+unsigned char* png_encode(
+    const unsigned char* image,
+    uvec2 size,
+    uint threadCount,
+    size_t* outSize
+);
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "qoi.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF 0x40
+#define QOI_OP_LUMA 0x80
+#define QOI_OP_RUN 0xc0
+#define QOI_OP_RGB 0xfe
+#define QOI_OP_RGBA 0xff
+
+#define QOI_HEADER_SIZE 14
+#define QOI_MAX_RUN 62
+
+static const unsigned char qoiPadding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+typedef struct {
+    unsigned char r, g, b, a;
+} Pixel;
+
+static uint pixel_hash(Pixel p) {
+    return (p.r * 3 + p.g * 5 + p.b * 7 + p.a * 11) % 64;
+}
+
+static bool pixel_equal(Pixel a, Pixel b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static unsigned char* put_u32(unsigned char* out, uint v) {
+    out[0] = v >> 24;
+    out[1] = v >> 16;
+    out[2] = v >> 8;
+    out[3] = v;
+    return out + 4;
+}
+
+// the smallest op that reproduces p from prev, the index is checked first
+static unsigned char* put_pixel(unsigned char* out, Pixel p, Pixel prev) {
+    if (p.a != prev.a) {
+        *out++ = QOI_OP_RGBA;
+        *out++ = p.r;
+        *out++ = p.g;
+        *out++ = p.b;
+        *out++ = p.a;
+        return out;
+    }
+
+    signed char dr = (signed char)(p.r - prev.r);
+    signed char dg = (signed char)(p.g - prev.g);
+    signed char db = (signed char)(p.b - prev.b);
+    signed char drg = (signed char)(dr - dg);
+    signed char dbg = (signed char)(db - dg);
+
+    if (dr > -3 && dr < 2 && dg > -3 && dg < 2 && db > -3 && db < 2) {
+        *out++ = QOI_OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+    } else if (drg > -9 && drg < 8 && dg > -33 && dg < 32 && dbg > -9
+               && dbg < 8) {
+        *out++ = QOI_OP_LUMA | (dg + 32);
+        *out++ = (drg + 8) << 4 | (dbg + 8);
+    } else {
+        *out++ = QOI_OP_RGB;
+        *out++ = p.r;
+        *out++ = p.g;
+        *out++ = p.b;
+    }
+    return out;
+}
+
+unsigned char* qoi_encode(
+    const unsigned char* image,
+    uvec2 size,
+    size_t* outSize
+) {
+    size_t pixelCount = (size_t)size.x * size.y;
+    size_t maxSize = QOI_HEADER_SIZE + pixelCount * 5 + sizeof qoiPadding;
+    unsigned char* data = malloc(maxSize);
+    if (data == NULL) return NULL;
+
+    unsigned char* out = data;
+    memcpy(out, "qoif", 4);
+    out = put_u32(out + 4, size.x);
+    out = put_u32(out, size.y);
+    *out++ = 4; // channels
+    *out++ = 0; // sRGB with linear alpha
+
+    Pixel index[64] = {0};
+    Pixel prev = {0, 0, 0, 255};
+    uint run = 0;
+
+    for (size_t i = 0; i < pixelCount; i++) {
+        Pixel p;
+        memcpy(&p, image + i * 4, sizeof p);
+
+        if (pixel_equal(p, prev)) {
+            run++;
+            if (run == QOI_MAX_RUN || i == pixelCount - 1) {
+                *out++ = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0) {
+            *out++ = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        uint hash = pixel_hash(p);
+        if (pixel_equal(index[hash], p)) {
+            *out++ = QOI_OP_INDEX | hash;
+        } else {
+            index[hash] = p;
+            out = put_pixel(out, p, prev);
+        }
+        prev = p;
+    }
+
+    memcpy(out, qoiPadding, sizeof qoiPadding);
+    out += sizeof qoiPadding;
+
+    *outSize = out - data;
+    return realloc(data, *outSize);
+}
\ No newline at end of file
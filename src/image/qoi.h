@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "vector.h"
+
+/**
+ * @brief Encode an RGBA image as QOI, which is much faster than PNG and
+ * usually only a little larger
+ * @param image The image to encode (4 bytes per pixel)
+ * @param size The size of the image
+ * @param outSize Set to the size of the encoded image
+ * @return The encoded image (must be freed by the caller), NULL on failure
+ */
+unsigned char* qoi_encode(
+    const unsigned char* image,
+    uvec2 size,
+    size_t* outSize
+);
\ No newline at end of file
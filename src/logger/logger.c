@@ -1,18 +1,65 @@
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "logger.h"
 
+#define LOG_QUEUE_SIZE 256 // must be a power of 2
+#define LOG_MSG_SIZE 1024
+#define LOG_SRC_SIZE 32
+
+typedef struct {
+    atomic_size_t seq;
+    int lvl;
+    char src[LOG_SRC_SIZE];
+    const char* file;
+    int line;
+    char msg[LOG_MSG_SIZE];
+} LogEntry;
+
 log_fn currLogFunction = basic_log_fn;
 void* currLogFunctionArg = NULL;
+int logMinLevel = MC_LOG_LEVEL_DEBUG;
+
+// the log function may not be thread safe (e.g. when it calls into lua), the
+// mutex is recursive so that the thread holding log_sink_lock can still log
+static pthread_mutex_t logMutex;
+static pthread_once_t logMutexOnce = PTHREAD_ONCE_INIT;
+
+// bounded multi-producer single-consumer queue, each entry's sequence number
+// tells whether it is free to write (seq == pos) or ready to read
+// (seq == pos + 1)
+static LogEntry logQueue[LOG_QUEUE_SIZE];
+static atomic_size_t logEnqueuePos;
+static atomic_size_t logDequeuePos; ///< Written with the log mutex held
+static atomic_size_t logDropped;
+static atomic_bool logAsync;
+static atomic_bool logStopping;
+static pthread_t logThread;
+
+// the background thread sleeps on the condition variable while the queue is
+// empty, producers only take the mutex to wake it when it is asleep
+static pthread_mutex_t logWakeMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logWakeCond = PTHREAD_COND_INITIALIZER;
+static atomic_bool logSleeping;
+
+// set while logs are drained (with the log mutex held), logs from within the
+// log function are passed on directly instead of draining again
+static bool logDraining = false;
 
 void set_log_fn(log_fn fn, void* arg) {
     currLogFunction = fn;
     currLogFunctionArg = arg;
 }
 
+void set_log_level(int lvl) {
+    logMinLevel = lvl;
+}
+
 void basic_log_fn(
     void* arg,
     int lvl,
@@ -27,6 +74,198 @@ void basic_log_fn(
     printf("%s\n", msg);
 }
 
+static void log_mutex_init(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&logMutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+static void log_mutex_lock(void) {
+    pthread_once(&logMutexOnce, log_mutex_init);
+    pthread_mutex_lock(&logMutex);
+}
+
+static void log_sink(
+    int lvl,
+    const char* src,
+    const char* file,
+    int line,
+    const char* msg
+) {
+    log_mutex_lock();
+    currLogFunction(currLogFunctionArg, lvl, src, file, line, msg);
+    pthread_mutex_unlock(&logMutex);
+}
+
+// a message was published since the queue was last drained
+static bool log_pending(void) {
+    size_t pos = atomic_load(&logDequeuePos);
+    LogEntry* entry = &logQueue[pos & (LOG_QUEUE_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+    return seq == pos + 1 || atomic_load(&logDropped) > 0;
+}
+
+// the queue is only read with the log mutex held, so a thread that has to log
+// right away can empty it first
+static bool log_drain(void) {
+    log_mutex_lock();
+    logDraining = true;
+    bool drained = false;
+    while (true) {
+        size_t pos = atomic_load_explicit(&logDequeuePos, memory_order_relaxed);
+        LogEntry* entry = &logQueue[pos & (LOG_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+        if (seq != pos + 1) break;
+
+        log_sink(entry->lvl, entry->src, entry->file, entry->line, entry->msg);
+
+        atomic_store_explicit(
+            &entry->seq,
+            pos + LOG_QUEUE_SIZE,
+            memory_order_release
+        );
+        atomic_store(&logDequeuePos, pos + 1);
+        drained = true;
+    }
+
+    size_t dropped = atomic_exchange(&logDropped, 0);
+    if (dropped > 0) {
+        char msg[64];
+        snprintf(msg, sizeof msg, "log queue full, dropped %zu logs", dropped);
+        log_sink(MC_LOG_LEVEL_WARN, "app", __FILE__, __LINE__, msg);
+    }
+
+    logDraining = false;
+    pthread_mutex_unlock(&logMutex);
+    return drained;
+}
+
+static void* log_thread(void* arg) {
+    while (!atomic_load(&logStopping)) {
+        if (log_drain()) continue;
+
+        pthread_mutex_lock(&logWakeMutex);
+        // a producer either sees the flag or its message is seen here
+        atomic_store(&logSleeping, true);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!log_pending() && !atomic_load(&logStopping)) {
+            pthread_cond_wait(&logWakeCond, &logWakeMutex);
+        }
+        atomic_store(&logSleeping, false);
+        pthread_mutex_unlock(&logWakeMutex);
+    }
+    log_drain();
+    return NULL;
+}
+
+static void log_wake(bool always) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!always && !atomic_load(&logSleeping)) return;
+    pthread_mutex_lock(&logWakeMutex);
+    pthread_cond_signal(&logWakeCond);
+    pthread_mutex_unlock(&logWakeMutex);
+}
+
+static bool log_enqueue(
+    mc_LogLevel lvl,
+    const char* src,
+    const char* file,
+    int line,
+    const char* fmt,
+    va_list args
+) {
+    size_t pos = atomic_load_explicit(&logEnqueuePos, memory_order_relaxed);
+    LogEntry* entry;
+
+    while (true) {
+        entry = &logQueue[pos & (LOG_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+        ptrdiff_t diff = (ptrdiff_t)seq - (ptrdiff_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &logEnqueuePos,
+                    &pos,
+                    pos + 1,
+                    memory_order_relaxed,
+                    memory_order_relaxed
+                ))
+                break;
+        } else if (diff < 0) {
+            return false; // full
+        } else {
+            pos = atomic_load_explicit(&logEnqueuePos, memory_order_relaxed);
+        }
+    }
+
+    entry->lvl = lvl;
+    snprintf(entry->src, LOG_SRC_SIZE, "%s", src);
+    entry->file = file;
+    entry->line = line;
+    vsnprintf(entry->msg, LOG_MSG_SIZE, fmt, args);
+
+    atomic_store_explicit(&entry->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+void log_start_async(void) {
+    if (atomic_load(&logAsync)) return;
+
+    for (size_t i = 0; i < LOG_QUEUE_SIZE; i++) {
+        atomic_init(&logQueue[i].seq, i);
+    }
+    atomic_store(&logEnqueuePos, 0);
+    atomic_store(&logDequeuePos, 0);
+    atomic_store(&logStopping, false);
+
+    if (pthread_create(&logThread, NULL, log_thread, NULL) != 0) return;
+    atomic_store(&logAsync, true);
+}
+
+void log_stop_async(void) {
+    if (!atomic_exchange(&logAsync, false)) return;
+    atomic_store(&logStopping, true);
+    log_wake(true);
+    pthread_join(logThread, NULL);
+}
+
+// also locks without the background thread, other threads (e.g. background
+// setup or render workers) log synchronously then
+void log_sink_lock(void) {
+    log_mutex_lock();
+}
+
+void log_sink_unlock(void) {
+    pthread_mutex_unlock(&logMutex);
+}
+
+static void log_now(
+    mc_LogLevel lvl,
+    const char* src,
+    const char* file,
+    int line,
+    const char* fmt,
+    va_list args
+) {
+    char buffer[LOG_MSG_SIZE];
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    int len = vsnprintf(buffer, sizeof buffer, fmt, args);
+
+    if (len < (int)sizeof buffer) {
+        log_sink(lvl, src, file, line, buffer);
+    } else {
+        char* message = malloc(len + 1);
+        vsnprintf(message, len + 1, fmt, argsCopy);
+        log_sink(lvl, src, file, line, message);
+        free(message);
+    }
+
+    va_end(argsCopy);
+}
+
 void new_log(
     void* arg,
     mc_LogLevel lvl,
@@ -36,15 +275,27 @@ void new_log(
     const char* fmt,
     ...
 ) {
+    // microcompute calls this directly, so the level is checked here as well
+    if ((int)lvl < logMinLevel) return;
+
     va_list args;
     va_start(args, fmt);
-    int message_len = vsnprintf(NULL, 0, fmt, args);
-    va_start(args, fmt);
-    char* message = malloc(message_len + 1);
-    vsnprintf(message, message_len + 1, fmt, args);
-    va_end(args);
 
-    currLogFunction(currLogFunctionArg, lvl, src, file, line, message);
+    if (!atomic_load_explicit(&logAsync, memory_order_relaxed)) {
+        log_now(lvl, src, file, line, fmt, args);
+    } else if (log_enqueue(lvl, src, file, line, fmt, args)) {
+        log_wake(false);
+    } else if (lvl < MC_LOG_LEVEL_ERROR) {
+        atomic_fetch_add(&logDropped, 1);
+        log_wake(false);
+    } else {
+        // errors are never dropped, the queue is emptied on this thread first
+        // so that they still come after the messages before them
+        log_mutex_lock();
+        if (!logDraining) log_drain();
+        log_now(lvl, src, file, line, fmt, args);
+        pthread_mutex_unlock(&logMutex);
+    }
 
-    free(message);
+    va_end(args);
 }
\ No newline at end of file
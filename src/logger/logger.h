@@ -7,21 +7,25 @@
 
 typedef void (*log_fn)(void*, int, const char*, const char*, int, const char*);
 
+extern int logMinLevel;
+
 /**
- * @brief Log a message
+ * @brief Log a message, messages below the minimum level are skipped before
+ * any formatting happens
  * @param lvl The level of the message
  * @param fmt The format of the message
  * @param ... The arguments for the message
  */
 #define LOG(lvl, fmt, ...)                                                     \
-    new_log(                                                                   \
-        NULL,                                                                  \
-        lvl,                                                                   \
-        "app",                                                                 \
-        __FILE__,                                                              \
-        __LINE__,                                                              \
-        fmt __VA_OPT__(, ) __VA_ARGS__                                         \
-    )
+    ((int)(lvl) < logMinLevel ? (void)0                                        \
+                              : new_log(                                       \
+                                    NULL,                                      \
+                                    lvl,                                       \
+                                    "app",                                     \
+                                    __FILE__,                                  \
+                                    __LINE__,                                  \
+                                    fmt __VA_OPT__(, ) __VA_ARGS__             \
+                                ))
 
 /**
  * @brief Log a message at the debug level
@@ -69,6 +73,36 @@ typedef void (*log_fn)(void*, int, const char*, const char*, int, const char*);
  */
 void set_log_fn(log_fn fn, void* arg);
 
+/**
+ * @brief Set the minimum level of messages that get logged
+ * @param lvl The minimum level
+ */
+void set_log_level(int lvl);
+
+/**
+ * @brief Start passing logs to the log function from a background thread,
+ * messages are queued in a bounded lock-free queue and dropped if it is full,
+ * except for errors, which are logged right away after the queued messages
+ */
+void log_start_async(void);
+
+/**
+ * @brief Log all queued messages and stop the background thread
+ */
+void log_stop_async(void);
+
+/**
+ * @brief Keep other threads from calling the log function, needed while the
+ * log function's state (e.g. a lua_State) is used elsewhere, the locking
+ * thread can still log (calls can be nested)
+ */
+void log_sink_lock(void);
+
+/**
+ * @brief Allow other threads to call the log function again
+ */
+void log_sink_unlock(void);
+
 /**
  * @brief A basic log function that logs to stdout
  */
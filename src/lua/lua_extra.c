@@ -228,4 +228,326 @@ void lua_raise_error(lua_State* L, const char* fmt, ...) {
     lua_pushvfstring(L, fmt, arg);
     va_end(arg);
     lua_error(L);
+}
+
+//============================================================================//
+// compiled formats
+//============================================================================//
+
+typedef struct LuaFormatNode {
+    char type;           ///< One of "bifslu{", or 'v' for a float vector
+    int keyRef;          ///< Registry reference to the (string) key
+    lua_Integer keyIdx;  ///< Integer key, used when keyRef is LUA_NOREF
+    char* keyName;       ///< Key name, for error messages
+    int childCount;      ///< Number of children (or components for 'v')
+    struct LuaFormatNode* children;
+} LuaFormatNode;
+
+struct LuaFormat {
+    int nodeCount;
+    LuaFormatNode* nodes;
+};
+
+static void format_nodes_free(lua_State* L, LuaFormatNode* nodes, int count) {
+    for (int i = 0; i < count; i++) {
+        if (nodes[i].keyRef != LUA_NOREF) {
+            luaL_unref(L, LUA_REGISTRYINDEX, nodes[i].keyRef);
+        }
+        free(nodes[i].keyName);
+        format_nodes_free(L, nodes[i].children, nodes[i].childCount);
+    }
+    free(nodes);
+}
+
+static LuaFormatNode* format_node_add(LuaFormatNode** nodes, int* count) {
+    *nodes = realloc(*nodes, sizeof **nodes * (*count + 1));
+    LuaFormatNode* node = &(*nodes)[(*count)++];
+    *node = (LuaFormatNode){.keyRef = LUA_NOREF};
+    return node;
+}
+
+// a table of the keys 1..n that only holds floats is read with lua_rawgeti
+static void format_node_try_vector(LuaFormatNode* node) {
+    for (int i = 0; i < node->childCount; i++) {
+        LuaFormatNode* child = &node->children[i];
+        if (child->type != 'f' || child->keyRef != LUA_NOREF) return;
+        if (child->keyIdx != i + 1) return;
+    }
+
+    format_nodes_free(NULL, node->children, node->childCount);
+    node->children = NULL;
+    node->type = 'v';
+}
+
+static bool lua_format_compile__(
+    lua_State* L,
+    const char** fmt,
+    LuaFormatNode** nodes,
+    int* count,
+    bool inTable
+) {
+    while (true) {
+        consume_spaces((char**)fmt);
+        LuaFormatNode* node;
+
+        if (inTable) {
+            const char* key = *fmt;
+            while (is_key(**fmt)) (*fmt)++;
+            int keyLen = (int)(*fmt - key);
+            consume_spaces((char**)fmt);
+            if (**fmt != ':') {
+                ERROR("expected ':', got '%c'", **fmt);
+                return false;
+            }
+            (*fmt)++;
+            consume_spaces((char**)fmt);
+
+            node = format_node_add(nodes, count);
+            node->keyName = strndup(key, keyLen);
+            if (is_integer(key, keyLen)) {
+                node->keyIdx = strtol(key, NULL, 10);
+            } else {
+                lua_pushlstring(L, key, keyLen);
+                node->keyRef = luaL_ref(L, LUA_REGISTRYINDEX);
+            }
+        } else {
+            if (**fmt == '\0') return true;
+            node = format_node_add(nodes, count);
+        }
+
+        switch (**fmt) {
+            case 'b':
+            case 'i':
+            case 'f':
+            case 's':
+            case 'l':
+            case 'u': node->type = **fmt; break;
+            case '{':
+                node->type = '{';
+                (*fmt)++;
+                if (!lua_format_compile__(
+                        L,
+                        fmt,
+                        &node->children,
+                        &node->childCount,
+                        true
+                    )) {
+                    ERROR("  in '%s'", node->keyName ? node->keyName : "");
+                    return false;
+                }
+                format_node_try_vector(node);
+                break;
+            default:
+                ERROR("expected on of \"bifslu{\", got '%c'", **fmt);
+                return false;
+        }
+
+        (*fmt)++;
+        consume_spaces((char**)fmt);
+
+        if (inTable) {
+            switch (**fmt) {
+                case ',': (*fmt)++; continue;
+                case '}': return true;
+                default:
+                    ERROR("expected ',' or '}', got '%c'", **fmt);
+                    return false;
+            }
+        } else {
+            switch (**fmt) {
+                case ';': (*fmt)++; continue;
+                case '\0': return true;
+                default:
+                    ERROR("expected ';' or '\0', got '%c'", **fmt);
+                    return false;
+            }
+        }
+    }
+}
+
+LuaFormat* lua_format_compile(lua_State* L, const char* fmt) {
+    LuaFormat* format = malloc(sizeof *format);
+    *format = (LuaFormat){0};
+
+    if (!lua_format_compile__(
+            L,
+            &fmt,
+            &format->nodes,
+            &format->nodeCount,
+            false
+        )) {
+        lua_format_destroy(L, format);
+        return NULL;
+    }
+
+    return format;
+}
+
+void lua_format_destroy(lua_State* L, LuaFormat* format) {
+    if (!format) return;
+    format_nodes_free(L, format->nodes, format->nodeCount);
+    free(format);
+}
+
+static void push_key(lua_State* L, LuaFormatNode* node) {
+    // string keys are kept in the registry, so they don't have to be hashed
+    // and interned again on every call
+    if (node->keyRef == LUA_NOREF) lua_pushinteger(L, node->keyIdx);
+    else lua_rawgeti(L, LUA_REGISTRYINDEX, node->keyRef);
+}
+
+static bool lua_pop_fc__(
+    lua_State* L,
+    LuaFormatNode* nodes,
+    int count,
+    bool inTable,
+    va_list* arg
+) {
+    for (int n = 0; n < count; n++) {
+        LuaFormatNode* node = &nodes[n];
+
+        if (inTable) {
+            push_key(L, node);
+            lua_rawget(L, -2);
+            if (lua_isnil(L, -1)) {
+                ERROR("key '%s' not found", node->keyName);
+                return false;
+            }
+        }
+
+        switch (node->type) {
+            case 'b':
+                if (!lua_isboolean(L, -1)) {
+                    ERROR("expected boolean, got %s", GET_TYPE(L));
+                    return false;
+                }
+                *va_arg(*arg, bool*) = lua_toboolean(L, -1);
+                break;
+            case 'i':
+                if (!lua_isinteger(L, -1)) {
+                    ERROR("expected integer, got %s", GET_TYPE(L));
+                    return false;
+                }
+                *va_arg(*arg, int*) = lua_tointeger(L, -1);
+                break;
+            case 'f':
+                if (!lua_isnumber(L, -1)) {
+                    ERROR("expected number, got %s", GET_TYPE(L));
+                    return false;
+                }
+                *va_arg(*arg, float*) = lua_tonumber(L, -1);
+                break;
+            case 's':
+                if (!lua_isstring(L, -1)) {
+                    ERROR("expected string, got %s", GET_TYPE(L));
+                    return false;
+                }
+                *va_arg(*arg, const char**) = strdup(lua_tostring(L, -1));
+                break;
+            case 'l':
+                if (!lua_isfunction(L, -1)) {
+                    ERROR("expected function, got %s", GET_TYPE(L));
+                    return false;
+                }
+                *va_arg(*arg, int*) = luaL_ref(L, LUA_REGISTRYINDEX);
+                lua_pushnil(L);
+                break;
+            case 'u':
+                if (!lua_isuserdata(L, -1)) {
+                    ERROR("expected userdata, got %s", GET_TYPE(L));
+                    return false;
+                }
+                *va_arg(*arg, void**) = lua_touserdata(L, -1);
+                break;
+            case 'v':
+                if (!lua_istable(L, -1)) {
+                    ERROR("expected table, got %s", GET_TYPE(L));
+                    return false;
+                }
+                for (int i = 1; i <= node->childCount; i++) {
+                    lua_rawgeti(L, -1, i);
+                    if (!lua_isnumber(L, -1)) {
+                        ERROR("expected number, got %s", GET_TYPE(L));
+                        ERROR("  in '%d'", i);
+                        return false;
+                    }
+                    *va_arg(*arg, float*) = lua_tonumber(L, -1);
+                    lua_pop(L, 1);
+                }
+                break;
+            case '{':
+                if (!lua_istable(L, -1)) {
+                    ERROR("expected table, got %s", GET_TYPE(L));
+                    return false;
+                }
+                if (!lua_pop_fc__(
+                        L,
+                        node->children,
+                        node->childCount,
+                        true,
+                        arg
+                    )) {
+                    if (node->keyName) ERROR("  in '%s'", node->keyName);
+                    return false;
+                }
+                break;
+        }
+
+        lua_pop(L, 1);
+    }
+
+    return true;
+}
+
+static void lua_push_fc__(
+    lua_State* L,
+    LuaFormatNode* nodes,
+    int count,
+    bool inTable,
+    va_list* arg
+) {
+    for (int n = 0; n < count; n++) {
+        LuaFormatNode* node = &nodes[n];
+        if (inTable) push_key(L, node);
+
+        switch (node->type) {
+            case 'b': lua_pushboolean(L, va_arg(*arg, int)); break;
+            case 'i': lua_pushinteger(L, va_arg(*arg, int)); break;
+            case 'f': lua_pushnumber(L, va_arg(*arg, double)); break;
+            case 's': lua_pushstring(L, va_arg(*arg, const char*)); break;
+            case 'l': lua_pushcfunction(L, va_arg(*arg, lua_CFunction)); break;
+            case 'u': lua_pushlightuserdata(L, va_arg(*arg, void*)); break;
+            case 'v':
+                lua_createtable(L, node->childCount, 0);
+                for (int i = 1; i <= node->childCount; i++) {
+                    lua_pushnumber(L, va_arg(*arg, double));
+                    lua_rawseti(L, -2, i);
+                }
+                break;
+            case '{':
+                lua_newtable(L);
+                lua_push_fc__(L, node->children, node->childCount, true, arg);
+                break;
+        }
+
+        if (inTable) lua_rawset(L, -3);
+    }
+}
+
+bool lua_pop_fc(lua_State* L, LuaFormat* format, ...) {
+    if (!format) return false;
+    va_list arg;
+    va_start(arg, format);
+    bool res = lua_pop_fc__(L, format->nodes, format->nodeCount, false, &arg);
+    va_end(arg);
+    return res;
+}
+
+bool lua_push_fc(lua_State* L, LuaFormat* format, ...) {
+    if (!format) return false;
+    va_list arg;
+    va_start(arg, format);
+    lua_push_fc__(L, format->nodes, format->nodeCount, false, &arg);
+    va_end(arg);
+    return true;
 }
\ No newline at end of file
@@ -39,6 +39,48 @@ bool lua_pop_f(lua_State* L, char* fmt, ...);
  */
 bool lua_push_f(lua_State* L, char* fmt, ...);
 
+/**
+ * A format string compiled with lua_format_compile, so that it does not have to
+ * be parsed again on every call. Tables of the keys 1..n that only hold floats
+ * (e.g. "{1: f, 2: f, 3: f}") are read as vectors with lua_rawgeti. Tables are
+ * accessed without metamethods.
+ */
+typedef struct LuaFormat LuaFormat;
+
+/**
+ * @brief Compile a format string
+ * @param L The lua_State the format will be used with (the keys are stored in
+ * its registry)
+ * @param fmt The format string to compile
+ * @return The compiled format on success, NULL on failure
+ */
+LuaFormat* lua_format_compile(lua_State* L, const char* fmt);
+
+/**
+ * @brief Destroy a compiled format
+ * @param L The lua_State the format was compiled for
+ * @param format The format to destroy
+ */
+void lua_format_destroy(lua_State* L, LuaFormat* format);
+
+/**
+ * @brief Pop values from a lua_State using a compiled format
+ * @param L The lua_State to parse
+ * @param format The compiled format to use
+ * @param ... Pointers to the variables to store the values in
+ * @return true if the parsing was successful, false otherwise
+ */
+bool lua_pop_fc(lua_State* L, LuaFormat* format, ...);
+
+/**
+ * @brief Push values to a lua_State using a compiled format
+ * @param L The lua_State to write to
+ * @param format The compiled format to use
+ * @param ... The values to write
+ * @return true if the writing was successful, false otherwise
+ */
+bool lua_push_fc(lua_State* L, LuaFormat* format, ...);
+
 /**
  * @brief Raise an error in a lua_State
  * @param L The lua_State to raise the error in
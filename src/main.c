@@ -1,15 +1,74 @@
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "config/config.h"
+#include "daemon/job_queue.h"
+#include "image/image_writer.h"
 #include "logger/logger.h"
 #include "lua/lua_extra.h"
+#include "memory/memory.h"
+#include "renderer/partial.h"
 #include "renderer/renderer.h"
-#include "stb/stb_image_write.h"
+#include "renderer/shader_compiler.h"
+#include "renderer/upscale.h"
+
+#define SCENE_CACHE_SIZE 4 // scenes kept per device between jobs
+
+#define PREVIEW_SCALE 4          // previews render 1/4 of the width and height
+#define PREVIEW_ITERATIONS 2     // samples per preview pixel
+#define PREVIEW_WORKGROUP_SIZE 8 // used instead of tuning the workgroup size
 
 typedef struct LogArg {
     lua_State* l;
     int logFunction;
 } LogArg;
 
+// the instance is created in the background, the devices are selected when the
+// first job needs them
+typedef struct DeviceSetup {
+    lua_State* l;
+    int deviceFunction;
+    pthread_t thread;
+    bool started; ///< Whether the thread still has to be joined
+    bool ready;   ///< Whether the devices were selected
+    mc_Instance* instance;
+    double instanceTime;  ///< Time the instance creation took
+    double selectionTime; ///< Time the device selection took
+    RenderDevice* devices;
+    int deviceCount;
+} DeviceSetup;
+
+// the shaders of a job are compiled in the background while its scene is built
+typedef struct ShaderSetup {
+    RenderSettings settings;
+    SceneCreateInfo sceneInfo;
+    pthread_t thread;
+    bool started;
+    bool res;
+    double time;
+} ShaderSetup;
+
+typedef struct CachedScene {
+    uint64_t hash;
+    mc_Device* dev;
+    Scene* scene;
+    unsigned long lastUse;
+} CachedScene;
+
+// compiled once, these are used for every call from the voxel placer
+static LuaFormat* materialFormat;
+static LuaFormat* sceneSetFormat;
+static LuaFormat* modelFormat;
+static LuaFormat* modelSetFormat;
+static LuaFormat* placeFormat;
+
+// device copies of the scenes of previous jobs, keyed by content hash
+static CachedScene* sceneCache;
+static int sceneCacheCount;
+static unsigned long sceneCacheClock;
+
 static void l_log(
     void* arg,
     int lvl,
@@ -28,13 +87,38 @@ static void l_log(
     }
 }
 
+static void push_memory_stats(lua_State* l, MemoryStats stats) {
+    // numbers instead of integers, the push format only takes ints
+    lua_push_f(
+        l,
+        "{host: f, device: f, peak_host: f, peak_device: f}",
+        (double)stats.current.host,
+        (double)stats.current.device,
+        (double)stats.peak.host,
+        (double)stats.peak.device
+    );
+}
+
+// memory_report() returns the bytes in use per category and in total, along
+// with their peaks since the current job started
+static int l_memory_report(lua_State* l) {
+    lua_newtable(l);
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        push_memory_stats(l, memory_get_stats(i));
+        lua_setfield(l, -2, memory_category_name(i));
+    }
+    push_memory_stats(l, memory_get_total());
+    lua_setfield(l, -2, "total");
+    return 1;
+}
+
 static int l_scene_register_material(lua_State* l) {
     Scene* scene;
     vec3 color;
     float emission;
-    bool res = lua_pop_f(
+    bool res = lua_pop_fc(
         l,
-        "{color: {1: f, 2: f, 3: f}, emission: f}; {_scene: u}",
+        materialFormat,
         &color.r,
         &color.g,
         &color.b,
@@ -44,7 +128,10 @@ static int l_scene_register_material(lua_State* l) {
 
     if (!res) lua_raise_error(l, "invalid material");
     Material m = material(color, emission);
-    lua_pushinteger(l, scene_register_material(scene, m));
+    // 0 is the empty material, it is only returned when the scene is full
+    uint materialID = scene_register_material(scene, m);
+    if (materialID == 0) lua_raise_error(l, "too many materials");
+    lua_pushinteger(l, materialID);
     return 1;
 }
 
@@ -52,9 +139,9 @@ static int l_scene_set(lua_State* l) {
     Scene* scene;
     vec3 pos;
     int materialID;
-    bool res = lua_pop_f(
+    bool res = lua_pop_fc(
         l,
-        "i; {1: f, 2: f, 3: f}; {_scene: u}",
+        sceneSetFormat,
         &materialID,
         &pos.x,
         &pos.y,
@@ -63,6 +150,8 @@ static int l_scene_set(lua_State* l) {
     );
 
     if (!res) lua_raise_error(l, "invalid position or material");
+    if (materialID < 0 || (uint)materialID >= scene_get_material_count(scene))
+        lua_raise_error(l, "unknown material %d", materialID);
     scene_set(
         scene,
         (uvec3){.x = (int)pos.x, .y = (int)pos.y, .z = (int)pos.z},
@@ -71,109 +160,135 @@ static int l_scene_set(lua_State* l) {
     return 0;
 }
 
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        ERROR("usage: %s <config file>", argv[0]);
-        return 1;
+// sizes and positions are plain numbers in lua, only whole ones in int range
+// (and at least min) address voxels
+static bool is_voxel_coord(vec3 v, float min) {
+    float c[3] = {v.x, v.y, v.z};
+    for (int i = 0; i < 3; i++) {
+        if (c[i] != floorf(c[i]) || c[i] < min || c[i] >= 2147483648.0f)
+            return false;
     }
+    return true;
+}
 
-    char* fileName = argv[1];
+static int l_scene_register_model(lua_State* l) {
+    Scene* scene;
+    vec3 size;
+    bool res = lua_pop_fc(l, modelFormat, &size.x, &size.y, &size.z, &scene);
 
-    lua_State* l = luaL_newstate();
-    luaL_openlibs(l);
+    if (!res || !is_voxel_coord(size, 1.0f))
+        lua_raise_error(l, "invalid model size");
+    uint model = scene_register_model(
+        scene,
+        (uvec3){.x = (int)size.x, .y = (int)size.y, .z = (int)size.z}
+    );
+    if (model == INVALID_MODEL) lua_raise_error(l, "models too large");
+    lua_pushinteger(l, model);
+    return 1;
+}
 
-    INFO("reading config file \"%s\n\"", fileName);
-    if (luaL_dofile(l, fileName)) {
-        ERROR(
-            "failed to run config file \"%s\": %s\n",
-            fileName,
-            lua_tostring(l, -1)
-        );
-        return 1;
-    }
+static int l_scene_model_set(lua_State* l) {
+    Scene* scene;
+    int model;
+    vec3 pos;
+    int materialID;
+    bool res = lua_pop_fc(
+        l,
+        modelSetFormat,
+        &materialID,
+        &pos.x,
+        &pos.y,
+        &pos.z,
+        &model,
+        &scene
+    );
 
-    char* outputFile;
-    int logFunction, deviceFunction, sceneDataFunction;
-    RenderSettings rendererSettings;
-    SceneCreateInfo sceneCreateInfo;
-    CameraCreateInfo cameraCreateInfo;
-
-    char* format = "{"
-                   "    output_file: s,"
-                   "    logger: l,"
-                   "    device_selector: l,"
-                   "    renderer: {"
-                   "        renderer_code: s,"
-                   "        iteration_code: s,"
-                   "        output_code: s,"
-                   "        workgroup_size: {1: i, 2: i},"
-                   "        image_size: {1: i, 2: i},"
-                   "        iterations: i,"
-                   "        max_depth: i"
-                   "    },"
-                   "    scene: {"
-                   "        size: {1: i, 2: i, 3: i},"
-                   "        bg: {color: {1: f, 2: f, 3: f}, emission: f},"
-                   "        voxel_placer: l"
-                   "    },"
-                   "    camera: {"
-                   "        sensor_size: {1: f, 2: f},"
-                   "        focal_length: f,"
-                   "        position: {1: f, 2: f, 3: f},"
-                   "        rotation: {1: f, 2: f, 3: f}"
-                   "    }"
-                   "}";
-
-    bool res = lua_pop_f(
+    if (!res || model < 0 || materialID < 0 || !is_voxel_coord(pos, 0.0f))
+        lua_raise_error(l, "invalid model, position or material");
+    if ((uint)materialID >= scene_get_material_count(scene))
+        lua_raise_error(l, "unknown material %d", materialID);
+    scene_model_set(
+        scene,
+        model,
+        (uvec3){.x = (int)pos.x, .y = (int)pos.y, .z = (int)pos.z},
+        materialID
+    );
+    return 0;
+}
+
+static int l_scene_place(lua_State* l) {
+    Scene* scene;
+    int model;
+    vec3 pos;
+    vec3 rot;
+    bool res = lua_pop_fc(
         l,
-        format,
-        &outputFile,
-        &logFunction,
-        &deviceFunction,
-        &rendererSettings.rendererCode,
-        &rendererSettings.iterationCode,
-        &rendererSettings.outputCode,
-        &rendererSettings.wgSize.x,
-        &rendererSettings.wgSize.y,
-        &rendererSettings.imageSize.x,
-        &rendererSettings.imageSize.y,
-        &rendererSettings.iterations,
-        &rendererSettings.maxRayDepth,
-        &sceneCreateInfo.size.x,
-        &sceneCreateInfo.size.y,
-        &sceneCreateInfo.size.z,
-        &sceneCreateInfo.bg.color.r,
-        &sceneCreateInfo.bg.color.g,
-        &sceneCreateInfo.bg.color.b,
-        &sceneCreateInfo.bg.properties.x,
-        &sceneDataFunction,
-        &cameraCreateInfo.sensorSize.x,
-        &cameraCreateInfo.sensorSize.y,
-        &cameraCreateInfo.focalLength,
-        &cameraCreateInfo.pos.x,
-        &cameraCreateInfo.pos.y,
-        &cameraCreateInfo.pos.z,
-        &cameraCreateInfo.rot.x,
-        &cameraCreateInfo.rot.y,
-        &cameraCreateInfo.rot.z
+        placeFormat,
+        &rot.x,
+        &rot.y,
+        &rot.z,
+        &pos.x,
+        &pos.y,
+        &pos.z,
+        &model,
+        &scene
     );
 
-    if (!res) {
-        ERROR("failed to parse config file \"%s\"\n", fileName);
-        return 1;
-    }
+    if (!res) lua_raise_error(l, "invalid model, position or rotation");
+    scene_place_model(
+        scene,
+        model,
+        (ivec3){.x = (int)pos.x, .y = (int)pos.y, .z = (int)pos.z},
+        (ivec3){.x = (int)rot.x, .y = (int)rot.y, .z = (int)rot.z}
+    );
+    return 0;
+}
 
-    LogArg logArg = {l, logFunction};
-    set_log_fn(l_log, &logArg);
+static int pop_device_selection(lua_State* l, int deviceCount, int** indices) {
+    // the selector returns either a single device index or a list of them,
+    // which is popped whatever it holds
+    int top = lua_gettop(l) - 1;
+    size_t length = lua_istable(l, -1) ? lua_rawlen(l, -1) : 1;
 
-    INFO("creating microcompute instance");
-    mc_Instance* instance = mc_instance_create((mc_log_fn*)new_log, NULL);
-    if (instance == NULL) {
-        ERROR("failed to create microcompute instance");
-        return 1;
+    // a longer list can't be a selection of distinct devices
+    if (length == 0 || length > (size_t)deviceCount) {
+        lua_settop(l, top);
+        return 0;
+    }
+
+    int count = (int)length;
+    *indices = malloc(sizeof **indices * count);
+
+    bool valid = true;
+    if (!lua_istable(l, -1)) {
+        valid = lua_pop_f(l, "i", &(*indices)[0]);
+    } else {
+        for (int i = 0; valid && i < count; i++) {
+            lua_rawgeti(l, -1, i + 1);
+            valid = lua_pop_f(l, "i", &(*indices)[i]);
+        }
+    }
+    lua_settop(l, top);
+    if (!valid) return 0;
+
+    for (int i = 0; i < count; i++) {
+        if ((*indices)[i] < 1 || (*indices)[i] > deviceCount) return 0;
+        for (int j = 0; j < i; j++) {
+            if ((*indices)[i] == (*indices)[j]) return 0;
+        }
     }
 
+    return count;
+}
+
+static int select_devices(
+    lua_State* l,
+    mc_Instance* instance,
+    int deviceFunction,
+    RenderDevice** devices
+) {
     INFO("running device selection function\n");
+    log_sink_lock();
     lua_rawgeti(l, LUA_REGISTRYINDEX, deviceFunction);
     int deviceCount = (int)mc_instance_get_device_count(instance);
 
@@ -188,75 +303,706 @@ int main(int argc, char** argv) {
 
     if (lua_pcall(l, 1, 1, 0)) {
         ERROR("error in device selector function: %s\n", lua_tostring(l, -1));
-        return 1;
+        lua_pop(l, 1);
+        log_sink_unlock();
+        return 0;
     }
 
-    int deviceIndex;
-    res = lua_pop_f(l, "i", &deviceIndex);
+    int* deviceIndices = NULL;
+    int selectedCount = pop_device_selection(l, deviceCount, &deviceIndices);
+    log_sink_unlock();
 
-    if (!res || deviceIndex < 1 || deviceIndex > deviceCount) {
+    if (selectedCount <= 0) {
         ERROR("invalid device index");
-        return 1;
+        free(deviceIndices);
+        return 0;
     }
 
-    mc_Device* dev = mc_instance_get_devices(instance)[deviceIndex - 1];
+    mc_Device** allDevices = mc_instance_get_devices(instance);
+    *devices = malloc(sizeof **devices * selectedCount);
+    for (int i = 0; i < selectedCount; i++) {
+        (*devices)[i] = (RenderDevice){.dev = allDevices[deviceIndices[i] - 1]};
+        INFO("using device \"%s\"", mc_device_get_name((*devices)[i].dev));
+    }
+    free(deviceIndices);
 
-    INFO("using device \"%s\"", mc_device_get_name(dev));
+    return selectedCount;
+}
 
-    Scene* scene = scene_create(dev, sceneCreateInfo);
-    if (scene == NULL) {
-        ERROR("failed to create scene");
-        return 1;
+static bool load_config(
+    lua_State* l,
+    const char* fileName,
+    const char* jobFile,
+    Config* config
+) {
+    *config = (Config){
+        .logFunction = LUA_NOREF,
+        .deviceFunction = LUA_NOREF,
+        .sceneDataFunction = LUA_NOREF,
+    };
+
+    // a failed parse leaves the config table on the stack
+    int top = lua_gettop(l);
+
+    INFO("reading config file \"%s\"", fileName);
+    if (luaL_dofile(l, fileName)) {
+        ERROR(
+            "failed to run config file \"%s\": %s\n",
+            fileName,
+            lua_tostring(l, -1)
+        );
+        lua_pop(l, 1);
+        return false;
     }
 
-    Camera* camera = camera_create(dev, cameraCreateInfo);
-    if (camera == NULL) {
-        ERROR("failed to create camera");
-        return 1;
+    // a job gets the base config as its argument, it can either modify it or
+    // return a new table
+    if (jobFile != NULL && strcmp(jobFile, "-") != 0) {
+        INFO("running job file \"%s\"", jobFile);
+        lua_pushvalue(l, -1);
+        if (luaL_loadfile(l, jobFile) != LUA_OK) {
+            const char* error = lua_tostring(l, -1);
+            ERROR("failed to load job \"%s\": %s", jobFile, error);
+            lua_pop(l, 3);
+            return false;
+        }
+        lua_insert(l, -2);
+        if (lua_pcall(l, 1, 1, 0)) {
+            ERROR("failed to run job \"%s\": %s", jobFile, lua_tostring(l, -1));
+            lua_pop(l, 2);
+            return false;
+        }
+        if (lua_istable(l, -1)) lua_remove(l, -2);
+        else lua_pop(l, 1);
+    }
+
+    if (!config_parse(l, config)) {
+        ERROR("failed to parse config file \"%s\"\n", fileName);
+        lua_settop(l, top);
+        return false;
+    }
+
+    return true;
+}
+
+static void* create_instance(void* arg) {
+    DeviceSetup* setup = arg;
+    double start = mc_get_time();
+    INFO("creating microcompute instance");
+    setup->instance = mc_instance_create((mc_log_fn*)new_log, NULL);
+    setup->instanceTime = mc_get_time() - start;
+    return NULL;
+}
+
+static void device_setup_start(
+    DeviceSetup* setup,
+    lua_State* l,
+    int deviceFunction
+) {
+    *setup = (DeviceSetup){.l = l, .deviceFunction = deviceFunction};
+    setup->started
+        = pthread_create(&setup->thread, NULL, create_instance, setup) == 0;
+    if (!setup->started) create_instance(setup);
+}
+
+// waits for the instance and selects the devices on the first call, returns
+// the number of devices (0 on failure, which is final)
+static int device_setup_get(DeviceSetup* setup) {
+    if (setup->ready) {
+        if (setup->deviceCount == 0) ERROR("no devices, device setup failed");
+        return setup->deviceCount;
+    }
+    setup->ready = true;
+
+    if (setup->started) pthread_join(setup->thread, NULL);
+    setup->started = false;
+    if (setup->instance == NULL) {
+        ERROR("failed to create microcompute instance");
+        return 0;
+    }
+
+    double start = mc_get_time();
+    setup->deviceCount = select_devices(
+        setup->l,
+        setup->instance,
+        setup->deviceFunction,
+        &setup->devices
+    );
+    setup->selectionTime = mc_get_time() - start;
+    return setup->deviceCount;
+}
+
+static void* compile_shaders(void* arg) {
+    ShaderSetup* setup = arg;
+    double start = mc_get_time();
+    setup->res = render_prepare(setup->settings, setup->sceneInfo);
+    setup->time = mc_get_time() - start;
+    return NULL;
+}
+
+static void shader_setup_start(
+    ShaderSetup* setup,
+    RenderSettings settings,
+    SceneCreateInfo sceneInfo
+) {
+    *setup = (ShaderSetup){.settings = settings, .sceneInfo = sceneInfo};
+    setup->started
+        = pthread_create(&setup->thread, NULL, compile_shaders, setup) == 0;
+    if (!setup->started) compile_shaders(setup);
+}
+
+static void shader_setup_join(ShaderSetup* setup) {
+    if (setup->started) pthread_join(setup->thread, NULL);
+    setup->started = false;
+}
+
+static Scene* build_scene(lua_State* l, Config* config) {
+    // built on the host only, it is copied to the devices if no cached copy of
+    // the same scene exists
+    Scene* scene = scene_create(NULL, config->sceneCreateInfo);
+    if (scene == NULL) {
+        ERROR("failed to create scene");
+        return NULL;
     }
 
     INFO("running voxel placer function\n");
-    lua_rawgeti(l, LUA_REGISTRYINDEX, sceneDataFunction);
+    log_sink_lock();
+    lua_rawgeti(l, LUA_REGISTRYINDEX, config->sceneDataFunction);
 
     lua_push_f(
         l,
-        "{_scene: u, size: {1: i, 2: i, 3: i}, register_material: l, set: l}",
+        "{"
+        "    _scene: u,"
+        "    size: {1: i, 2: i, 3: i},"
+        "    register_material: l,"
+        "    set: l,"
+        "    register_model: l,"
+        "    model_set: l,"
+        "    place: l"
+        "}",
         scene,
-        sceneCreateInfo.size.x,
-        sceneCreateInfo.size.y,
-        sceneCreateInfo.size.z,
+        config->sceneCreateInfo.size.x,
+        config->sceneCreateInfo.size.y,
+        config->sceneCreateInfo.size.z,
         l_scene_register_material,
-        l_scene_set
+        l_scene_set,
+        l_scene_register_model,
+        l_scene_model_set,
+        l_scene_place
     );
 
     if (lua_pcall(l, 1, 0, 0)) {
         ERROR("error in voxel placer function: %s\n", lua_tostring(l, -1));
-        return 1;
+        lua_pop(l, 1);
+        log_sink_unlock();
+        scene_destroy(scene);
+        return NULL;
+    }
+    log_sink_unlock();
+
+    return scene;
+}
+
+static Scene* get_device_scene(Scene* scene, uint64_t hash, mc_Device* dev) {
+    CachedScene* oldest = NULL;
+    int deviceScenes = 0;
+
+    for (int i = 0; i < sceneCacheCount; i++) {
+        CachedScene* entry = &sceneCache[i];
+        if (entry->dev != dev) continue;
+        if (entry->hash == hash) {
+            DEBUG("reusing cached scene %016lx", (unsigned long)hash);
+            entry->lastUse = sceneCacheClock++;
+            return entry->scene;
+        }
+        if (oldest == NULL || entry->lastUse < oldest->lastUse) oldest = entry;
+        deviceScenes++;
+    }
+
+    Scene* clone = scene_clone(scene, dev);
+    if (clone == NULL) return NULL;
+
+    CachedScene newEntry = {hash, dev, clone, sceneCacheClock++};
+    if (deviceScenes >= SCENE_CACHE_SIZE) {
+        DEBUG("evicting cached scene %016lx", (unsigned long)oldest->hash);
+        scene_destroy(oldest->scene);
+        *oldest = newEntry;
+    } else {
+        sceneCache = realloc(
+            sceneCache,
+            sizeof *sceneCache * (sceneCacheCount + 1)
+        );
+        sceneCache[sceneCacheCount++] = newEntry;
+    }
+
+    return clone;
+}
+
+static void scene_cache_clear(void) {
+    for (int i = 0; i < sceneCacheCount; i++) {
+        scene_destroy(sceneCache[i].scene);
+    }
+    free(sceneCache);
+    sceneCache = NULL;
+    sceneCacheCount = 0;
+}
+
+// both sides are scaled by the same factor, so the aspect ratio is kept
+static uvec2 preview_content_size(uvec2 size) {
+    uint x = (size.x + PREVIEW_SCALE / 2) / PREVIEW_SCALE;
+    uint y = (size.y + PREVIEW_SCALE / 2) / PREVIEW_SCALE;
+    return (uvec2){{x > 0 ? x : 1, y > 0 ? y : 1}};
+}
+
+static uint pad_size(uint size, uint wgSize) {
+    return (size + wgSize - 1) / wgSize * wgSize;
+}
+
+// a quick look at the config: fewer samples of fewer pixels, shaded directly,
+// which are upscaled to the full image size afterwards, the content size is
+// padded to whole workgroups
+static RenderSettings preview_settings(
+    RenderSettings settings,
+    uvec2 contentSize
+) {
+    if (settings.wgSize.x == 0 || settings.wgSize.y == 0) {
+        settings.wgSize.x = PREVIEW_WORKGROUP_SIZE;
+        settings.wgSize.y = PREVIEW_WORKGROUP_SIZE;
+    }
+
+    settings.imageSize.x = pad_size(contentSize.x, settings.wgSize.x);
+    settings.imageSize.y = pad_size(contentSize.y, settings.wgSize.y);
+    settings.iterations = PREVIEW_ITERATIONS;
+    settings.timeBudgetMs = 0;
+    settings.targetNoise = 0.0f;
+    settings.batchSize = PREVIEW_ITERATIONS;
+    settings.denoisePasses = 0;
+    settings.preview = true;
+    settings.partialFile = NULL; // too few samples to be worth merging
+    return settings;
+}
+
+// cuts the content out of the middle of every padded preview view
+static unsigned char* crop_preview(
+    const unsigned char* image,
+    uvec2 paddedSize,
+    uvec2 contentSize,
+    uint viewCount
+) {
+    uint offsetX = (paddedSize.x - contentSize.x) / 2;
+    uint offsetY = (paddedSize.y - contentSize.y) / 2;
+    size_t rowBytes = (size_t)contentSize.x * 4;
+    unsigned char* out = malloc(rowBytes * contentSize.y * viewCount);
+
+    for (uint view = 0; view < viewCount; view++) {
+        for (uint y = 0; y < contentSize.y; y++) {
+            size_t row = (size_t)view * paddedSize.y + offsetY + y;
+            const unsigned char* src
+                = image + (row * paddedSize.x + offsetX) * 4;
+            size_t dstRow = (size_t)view * contentSize.y + y;
+            memcpy(out + dstRow * rowBytes, src, rowBytes);
+        }
+    }
+    return out;
+}
+
+// each view of a multi-view camera is written to "<name>_<view>.<ext>"
+static char* view_file_name(const char* fileName, uint view) {
+    const char* ext = strrchr(fileName, '.');
+    const char* dir = strrchr(fileName, '/');
+    if (ext == NULL || (dir && ext < dir)) ext = fileName + strlen(fileName);
+
+    int stem = (int)(ext - fileName);
+    int len = snprintf(NULL, 0, "%.*s_%u%s", stem, fileName, view, ext);
+    char* name = malloc(len + 1);
+    snprintf(name, len + 1, "%.*s_%u%s", stem, fileName, view, ext);
+    return name;
+}
+
+// the views are encoded in the background, the writers take the image
+static ImageWriter** start_writers(
+    Config* config,
+    unsigned char* image,
+    uvec2 viewSize,
+    uint viewCount
+) {
+    ImageWriter** writers = calloc(viewCount, sizeof *writers);
+    size_t viewBytes = (size_t)viewSize.x * viewSize.y * 4;
+    for (uint i = 0; i < viewCount; i++) {
+        char* fileName = viewCount > 1 ? view_file_name(config->outputFile, i)
+                                       : strdup(config->outputFile);
+        unsigned char* viewImage = image;
+        if (viewCount > 1) {
+            viewImage = malloc(viewBytes);
+            memcpy(viewImage, image + viewBytes * i, viewBytes);
+        }
+
+        INFO("writing image to \"%s\"", fileName);
+        writers[i] = image_writer_start(
+            fileName,
+            viewImage,
+            viewSize,
+            config->outputFormat
+        );
+        free(fileName);
+        if (viewImage == image) image = NULL; // owned by the writer now
+    }
+
+    free(image);
+    return writers;
+}
+
+// the writers of a job, joined by the caller once the job is cleaned up
+typedef struct PendingWrites {
+    ImageWriter** writers; ///< NULL if nothing is being written
+    uint viewCount;        ///< the number of writers
+} PendingWrites;
+
+// returns false if any of the views failed to start or to be written
+static bool finish_writers(ImageWriter** writers, uint viewCount) {
+    if (writers == NULL) return true;
+    bool res = true;
+    for (uint i = 0; i < viewCount; i++) {
+        if (writers[i] == NULL || !image_writer_finish(writers[i])) {
+            res = false;
+        }
+    }
+    free(writers);
+    return res;
+}
+
+// the phases that can overlap run in the background, their sum is what a
+// sequential startup would have taken
+static void log_startup(
+    DeviceSetup* devices,
+    bool instanceCreated,
+    double sceneTime,
+    double copyTime,
+    ShaderSetup* shaders,
+    double total
+) {
+    double sum = sceneTime + copyTime + shaders->time;
+    INFO("startup breakdown:");
+    INFO("- scene building: %.3fs", sceneTime);
+    if (instanceCreated) {
+        INFO("- instance creation: %.3fs (background)", devices->instanceTime);
+        INFO("- device selection: %.3fs", devices->selectionTime);
+        sum += devices->instanceTime + devices->selectionTime;
+    }
+    INFO("- scene copy: %.3fs", copyTime);
+    INFO("- shader compilation: %.3fs (background)", shaders->time);
+    INFO("- until render: %.3fs (%.3fs in sequence)", total, sum);
+}
+
+static bool run_job(
+    lua_State* l,
+    Config* config,
+    DeviceSetup* deviceSetup,
+    bool preview,
+    PendingWrites* writes
+) {
+    *writes = (PendingWrites){.writers = NULL, .viewCount = 0};
+    memory_reset_peaks();
+    double start = mc_get_time();
+
+    // all views are rendered in one image, stacked vertically
+    uint viewCount = config->cameraCreateInfo.viewCount;
+    if (viewCount == 0) viewCount = 1;
+    uvec2 viewSize = config->renderSettings.imageSize;
+
+    RenderSettings settings = config->renderSettings;
+    CameraCreateInfo cameraInfo = config->cameraCreateInfo;
+    uvec2 previewSize = {0};
+    if (preview) {
+        previewSize = preview_content_size(viewSize);
+        settings = preview_settings(settings, previewSize);
+        // the padding widens the view around the content instead of
+        // stretching it
+        uvec2 padded = settings.imageSize;
+        cameraInfo.sensorSize.x *= (float)padded.x / (float)previewSize.x;
+        cameraInfo.sensorSize.y *= (float)padded.y / (float)previewSize.y;
+    }
+    uvec2 renderViewSize = settings.imageSize;
+    settings.imageSize.y *= viewCount;
+
+    ShaderSetup shaders;
+    shader_setup_start(&shaders, settings, config->sceneCreateInfo);
+
+    Scene* scene = build_scene(l, config);
+    double sceneTime = mc_get_time() - start;
+
+    bool instanceCreated = !deviceSetup->ready;
+    int deviceCount = scene ? device_setup_get(deviceSetup) : 0;
+    RenderDevice* devices = deviceSetup->devices;
+    bool res = scene != NULL && deviceCount > 0;
+
+    double copyStart = mc_get_time();
+    uint64_t hash = res ? scene_hash(scene) : 0;
+    for (int i = 0; res && i < deviceCount; i++) {
+        devices[i].scene = get_device_scene(scene, hash, devices[i].dev);
+        if (devices[i].scene == NULL) {
+            ERROR("failed to copy scene");
+            res = false;
+        }
+    }
+    if (scene) scene_destroy(scene);
+
+    for (int i = 0; res && i < deviceCount; i++) {
+        devices[i].camera = camera_create(devices[i].dev, cameraInfo);
+        if (devices[i].camera == NULL) {
+            ERROR("failed to create camera");
+            res = false;
+        }
+    }
+    double copyTime = mc_get_time() - copyStart;
+
+    // render compiles whatever failed here again and reports the error
+    shader_setup_join(&shaders);
+    if (res) {
+        double total = mc_get_time() - start;
+        log_startup(
+            deviceSetup,
+            instanceCreated,
+            sceneTime,
+            copyTime,
+            &shaders,
+            total
+        );
     }
 
-    unsigned char* image = render(dev, rendererSettings, scene, camera);
-    if (image == NULL) {
+    unsigned char* image = NULL;
+    if (res) image = render(devices, deviceCount, settings);
+    if (res && image == NULL) {
         ERROR("failed to render image");
+        res = false;
+    }
+
+    if (res && preview) {
+        uvec2 size = {{viewSize.x, viewSize.y * viewCount}};
+        INFO("upscaling preview to %dx%d", size.x, size.y);
+        unsigned char* content
+            = crop_preview(image, renderViewSize, previewSize, viewCount);
+        uvec2 contentSize = {{previewSize.x, previewSize.y * viewCount}};
+        unsigned char* upscaled = upscale_image(content, contentSize, size);
+        free(content);
+        free(image);
+        image = upscaled;
+    }
+
+    // the views are encoded in the background while the job is cleaned up,
+    // the caller joins the writers once it has cleaned up too
+    if (res) {
+        writes->writers = start_writers(config, image, viewSize, viewCount);
+        writes->viewCount = viewCount;
+    } else {
+        free(image);
+    }
+
+    for (int i = 0; i < deviceCount; i++) {
+        if (devices[i].camera != NULL) camera_destroy(devices[i].camera);
+        devices[i].camera = NULL;
+        devices[i].scene = NULL;
+    }
+
+    // the device scenes stay cached for later jobs and are still included
+    memory_log_report();
+    return res;
+}
+
+// combines the partial renders of one frame (rendered with this config) and
+// finishes the image like a single render would
+static bool run_merge(Config* config, char** partialFiles, int partialCount) {
+    PartialImage* partials = calloc(partialCount, sizeof *partials);
+    bool res = true;
+    for (int i = 0; res && i < partialCount; i++) {
+        INFO("reading partial render \"%s\"", partialFiles[i]);
+        res = partial_read(partialFiles[i], &partials[i]);
+        if (res) {
+            INFO(
+                "- iterations %d to %d",
+                partials[i].firstIteration,
+                partials[i].firstIteration + partials[i].samples - 1
+            );
+        }
+    }
+
+    PartialImage merged = {0};
+    res = res && partial_merge(partials, partialCount, &merged);
+    for (int i = 0; i < partialCount; i++) partial_free(&partials[i]);
+    free(partials);
+
+    uint viewCount = config->cameraCreateInfo.viewCount;
+    if (viewCount == 0) viewCount = 1;
+    if (res && merged.size.y % viewCount != 0) {
+        ERROR("image height doesn't match the %d camera views", viewCount);
+        res = false;
+    }
+    if (!res) {
+        partial_free(&merged);
+        return false;
+    }
+
+    INFO("merged %d samples per pixel", merged.samples);
+    unsigned char* image = render_finish_cpu(
+        merged.image,
+        merged.albedo,
+        merged.normal,
+        merged.size,
+        config->renderSettings.denoisePasses
+    );
+    uvec2 viewSize = {{merged.size.x, merged.size.y / viewCount}};
+    partial_free(&merged);
+
+    ImageWriter** writers = start_writers(config, image, viewSize, viewCount);
+    return finish_writers(writers, viewCount);
+}
+
+// returns false if the daemon couldn't run its jobs at all
+static bool run_daemon(
+    lua_State* l,
+    const char* fileName,
+    DeviceSetup* deviceSetup,
+    bool preview
+) {
+    // jobs are read from stdin while the current one renders, one per line:
+    // "<priority> <job file>", a job file of "-" renders the base config as is
+    JobQueue* queue = job_queue_create();
+    if (!job_queue_start_reader(queue, stdin)) {
+        ERROR("failed to start job reader");
+        job_queue_destroy(queue);
+        return false;
+    }
+
+    INFO("waiting for jobs");
+    Job job;
+    bool setupFailed = false;
+    while (!setupFailed && job_queue_pop(queue, &job)) {
+        INFO("starting job \"%s\" (priority %d)", job.jobFile, job.priority);
+        double startTime = mc_get_time();
+
+        Config config;
+        log_sink_lock();
+        bool res = load_config(l, fileName, job.jobFile, &config);
+        log_sink_unlock();
+
+        PendingWrites writes = {.writers = NULL, .viewCount = 0};
+        if (res) res = run_job(l, &config, deviceSetup, preview, &writes);
+
+        log_sink_lock();
+        config_free(l, &config);
+        log_sink_unlock();
+
+        if (res) res = finish_writers(writes.writers, writes.viewCount);
+        if (res) {
+            double time = mc_get_time() - startTime;
+            INFO("finished job \"%s\" in %.3fs", job.jobFile, time);
+        } else {
+            ERROR("job \"%s\" failed", job.jobFile);
+        }
+        free(job.jobFile);
+
+        // the devices come from the base config, no later job can get any
+        setupFailed = deviceSetup->ready && deviceSetup->deviceCount == 0;
+    }
+
+    if (setupFailed) ERROR("device setup failed, stopping");
+    else INFO("no more jobs");
+    job_queue_destroy(queue);
+    return !setupFailed;
+}
+
+int main(int argc, char** argv) {
+    bool daemonMode = false;
+    bool preview = false;
+    bool mergeMode = argc > 1 && strcmp(argv[1], "merge") == 0;
+    int arg = 1;
+    for (; !mergeMode && arg < argc - 1; arg++) {
+        if (strcmp(argv[arg], "--daemon") == 0) daemonMode = true;
+        else if (strcmp(argv[arg], "--preview") == 0) preview = true;
+        else break;
+    }
+
+    if (mergeMode && argc < 4) {
+        ERROR("usage: %s merge <config file> <partial files...>", argv[0]);
+        return 1;
+    } else if (!mergeMode && arg != argc - 1) {
+        ERROR("usage: %s [--daemon] [--preview] <config file>", argv[0]);
+        ERROR("       %s merge <config file> <partial files...>", argv[0]);
         return 1;
     }
 
-    INFO("writing image to \"%s\"", outputFile);
-    stbi_write_bmp(
-        outputFile,
-        (int)rendererSettings.imageSize.x,
-        (int)rendererSettings.imageSize.y,
-        4,
-        image
+    char* fileName = mergeMode ? argv[2] : argv[argc - 1];
+
+    lua_State* l = luaL_newstate();
+    luaL_openlibs(l);
+    lua_register(l, "memory_report", l_memory_report);
+
+    materialFormat = lua_format_compile(
+        l,
+        "{color: {1: f, 2: f, 3: f}, emission: f}; {_scene: u}"
+    );
+    sceneSetFormat
+        = lua_format_compile(l, "i; {1: f, 2: f, 3: f}; {_scene: u}");
+    modelFormat = lua_format_compile(l, "{1: f, 2: f, 3: f}; {_scene: u}");
+    modelSetFormat = lua_format_compile(
+        l,
+        "i; {1: f, 2: f, 3: f}; i; {_scene: u}"
+    );
+    placeFormat = lua_format_compile(
+        l,
+        "{1: f, 2: f, 3: f}; {1: f, 2: f, 3: f}; i; {_scene: u}"
     );
 
-    INFO("cleanup");
-    free(image);
-    scene_destroy(scene);
-    camera_destroy(camera);
-    mc_instance_destroy(instance);
+    // in daemon mode, the logger and devices of the base config are used for
+    // every job
+    Config config;
+    if (!load_config(l, fileName, NULL, &config)) return 1;
+
+    LogArg logArg = {l, config.logFunction};
+    set_log_fn(l_log, &logArg);
+    set_log_level(config.logLevel);
+
+    // from here on logs reach the lua log function from a background thread,
+    // so the lua state must be locked whenever it is used on this thread
+    log_start_async();
+    atexit(log_stop_async);
+
+    bool res = true;
+    if (mergeMode) {
+        // merging happens on the cpu, no devices are needed
+        res = run_merge(&config, argv + 3, argc - 3);
+    } else {
+        // the instance is created while the (first) scene is built
+        DeviceSetup deviceSetup;
+        device_setup_start(&deviceSetup, l, config.deviceFunction);
+
+        PendingWrites writes = {.writers = NULL, .viewCount = 0};
+        if (daemonMode) {
+            res = run_daemon(l, fileName, &deviceSetup, preview);
+        } else {
+            res = run_job(l, &config, &deviceSetup, preview, &writes);
+        }
+
+        INFO("cleanup");
+        if (deviceSetup.started) pthread_join(deviceSetup.thread, NULL);
+        scene_cache_clear();
+        free(deviceSetup.devices);
+        render_release_programs();
+        shader_cache_clear();
+        if (deviceSetup.instance) mc_instance_destroy(deviceSetup.instance);
+
+        if (!finish_writers(writes.writers, writes.viewCount)) res = false;
+    }
 
     INFO("all done, goodbye!");
 
+    log_stop_async();
+    config_free(l, &config);
+    lua_format_destroy(l, materialFormat);
+    lua_format_destroy(l, sceneSetFormat);
+    lua_format_destroy(l, modelFormat);
+    lua_format_destroy(l, modelSetFormat);
+    lua_format_destroy(l, placeFormat);
     lua_close(l);
-    return 0;
+    return res ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include <pthread.h>
+
+#include "logger/logger.h"
+#include "memory.h"
+
+static const char* categoryNames[MEMORY_CATEGORY_COUNT] = {
+    "scene_voxels",
+    "scene_materials",
+    "scene_lod",
+    "instances",
+    "render_images",
+    "render_accum",
+};
+
+// render workers allocate from their own threads
+static pthread_mutex_t memoryMutex = PTHREAD_MUTEX_INITIALIZER;
+static MemoryStats categoryStats[MEMORY_CATEGORY_COUNT];
+static MemoryStats totalStats;
+
+static void apply(MemoryStats* stats, MemoryUsage old, MemoryUsage usage) {
+    stats->current.host = stats->current.host - old.host + usage.host;
+    stats->current.device = stats->current.device - old.device + usage.device;
+    if (stats->current.host > stats->peak.host)
+        stats->peak.host = stats->current.host;
+    if (stats->current.device > stats->peak.device)
+        stats->peak.device = stats->current.device;
+}
+
+void memory_update(
+    MemoryCategory category,
+    MemoryUsage* tracked,
+    MemoryUsage usage
+) {
+    CHECK_NULL(tracked)
+    pthread_mutex_lock(&memoryMutex);
+    apply(&categoryStats[category], *tracked, usage);
+    apply(&totalStats, *tracked, usage);
+    *tracked = usage;
+    pthread_mutex_unlock(&memoryMutex);
+}
+
+MemoryStats memory_get_stats(MemoryCategory category) {
+    pthread_mutex_lock(&memoryMutex);
+    MemoryStats stats = categoryStats[category];
+    pthread_mutex_unlock(&memoryMutex);
+    return stats;
+}
+
+MemoryStats memory_get_total(void) {
+    pthread_mutex_lock(&memoryMutex);
+    MemoryStats stats = totalStats;
+    pthread_mutex_unlock(&memoryMutex);
+    return stats;
+}
+
+const char* memory_category_name(MemoryCategory category) {
+    return categoryNames[category];
+}
+
+void memory_reset_peaks(void) {
+    pthread_mutex_lock(&memoryMutex);
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        categoryStats[i].peak = categoryStats[i].current;
+    }
+    totalStats.peak = totalStats.current;
+    pthread_mutex_unlock(&memoryMutex);
+}
+
+static double mib(size_t bytes) {
+    return (double)bytes / (1024.0 * 1024.0);
+}
+
+static void log_stats(const char* name, MemoryStats stats) {
+    INFO(
+        "- %s: host %.2f MiB (peak %.2f), device %.2f MiB (peak %.2f)",
+        name,
+        mib(stats.current.host),
+        mib(stats.peak.host),
+        mib(stats.current.device),
+        mib(stats.peak.device)
+    );
+}
+
+void memory_log_report(void) {
+    INFO("memory usage:");
+    for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+        log_stats(categoryNames[i], memory_get_stats(i));
+    }
+    log_stats("total", memory_get_total());
+}
\ No newline at end of file
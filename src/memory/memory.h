@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef enum {
+    MEMORY_SCENE_VOXELS,    ///< The voxels of scenes
+    MEMORY_SCENE_MATERIALS, ///< The materials and data of scenes
+    MEMORY_SCENE_LOD,       ///< The levels of detail of scenes
+    MEMORY_INSTANCES,       ///< Models, instances and their grids
+    MEMORY_RENDER_IMAGES,   ///< Rendered images and their AOVs
+    MEMORY_RENDER_ACCUM,    ///< Accumulation, primary hit and info buffers
+    MEMORY_CATEGORY_COUNT,
+} MemoryCategory;
+
+typedef struct {
+    size_t host;   ///< Bytes in host memory
+    size_t device; ///< Bytes in device buffers
+} MemoryUsage;
+
+typedef struct {
+    MemoryUsage current; ///< The bytes in use right now
+    MemoryUsage peak;    ///< The most bytes in use since the last reset
+} MemoryStats;
+
+/**
+ * @brief Update the memory used by one owner (a scene, a render band, ...),
+ * the difference to what it used before is added to the category
+ * @param category The category of the memory
+ * @param tracked The usage of the owner that was tracked so far, replaced by
+ * the new one
+ * @param usage The new usage of the owner (zeroed when it is freed)
+ */
+void memory_update(
+    MemoryCategory category,
+    MemoryUsage* tracked,
+    MemoryUsage usage
+);
+
+/**
+ * @brief Get the memory statistics of a category
+ * @param category The category
+ * @return The statistics
+ */
+MemoryStats memory_get_stats(MemoryCategory category);
+
+/**
+ * @brief Get the memory statistics of all categories together (the peak is
+ * that of the sum, not the sum of the peaks)
+ * @return The statistics
+ */
+MemoryStats memory_get_total(void);
+
+/**
+ * @brief Get the name of a category
+ * @param category The category
+ * @return The name, e.g. "scene_voxels"
+ */
+const char* memory_category_name(MemoryCategory category);
+
+/**
+ * @brief Reset all peaks to the current usage
+ */
+void memory_reset_peaks(void);
+
+/**
+ * @brief Log the current and peak usage of all categories
+ */
+void memory_log_report(void);
\ No newline at end of file
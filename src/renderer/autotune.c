@@ -0,0 +1,121 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "autotune.h"
+#include "logger/logger.h"
+
+// one result per line: "<shader hash> <x> <y> <device name>", the device name
+// comes last since it may contain spaces
+
+static bool parse_line(
+    const char* line,
+    uint64_t* shaderHash,
+    uvec2* wgSize,
+    const char** device
+) {
+    int nameStart;
+    int res = sscanf(
+        line,
+        "%" SCNx64 " %u %u %n",
+        shaderHash,
+        &wgSize->x,
+        &wgSize->y,
+        &nameStart
+    );
+    if (res != 3) return false;
+    *device = line + nameStart;
+    return true;
+}
+
+bool autotune_cache_lookup(
+    const char* file,
+    const char* device,
+    uint64_t shaderHash,
+    uvec2* wgSize
+) {
+    CHECK_NULL(file, false)
+    CHECK_NULL(device, false)
+
+    FILE* f = fopen(file, "r");
+    if (f == NULL) return false;
+
+    char* line = NULL;
+    size_t lineSize = 0;
+    bool found = false;
+
+    while (!found && getline(&line, &lineSize, f) != -1) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        uint64_t hash;
+        uvec2 size;
+        const char* name;
+        if (!parse_line(line, &hash, &size, &name)) continue;
+
+        if (hash == shaderHash && strcmp(name, device) == 0) {
+            *wgSize = size;
+            found = true;
+        }
+    }
+
+    free(line);
+    fclose(f);
+    return found;
+}
+
+void autotune_cache_store(
+    const char* file,
+    const char* device,
+    uint64_t shaderHash,
+    uvec2 wgSize
+) {
+    CHECK_NULL(file)
+    CHECK_NULL(device)
+
+    // keep every other entry, the file is tiny so it is simply rewritten
+    char* kept = NULL;
+    size_t keptSize = 0;
+    FILE* out = open_memstream(&kept, &keptSize);
+
+    FILE* f = fopen(file, "r");
+    if (f != NULL) {
+        char* line = NULL;
+        size_t lineSize = 0;
+
+        while (getline(&line, &lineSize, f) != -1) {
+            line[strcspn(line, "\r\n")] = '\0';
+
+            uint64_t hash;
+            uvec2 size;
+            const char* name;
+            if (!parse_line(line, &hash, &size, &name)) continue;
+            if (hash == shaderHash && strcmp(name, device) == 0) continue;
+            fprintf(out, "%s\n", line);
+        }
+
+        free(line);
+        fclose(f);
+    }
+
+    fprintf(
+        out,
+        "%016" PRIx64 " %u %u %s\n",
+        shaderHash,
+        wgSize.x,
+        wgSize.y,
+        device
+    );
+    fclose(out);
+
+    f = fopen(file, "w");
+    if (f == NULL) {
+        ERROR("failed to write workgroup size cache \"%s\"", file);
+        free(kept);
+        return;
+    }
+
+    fwrite(kept, 1, keptSize, f);
+    fclose(f);
+    free(kept);
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vector.h"
+
+/**
+ * @brief Look up a tuned workgroup size in a cache file
+ * @param file The cache file (may not exist yet)
+ * @param device The name of the device
+ * @param shaderHash The hash of the shader code the size was tuned for
+ * @param wgSize The tuned workgroup size, only set if one was found
+ * @return true if the cache file has a size for the device and shader
+ */
+bool autotune_cache_lookup(
+    const char* file,
+    const char* device,
+    uint64_t shaderHash,
+    uvec2* wgSize
+);
+
+/**
+ * @brief Store a tuned workgroup size in a cache file, replacing an older one
+ * for the same device and shader
+ * @param file The cache file (created if it doesn't exist)
+ * @param device The name of the device
+ * @param shaderHash The hash of the shader code the size was tuned for
+ * @param wgSize The tuned workgroup size
+ */
+void autotune_cache_store(
+    const char* file,
+    const char* device,
+    uint64_t shaderHash,
+    uvec2 wgSize
+);
\ No newline at end of file
@@ -0,0 +1,96 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "denoiser.h"
+
+static const float kernel[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+static float edge_weight(vec3 a, vec3 b, float phi) {
+    float dx = a.x - b.x;
+    float dy = a.y - b.y;
+    float dz = a.z - b.z;
+    return expf(-(dx * dx + dy * dy + dz * dz) / phi);
+}
+
+DenoiseInfo denoise_pass_info(uint pass) {
+    // the color weight gets stricter with every pass since the image becomes
+    // smoother, which keeps edges that were preserved so far intact
+    return (DenoiseInfo){
+        .stepWidth = 1u << pass,
+        .colorPhi = 0.5f / (float)(1u << pass),
+        .normalPhi = 0.1f,
+        .albedoPhi = 0.05f,
+    };
+}
+
+static void denoise_pass(
+    const vec3* in,
+    vec3* out,
+    const vec3* albedo,
+    const vec3* normal,
+    uvec2 size,
+    DenoiseInfo info
+) {
+    for (int y = 0; y < (int)size.y; y++) {
+        for (int x = 0; x < (int)size.x; x++) {
+            int idx = y * (int)size.x + x;
+            vec3 c = in[idx];
+            vec3 n = normal[idx];
+            vec3 a = albedo[idx];
+
+            vec3 sum = {0, 0, 0};
+            float weightSum = 0;
+
+            for (int dy = -2; dy <= 2; dy++) {
+                for (int dx = -2; dx <= 2; dx++) {
+                    int px = x + dx * (int)info.stepWidth;
+                    int py = y + dy * (int)info.stepWidth;
+                    if (px < 0 || py < 0) continue;
+                    if (px >= (int)size.x || py >= (int)size.y) continue;
+
+                    int i = py * (int)size.x + px;
+                    float wc = edge_weight(c, in[i], info.colorPhi);
+                    float wn = edge_weight(n, normal[i], info.normalPhi);
+                    float wa = edge_weight(a, albedo[i], info.albedoPhi);
+                    float w = kernel[abs(dx)] * kernel[abs(dy)] * wc * wn * wa;
+
+                    sum.r += in[i].r * w;
+                    sum.g += in[i].g * w;
+                    sum.b += in[i].b * w;
+                    weightSum += w;
+                }
+            }
+
+            out[idx] = (vec3){
+                sum.r / weightSum,
+                sum.g / weightSum,
+                sum.b / weightSum,
+            };
+        }
+    }
+}
+
+void denoise_cpu(
+    vec3* image,
+    const vec3* albedo,
+    const vec3* normal,
+    uvec2 size,
+    uint passes
+) {
+    if (passes == 0) return;
+
+    vec3* tmp = malloc(sizeof *tmp * size.x * size.y);
+    vec3* in = image;
+    vec3* out = tmp;
+
+    for (uint i = 0; i < passes; i++) {
+        denoise_pass(in, out, albedo, normal, size, denoise_pass_info(i));
+        vec3* swap = in;
+        in = out;
+        out = swap;
+    }
+
+    if (in != image) memcpy(image, in, sizeof *image * size.x * size.y);
+    free(tmp);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "vector.h"
+
+typedef struct {
+    uint stepWidth;  ///< The distance between filter taps
+    float colorPhi;  ///< The color edge-stopping strength
+    float normalPhi; ///< The normal edge-stopping strength
+    float albedoPhi; ///< The albedo edge-stopping strength
+} DenoiseInfo;
+
+/**
+ * @brief Get the filter parameters for a denoising pass (matches the layout of
+ * the denoise shader info buffer)
+ * @param pass The index of the pass, starting at 0
+ * @return The filter parameters
+ */
+DenoiseInfo denoise_pass_info(uint pass);
+
+/**
+ * @brief Denoise an image on the CPU with an edge-avoiding a-trous filter
+ * @param image The image to denoise, overwritten with the result
+ * @param albedo The first-hit albedo of each pixel
+ * @param normal The first-hit normal of each pixel
+ * @param size The size of the image
+ * @param passes The number of filter passes
+ */
+void denoise_cpu(
+    vec3* image,
+    const vec3* albedo,
+    const vec3* normal,
+    uvec2 size,
+    uint passes
+);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "vector.h"
+
+/**
+ * @brief A stock shader compiled at build time (EMBED_SHADERS), it is used
+ * instead of compiling the same code, entrypoint ("main"), workgroup size and
+ * macro at runtime
+ */
+typedef struct {
+    const char* name;           ///< The name of the shader
+    const char* glsl;           ///< The GLSL code it was compiled from
+    uvec2 wgSize;               ///< The workgroup size
+    const char* macroName;      ///< The extra macro (NULL: none)
+    const char* macroValue;     ///< The value of the extra macro
+    const unsigned char* spirv; ///< The SPIR-V code
+    size_t size;                ///< The size of the SPIR-V code in bytes
+} EmbeddedShader;
+
+extern const EmbeddedShader embeddedShaders[]; ///< Generated at build time
+extern const uint embeddedShaderCount;         ///< Generated at build time
\ No newline at end of file
@@ -0,0 +1,258 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "frame_stream.h"
+#include "logger/logger.h"
+
+struct FrameStream {
+    uvec2 size;
+    char* file;          ///< The file frames are written to (NULL for shm)
+    FrameHeader* shm;    ///< The mapped shared memory (NULL for files)
+    size_t shmSize;      ///< The size of the mapping
+    uint sequence;       ///< The sequence number of the last file frame
+    vec3* image;         ///< Written by the render workers
+    unsigned char* rgba; ///< The converted image, only used by the thread
+    uint iteration;
+    bool pending;
+    bool stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
+static size_t pixels_size(FrameStream* stream) {
+    return (size_t)stream->size.x * stream->size.y * 4;
+}
+
+static void image_to_rgba(FrameStream* stream) {
+    size_t pixelCount = (size_t)stream->size.x * stream->size.y;
+    for (size_t i = 0; i < pixelCount; i++) {
+        vec3 pixel = stream->image[i];
+        float c[3] = {pixel.r, pixel.g, pixel.b};
+        for (int j = 0; j < 3; j++) {
+            int v = (int)(c[j] * 255);
+            stream->rgba[i * 4 + j] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+        stream->rgba[i * 4 + 3] = 255;
+    }
+}
+
+// marks the frame as being written, the fence keeps the (plain) frame writes
+// from becoming visible before the odd sequence number, a store alone only
+// orders the writes before it (an odd number left by a crashed writer is
+// rounded down)
+static uint shm_write_begin(FrameHeader* header) {
+    uint sequence = atomic_load_explicit(
+        &header->sequence,
+        memory_order_relaxed
+    ) & ~1u;
+    atomic_store_explicit(
+        &header->sequence,
+        sequence + 1,
+        memory_order_relaxed
+    );
+    atomic_thread_fence(memory_order_release);
+    return sequence;
+}
+
+static void shm_write_end(FrameHeader* header, uint sequence) {
+    atomic_store_explicit(
+        &header->sequence,
+        sequence + 2,
+        memory_order_release
+    );
+}
+
+// readers of the shared memory retry if the sequence number is odd or changed
+// while they copied the frame (see FrameHeader)
+static void write_shm(
+    FrameStream* stream,
+    const unsigned char* pixels,
+    uint iteration
+) {
+    FrameHeader* header = stream->shm;
+    uint sequence = shm_write_begin(header);
+    header->iteration = iteration;
+    memcpy(header + 1, pixels, pixels_size(stream));
+    shm_write_end(header, sequence);
+}
+
+// written next to the file and renamed, so readers never see half a frame
+static void write_file(
+    FrameStream* stream,
+    const unsigned char* pixels,
+    uint iteration
+) {
+    size_t nameSize = strlen(stream->file) + 5;
+    char* tmpName = malloc(nameSize);
+    snprintf(tmpName, nameSize, "%s.tmp", stream->file);
+
+    FILE* file = fopen(tmpName, "wb");
+    if (file == NULL) {
+        WARN("failed to write frame to \"%s\"", tmpName);
+        free(tmpName);
+        return;
+    }
+
+    stream->sequence += 2;
+    FrameHeader header = {
+        .magic = {'V', 'R', 'F', 'B'},
+        .width = stream->size.x,
+        .height = stream->size.y,
+        .iteration = iteration,
+    };
+    atomic_init(&header.sequence, stream->sequence);
+
+    bool res = fwrite(&header, sizeof header, 1, file) == 1
+            && fwrite(pixels, pixels_size(stream), 1, file) == 1;
+    res = fclose(file) == 0 && res;
+    if (res) res = rename(tmpName, stream->file) == 0;
+    if (!res) WARN("failed to write frame to \"%s\"", stream->file);
+    free(tmpName);
+}
+
+static void write_frame(
+    FrameStream* stream,
+    const unsigned char* pixels,
+    uint iteration
+) {
+    if (stream->shm) write_shm(stream, pixels, iteration);
+    else write_file(stream, pixels, iteration);
+}
+
+static void* stream_thread(void* arg) {
+    FrameStream* stream = arg;
+
+    pthread_mutex_lock(&stream->mutex);
+    while (true) {
+        while (!stream->pending && !stream->stopping) {
+            pthread_cond_wait(&stream->cond, &stream->mutex);
+        }
+        if (!stream->pending) break;
+
+        // the workers skip frames while the image is converted, but not while
+        // the (slower) write runs
+        stream->pending = false;
+        image_to_rgba(stream);
+        uint iteration = stream->iteration;
+        pthread_mutex_unlock(&stream->mutex);
+
+        write_frame(stream, stream->rgba, iteration);
+
+        pthread_mutex_lock(&stream->mutex);
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return NULL;
+}
+
+static bool open_shm(FrameStream* stream, const char* name) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        ERROR("failed to open shared memory \"%s\"", name);
+        return false;
+    }
+
+    stream->shmSize = sizeof(FrameHeader) + pixels_size(stream);
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)stream->shmSize) == 0) {
+        map = mmap(
+            NULL,
+            stream->shmSize,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            fd,
+            0
+        );
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        ERROR("failed to map shared memory \"%s\"", name);
+        return false;
+    }
+
+    // the sequence number carries on from earlier renders, so readers notice
+    // the new frames
+    stream->shm = map;
+    uint sequence = shm_write_begin(stream->shm);
+    memcpy(stream->shm->magic, "VRFB", 4);
+    stream->shm->width = stream->size.x;
+    stream->shm->height = stream->size.y;
+    stream->shm->iteration = 0;
+    memset(stream->shm + 1, 0, pixels_size(stream));
+    shm_write_end(stream->shm, sequence);
+    return true;
+}
+
+FrameStream* frame_stream_create(const char* target, uvec2 size) {
+    CHECK_NULL(target, NULL)
+
+    FrameStream* stream = malloc(sizeof *stream);
+    *stream = (FrameStream){.size = size};
+
+    size_t prefixLength = strlen(FRAME_STREAM_SHM_PREFIX);
+    if (strncmp(target, FRAME_STREAM_SHM_PREFIX, prefixLength) == 0) {
+        const char* name = target + prefixLength;
+        INFO("streaming frames to shared memory \"%s\"", name);
+        if (!open_shm(stream, name)) {
+            free(stream);
+            return NULL;
+        }
+    } else {
+        INFO("streaming frames to \"%s\"", target);
+        stream->file = strdup(target);
+    }
+
+    size_t pixelCount = (size_t)size.x * size.y;
+    stream->image = calloc(pixelCount, sizeof(vec3));
+    stream->rgba = malloc(pixelCount * 4);
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    pthread_create(&stream->thread, NULL, stream_thread, stream);
+    return stream;
+}
+
+void frame_stream_destroy(
+    FrameStream* stream,
+    const unsigned char* image,
+    uint iteration
+) {
+    CHECK_NULL(stream)
+
+    pthread_mutex_lock(&stream->mutex);
+    stream->stopping = true;
+    pthread_cond_signal(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+    pthread_join(stream->thread, NULL);
+
+    if (image) write_frame(stream, image, iteration);
+
+    // the shared memory object stays around for the readers
+    if (stream->shm) munmap(stream->shm, stream->shmSize);
+    pthread_mutex_destroy(&stream->mutex);
+    pthread_cond_destroy(&stream->cond);
+    free(stream->file);
+    free(stream->image);
+    free(stream->rgba);
+    free(stream);
+}
+
+vec3* frame_stream_try_lock(FrameStream* stream) {
+    CHECK_NULL(stream, NULL)
+    if (pthread_mutex_trylock(&stream->mutex) != 0) return NULL;
+    return stream->image;
+}
+
+void frame_stream_unlock(FrameStream* stream, uint iteration) {
+    CHECK_NULL(stream)
+    stream->iteration = iteration;
+    stream->pending = true;
+    pthread_cond_signal(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+}
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vector.h"
+
+#define FRAME_STREAM_SHM_PREFIX "shm:"
+
+/**
+ * @brief The header in front of every published frame, followed by the RGBA
+ * pixels (4 bytes each, in the same order as the output image)
+ *
+ * Shared memory readers load the sequence number (acquire), skip odd ones,
+ * copy the frame, issue atomic_thread_fence(memory_order_acquire) and load the
+ * sequence number again, the copy is only complete if it didn't change.
+ */
+typedef struct {
+    char magic[4];        ///< "VRFB"
+    uint32_t width;       ///< The width of the frame
+    uint32_t height;      ///< The height of the frame
+    uint32_t iteration;   ///< The samples per pixel of the newest rows
+    atomic_uint sequence; ///< Incremented per frame, odd while one is written
+} FrameHeader;
+
+typedef struct FrameStream FrameStream;
+
+/**
+ * @brief Create a stream that publishes in-progress images from a background
+ * thread
+ * @param target "shm:<name>" for a POSIX shared memory object, which is
+ * overwritten in place, or a file, which is replaced with every frame
+ * @param size The size of the image
+ * @return A new frame stream, NULL on failure
+ */
+FrameStream* frame_stream_create(const char* target, uvec2 size);
+
+/**
+ * @brief Finish a stream: stop its thread and publish the final image
+ * @param stream The stream to finish
+ * @param image The final image (4 bytes per pixel) or NULL to keep the last
+ * published frame
+ * @param iteration The samples per pixel of the final image
+ */
+void frame_stream_destroy(
+    FrameStream* stream,
+    const unsigned char* image,
+    uint iteration
+);
+
+/**
+ * @brief Get the image of a stream for writing, without waiting
+ * @param stream The stream to write to
+ * @return The image of the stream, NULL if it is being converted right now
+ * (the frame should be skipped then)
+ */
+vec3* frame_stream_try_lock(FrameStream* stream);
+
+/**
+ * @brief Release the image of a stream and publish it in the background
+ * @param stream The stream to release
+ * @param iteration The samples per pixel of the rows that were written
+ */
+void frame_stream_unlock(FrameStream* stream, uint iteration);
\ No newline at end of file
@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logger/logger.h"
+#include "partial.h"
+
+static bool write_vec3s(FILE* file, const vec3* data, size_t count) {
+    float* packed = malloc(count * 3 * sizeof(float));
+    for (size_t i = 0; i < count; i++) {
+        packed[i * 3 + 0] = data[i].x;
+        packed[i * 3 + 1] = data[i].y;
+        packed[i * 3 + 2] = data[i].z;
+    }
+    bool res = fwrite(packed, sizeof(float) * 3, count, file) == count;
+    free(packed);
+    return res;
+}
+
+static vec3* read_vec3s(FILE* file, size_t count) {
+    float* packed = malloc(count * 3 * sizeof(float));
+    if (fread(packed, sizeof(float) * 3, count, file) != count) {
+        free(packed);
+        return NULL;
+    }
+
+    vec3* data = malloc(count * sizeof(vec3));
+    for (size_t i = 0; i < count; i++) {
+        data[i] = (vec3){{packed[i * 3], packed[i * 3 + 1], packed[i * 3 + 2]}};
+    }
+    free(packed);
+    return data;
+}
+
+bool partial_write(const char* fileName, const PartialImage* partial) {
+    CHECK_NULL(fileName, false)
+    CHECK_NULL(partial, false)
+    CHECK_NULL(partial->image, false)
+
+    FILE* file = fopen(fileName, "wb");
+    if (file == NULL) {
+        ERROR("failed to open \"%s\"", fileName);
+        return false;
+    }
+
+    bool aovs = partial->albedo != NULL && partial->normal != NULL;
+    PartialHeader header = {
+        .magic = {'V', 'R', 'P', 'A'},
+        .width = partial->size.x,
+        .height = partial->size.y,
+        .firstIteration = partial->firstIteration,
+        .samples = partial->samples,
+        .seed = partial->seed,
+        .hasAOVs = aovs,
+    };
+
+    size_t pixelCount = (size_t)partial->size.x * partial->size.y;
+    bool res = fwrite(&header, sizeof header, 1, file) == 1
+            && write_vec3s(file, partial->image, pixelCount);
+    if (aovs) {
+        res = res && write_vec3s(file, partial->albedo, pixelCount)
+           && write_vec3s(file, partial->normal, pixelCount);
+    }
+
+    if (fclose(file) != 0) res = false;
+    if (!res) ERROR("failed to write \"%s\"", fileName);
+    return res;
+}
+
+bool partial_read(const char* fileName, PartialImage* partial) {
+    CHECK_NULL(fileName, false)
+    CHECK_NULL(partial, false)
+
+    *partial = (PartialImage){0};
+
+    FILE* file = fopen(fileName, "rb");
+    if (file == NULL) {
+        ERROR("failed to open \"%s\"", fileName);
+        return false;
+    }
+
+    PartialHeader header;
+    if (fread(&header, sizeof header, 1, file) != 1
+        || memcmp(header.magic, "VRPA", 4) != 0) {
+        ERROR("\"%s\" is not a partial render", fileName);
+        fclose(file);
+        return false;
+    }
+
+    partial->size = (uvec2){{header.width, header.height}};
+    partial->firstIteration = header.firstIteration;
+    partial->samples = header.samples;
+    partial->seed = header.seed;
+
+    size_t pixelCount = (size_t)header.width * header.height;
+    partial->image = read_vec3s(file, pixelCount);
+    bool res = partial->image != NULL;
+    if (res && header.hasAOVs) {
+        partial->albedo = read_vec3s(file, pixelCount);
+        partial->normal = read_vec3s(file, pixelCount);
+        res = partial->albedo != NULL && partial->normal != NULL;
+    }
+    fclose(file);
+
+    if (!res) {
+        ERROR("\"%s\" is truncated", fileName);
+        partial_free(partial);
+    }
+    return res;
+}
+
+void partial_free(PartialImage* partial) {
+    if (partial == NULL) return;
+    free(partial->image);
+    free(partial->albedo);
+    free(partial->normal);
+    *partial = (PartialImage){0};
+}
+
+static int compare_first_iteration(const void* a, const void* b) {
+    uint firstA = (*(const PartialImage**)a)->firstIteration;
+    uint firstB = (*(const PartialImage**)b)->firstIteration;
+    return firstA < firstB ? -1 : firstA > firstB;
+}
+
+bool partial_merge(
+    const PartialImage* partials,
+    uint count,
+    PartialImage* merged
+) {
+    CHECK_NULL(partials, false)
+    CHECK_NULL(merged, false)
+    if (count == 0) {
+        ERROR("no partial renders to merge");
+        return false;
+    }
+
+    const PartialImage** sorted = malloc(count * sizeof *sorted);
+    for (uint i = 0; i < count; i++) sorted[i] = &partials[i];
+    qsort(sorted, count, sizeof *sorted, compare_first_iteration);
+
+    uvec2 size = sorted[0]->size;
+    uint seed = sorted[0]->seed;
+    uint samples = 0;
+    uint end = sorted[0]->firstIteration;
+    for (uint i = 0; i < count; i++) {
+        const PartialImage* partial = sorted[i];
+        if (partial->size.x != size.x || partial->size.y != size.y) {
+            ERROR(
+                "partial render sizes differ (%dx%d and %dx%d)",
+                size.x,
+                size.y,
+                partial->size.x,
+                partial->size.y
+            );
+            free(sorted);
+            return false;
+        }
+
+        // other seeds draw other samples for the same iterations
+        if (partial->seed != seed) {
+            ERROR(
+                "partial render seeds differ (%u and %u)",
+                seed,
+                partial->seed
+            );
+            free(sorted);
+            return false;
+        }
+
+        // repeated iterations would count the same samples twice, end is the
+        // end of the previous range (gaps don't move it back)
+        if (partial->firstIteration < end) {
+            ERROR(
+                "partial renders overlap at iteration %d",
+                partial->firstIteration
+            );
+            free(sorted);
+            return false;
+        }
+        if (i > 0 && partial->firstIteration > end) {
+            WARN(
+                "iterations %d to %d are missing",
+                end,
+                partial->firstIteration - 1
+            );
+        }
+        end = partial->firstIteration + partial->samples;
+        samples += partial->samples;
+    }
+
+    if (samples == 0) {
+        ERROR("partial renders have no samples");
+        free(sorted);
+        return false;
+    }
+
+    size_t pixelCount = (size_t)size.x * size.y;
+    *merged = (PartialImage){
+        .size = size,
+        .firstIteration = sorted[0]->firstIteration,
+        .samples = samples,
+        .seed = seed,
+        .image = malloc(pixelCount * sizeof(vec3)),
+    };
+
+    // same as continuing the running mean of the renderer, up to rounding
+    for (size_t p = 0; p < pixelCount; p++) {
+        double sum[3] = {0.0, 0.0, 0.0};
+        for (uint i = 0; i < count; i++) {
+            vec3 c = sorted[i]->image[p];
+            sum[0] += (double)c.x * sorted[i]->samples;
+            sum[1] += (double)c.y * sorted[i]->samples;
+            sum[2] += (double)c.z * sorted[i]->samples;
+        }
+        merged->image[p] = (vec3){{
+            (float)(sum[0] / samples),
+            (float)(sum[1] / samples),
+            (float)(sum[2] / samples),
+        }};
+    }
+
+    // a single render writes the AOVs of its first sample
+    const PartialImage* first = sorted[0];
+    if (first->albedo != NULL && first->normal != NULL) {
+        merged->albedo = malloc(pixelCount * sizeof(vec3));
+        merged->normal = malloc(pixelCount * sizeof(vec3));
+        memcpy(merged->albedo, first->albedo, pixelCount * sizeof(vec3));
+        memcpy(merged->normal, first->normal, pixelCount * sizeof(vec3));
+    }
+
+    free(sorted);
+    return true;
+}
\ No newline at end of file
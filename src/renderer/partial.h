@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "vector.h"
+
+/**
+ * @brief The header of a partial render file, followed by the image and (if
+ * present) the albedo and normals, each as 3 floats per pixel
+ */
+typedef struct {
+    char magic[4];           ///< "VRPA"
+    uint32_t width;          ///< The width of the image
+    uint32_t height;         ///< The height of the image
+    uint32_t firstIteration; ///< The index of the first rendered iteration
+    uint32_t samples;        ///< The number of iterations that were rendered
+    uint32_t seed;           ///< The seed the samples were drawn with
+    uint32_t hasAOVs;        ///< Whether the albedo and normals follow
+} PartialHeader;
+
+typedef struct {
+    uvec2 size;          ///< The size of the image
+    uint firstIteration; ///< The index of the first rendered iteration
+    uint samples;        ///< The number of iterations that were rendered
+    uint seed;           ///< The seed the samples were drawn with
+    vec3* image;         ///< The mean of the samples
+    vec3* albedo;        ///< The first-hit albedo (NULL: none)
+    vec3* normal;        ///< The first-hit normals (NULL: none)
+} PartialImage;
+
+/**
+ * @brief Write an unfinished (not denoised) render to a file
+ * @param fileName The file to write to
+ * @param partial The render to write
+ * @return true on success, false on failure
+ */
+bool partial_write(const char* fileName, const PartialImage* partial);
+
+/**
+ * @brief Read a render written by partial_write
+ * @param fileName The file to read from
+ * @param partial Filled with the render, free it with partial_free
+ * @return true on success, false on failure
+ */
+bool partial_read(const char* fileName, PartialImage* partial);
+
+/**
+ * @brief Free the images of a partial render
+ * @param partial The render to free
+ */
+void partial_free(PartialImage* partial);
+
+/**
+ * @brief Combine renders of disjoint iteration ranges into the render of all
+ * of them, the images are weighted by their sample counts and the AOVs are
+ * taken from the render with the lowest first iteration
+ * @param partials The renders to combine, all of the same size
+ * @param count The number of renders
+ * @param merged Filled with the combined render, free it with partial_free
+ * @return true on success, false if the sizes or seeds differ or the ranges
+ * overlap
+ */
+bool partial_merge(
+    const PartialImage* partials,
+    uint count,
+    PartialImage* merged
+);
\ No newline at end of file
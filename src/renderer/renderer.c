@@ -1,183 +1,1700 @@
 #include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "autotune.h"
+#include "denoiser.h"
+#include "frame_stream.h"
+#include "hash.h"
 #include "logger/logger.h"
+#include "memory/memory.h"
+#include "partial.h"
 #include "renderer.h"
 #include "shader_compiler.h"
 
+// minimum time between two progress logs in seconds
+#define PROGRESS_INTERVAL 1.0
+
+// at most this many specialized variants of the render shader stay compiled,
+// the shaders of the least recently used one are dropped for a new one
+#define MAX_RENDER_VARIANTS 8
+
+// the most macros scene_macros writes
+#define MAX_SCENE_MACROS 8
+
+// the least recently used programs are destroyed beyond this, which must be
+// more than the programs of one render on all devices
+#define PROGRAM_CACHE_SIZE 32
+
+// number of timed iterations per workgroup size candidate
+#define AUTOTUNE_ITERATIONS 4
+
+// sample count of the first noise snapshot of budgeted renders
+#define NOISE_FIRST_CHECK 4
+
+// rows of a band read back for a noise estimate, spread evenly over the band
+#define NOISE_ROWS 32
+
+// the bands of a budgeted multi device render agree on every batch size, so
+// that they all end up with the same sample count
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint bandCount; ///< The number of bands sampled together
+    uint arrived;   ///< The bands that proposed a batch size this round
+    uint round;     ///< Incremented whenever all bands have proposed
+    uint batch;     ///< The smallest batch size proposed this round
+    bool converged; ///< Whether all bands proposed so far reached their target
+    uint agreed;    ///< The batch size of the last completed round
+} SampleSync;
+
+// progress of all bands together, in rows times samples
+typedef struct {
+    pthread_mutex_t mutex;
+    uint64_t total;  ///< Rows of the image times the iterations
+    uint64_t done;   ///< Rows times samples submitted so far
+    uint iterations; ///< The iterations of the render
+    uint rows;       ///< The rows of the image
+    double lastLog;  ///< When progress was last logged
+} Progress;
+
 typedef struct {
     uint maxRayDepth;
     uint iter;
-    float seed;
+    uint seed;
+    uint writeAOVs;
+    uvec2 imageSize;
+    uint bandOffset;
+    uint cachePrimary;
+    uint batchSize;
+    uint resolve;
+    uint lodBounce;
+    float lodDistance;
+    uint preview;
+    uint firstIteration;
 } RenderInfo;
 
-unsigned char* render(
-    mc_Device* dev,
-    RenderSettings settings,
-    Scene* scene,
-    Camera* camera
-) {
-    CHECK_NULL(dev, NULL)
-    CHECK_NULL(scene, NULL)
-    CHECK_NULL(camera, NULL)
+typedef struct {
+    SPIRVCode render;
+    SPIRVCode iter;
+    SPIRVCode output;
+    SPIRVCode denoise;
+} RenderCode;
 
-    INFO("preparing render with settings:");
-    INFO("- device: \"%s\"", mc_device_get_name(dev));
-    INFO("- work group size: %dx%d", settings.wgSize.x, settings.wgSize.y);
-    INFO("- image size: %dx%d", settings.imageSize.x, settings.imageSize.y);
-    INFO("- iterations: %d", settings.iterations);
-    INFO("- max ray depth: %d", settings.maxRayDepth);
+typedef struct {
+    mc_Program* render;
+    mc_Program* iter;
+    mc_Program* output;
+    mc_Program* denoise;
+} RenderPrograms;
 
+typedef struct {
+    mce_HBuffer* fImageBuff;
+    mce_HBuffer* albedoBuff;
+    mce_HBuffer* normalBuff;
+    MemoryUsage memory;
+} ImageBuffers;
+
+static size_t accum_format_size(AccumFormat format) {
+    switch (format) {
+        case ACCUM_FORMAT_PACKED: return 3 * sizeof(float);
+        case ACCUM_FORMAT_HALF: return 4 * sizeof(uint16_t);
+        default: return sizeof(vec3);
+    }
+}
+
+static const char* accum_format_name(AccumFormat format) {
+    switch (format) {
+        case ACCUM_FORMAT_PACKED: return "packed";
+        case ACCUM_FORMAT_HALF: return "half";
+        default: return "vec3";
+    }
+}
+
+typedef struct {
+    RenderSettings* settings;
+    RenderDevice* device;
+    RenderPrograms programs;
+    uint bandCount;
+    uint bandHeight;
+    uint imageRows;
+    atomic_uint* nextBand;
+    vec3* fImage;          ///< Merged image (multi band renders only)
+    vec3* albedo;          ///< Merged albedo (multi band renders only)
+    vec3* normal;          ///< Merged normals (multi band renders only)
+    ImageBuffers buffers;  ///< Full image buffers (single band renders only)
+    uint rows;             ///< Number of rows rendered by this worker
+    double time;           ///< Time spent rendering by this worker
+    uint dispatches;       ///< Number of iteration dispatches submitted
+    uint iterations;       ///< Number of iterations submitted (all bands)
+    double submitTime;     ///< Time spent in the (trivial) iteration dispatches
+    double deadline;       ///< Time at which sampling stops (0: no budget)
+    SampleSync* sync;      ///< Shared by the bands (NULL: sampled on their own)
+    Progress* progress;    ///< Shared by all workers
+    uint samples;          ///< Samples per pixel of the last band
+    float noise;           ///< Estimated noise of the last band (-1: none)
+    FrameStream* stream;   ///< Where progress is published (NULL: nowhere)
+} RenderWorker;
+
+static void image_to_bytes(vec3* image, uint pixelCount, unsigned char* out) {
+    for (uint i = 0; i < pixelCount; i++) {
+        float c[3] = {image[i].r, image[i].g, image[i].b};
+        for (int j = 0; j < 3; j++) {
+            int v = (int)(c[j] * 255);
+            out[i * 4 + j] = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+        out[i * 4 + 3] = 255;
+    }
+}
+
+static bool check_workgroup_size(mc_Device* dev, uvec2 wgSize) {
     uint maxWGSizeTotal = mc_device_get_max_workgroup_size_total(dev);
     uint* maxWGSizeShape = mc_device_get_max_workgroup_size_shape(dev);
 
-    if (settings.wgSize.x * settings.wgSize.y > maxWGSizeTotal) {
+    if (wgSize.x * wgSize.y > maxWGSizeTotal) {
         ERROR("total workgroup size  too large, max: %d", maxWGSizeTotal);
-        return NULL;
+        return false;
     }
 
-    if (settings.wgSize.x > maxWGSizeShape[0]) {
+    if (wgSize.x > maxWGSizeShape[0]) {
         ERROR("workgroup size x too large, max: %d", maxWGSizeShape[0]);
-        return NULL;
+        return false;
     }
 
-    if (settings.wgSize.y > maxWGSizeShape[1]) {
+    if (wgSize.y > maxWGSizeShape[1]) {
         ERROR("workgroup size y too large, max: %d", maxWGSizeShape[1]);
-        return NULL;
+        return false;
     }
 
-    INFO("updating scene and camera");
-    scene_update_data(scene);
-    scene_update_materials(scene);
-    scene_update_voxels(scene);
-    camera_update(camera);
+    return true;
+}
+
+// the scene macros of a specialized render shader
+typedef struct {
+    const char* names[MAX_SCENE_MACROS]; ///< Static strings
+    char values[MAX_SCENE_MACROS][64];
+    uint macroCount;
+} RenderVariant;
+
+// ordered from the most to the least recently used
+static RenderVariant renderVariants[MAX_RENDER_VARIANTS];
+static uint renderVariantCount = 0;
+
+static bool is_power_of_two(uint v) {
+    return v != 0 && (v & (v - 1)) == 0;
+}
+
+static uint log2_uint(uint v) {
+    uint log = 0;
+    while (v >>= 1) log++;
+    return log;
+}
+
+// returns the number of macros written
+static uint scene_macros(
+    RenderSettings* settings,
+    SceneCreateInfo* scene,
+    ShaderMacro* macros,
+    char (*values)[64]
+) {
+    uvec3 size = scene->size;
+    Material bg = scene->bg;
+    vec3 color = bg.color;
+    vec4 props = bg.properties;
+
+    const char* vec3Format = "vec3(%.9g, %.9g, %.9g)";
+    snprintf(values[0], 64, "uvec3(%u, %u, %u)", size.x, size.y, size.z);
+    snprintf(values[1], 64, "%uu", settings->maxRayDepth);
+    snprintf(values[2], 64, vec3Format, color.r, color.g, color.b);
+    snprintf(values[3], 64, vec3Format, props.x, props.y, props.z);
+
+    snprintf(values[4], 64, "%du", (int)scene->layout);
+    snprintf(values[5], 64, "%du", (int)scene->format);
+
+    macros[0] = (ShaderMacro){"SCENE_SIZE", values[0]};
+    macros[1] = (ShaderMacro){"MAX_RAY_DEPTH", values[1]};
+    macros[2] = (ShaderMacro){"BG_COLOR", values[2]};
+    macros[3] = (ShaderMacro){"BG_PROPERTIES", values[3]};
+    macros[4] = (ShaderMacro){"VOXEL_LAYOUT", values[4]};
+    macros[5] = (ShaderMacro){"VOXEL_FORMAT", values[5]};
+    uint macroCount = 6;
+
+    if (is_power_of_two(size.x) && is_power_of_two(size.y)
+        && is_power_of_two(size.z)) {
+        uint shiftX = log2_uint(size.x);
+        snprintf(values[6], 64, "%u", shiftX);
+        snprintf(values[7], 64, "%u", shiftX + log2_uint(size.y));
+        macros[macroCount++] = (ShaderMacro){"SCENE_SHIFT_X", values[6]};
+        macros[macroCount++] = (ShaderMacro){"SCENE_SHIFT_XY", values[7]};
+    }
+
+    return macroCount;
+}
+
+static bool variant_matches(
+    const RenderVariant* variant,
+    const ShaderMacro* macros,
+    uint macroCount
+) {
+    if (variant->macroCount != macroCount) return false;
+    for (uint i = 0; i < macroCount; i++) {
+        if (strcmp(variant->names[i], macros[i].name) != 0) return false;
+        if (strcmp(variant->values[i], macros[i].value) != 0) return false;
+    }
+    return true;
+}
+
+// makes the variant the most recently used one, a new variant replaces the
+// least recently used one once there are too many
+static void register_variant(const ShaderMacro* macros, uint macroCount) {
+    uint index = 0;
+    while (index < renderVariantCount
+           && !variant_matches(&renderVariants[index], macros, macroCount)) {
+        index++;
+    }
+
+    RenderVariant variant;
+    if (index < renderVariantCount) {
+        variant = renderVariants[index];
+    } else {
+        variant.macroCount = macroCount;
+        for (uint i = 0; i < macroCount; i++) {
+            variant.names[i] = macros[i].name;
+            snprintf(variant.values[i], 64, "%s", macros[i].value);
+        }
+
+        if (renderVariantCount == MAX_RENDER_VARIANTS) {
+            RenderVariant* lru = &renderVariants[--renderVariantCount];
+            ShaderMacro lruMacros[MAX_SCENE_MACROS];
+            for (uint i = 0; i < lru->macroCount; i++) {
+                lruMacros[i] = (ShaderMacro){lru->names[i], lru->values[i]};
+            }
+            DEBUG("dropping least recently used render shader variant");
+            shader_cache_release_variant(lruMacros, lru->macroCount);
+        }
+        index = renderVariantCount++;
+    }
+
+    memmove(
+        &renderVariants[1],
+        &renderVariants[0],
+        index * sizeof *renderVariants
+    );
+    renderVariants[0] = variant;
+}
 
-    SPIRVCode renderCode = compile_glsl(
+static SPIRVCode compile_render_code(
+    RenderSettings* settings,
+    SceneCreateInfo* scene
+) {
+    ShaderMacro macros[MAX_SCENE_MACROS + 1];
+    char values[MAX_SCENE_MACROS + 1][64];
+    uint macroCount = 0;
+
+    if (settings->accumFormat != ACCUM_FORMAT_VEC3) {
+        snprintf(values[0], 64, "%d", (int)settings->accumFormat);
+        macros[macroCount++] = (ShaderMacro){"ACCUM_FORMAT", values[0]};
+    }
+
+    if (settings->specialize) {
+        ShaderMacro* sceneMacros = macros + macroCount;
+        uint count = scene_macros(
+            settings,
+            scene,
+            sceneMacros,
+            values + macroCount
+        );
+
+        register_variant(sceneMacros, count);
+        macroCount += count;
+    }
+
+    return compile_glsl_variant(
         "render_shader",
-        settings.rendererCode,
+        settings->rendererCode,
         "main",
-        settings.wgSize
+        settings->wgSize,
+        macros,
+        macroCount
     );
-    if (renderCode.size == 0) {
+}
+
+static bool compile_code(
+    RenderSettings* settings,
+    SceneCreateInfo* scene,
+    RenderCode* code
+) {
+    *code = (RenderCode){0};
+
+    code->render = compile_render_code(settings, scene);
+    if (code->render.size == 0) {
         ERROR("failed to compile render code");
-        return NULL;
+        return false;
     }
 
-    mc_Program* renderProgram
-        = mc_program_create(dev, renderCode.size, renderCode.code, "main");
-
-    SPIRVCode iterCode = compile_glsl(
+    code->iter = compile_glsl(
         "iteration_shader",
-        settings.iterationCode,
+        settings->iterationCode,
         "main",
         (uvec2){1, 1}
     );
-    if (iterCode.size == 0) {
+    if (code->iter.size == 0) {
         ERROR("failed to compile iteration code");
-        return NULL;
+        return false;
     }
 
-    mc_Program* iterProgram
-        = mc_program_create(dev, iterCode.size, iterCode.code, "main");
-
-    if (!iterProgram) {
-        ERROR("failed to create iteration program");
-        return NULL;
-    }
-
-    SPIRVCode outputCode = compile_glsl(
+    code->output = compile_glsl(
         "output_shader",
-        settings.outputCode,
+        settings->outputCode,
         "main",
-        settings.wgSize
+        settings->wgSize
     );
-    if (outputCode.size == 0) {
+    if (code->output.size == 0) {
         ERROR("failed to compile output code");
-        return NULL;
+        return false;
+    }
+
+    if (settings->denoisePasses > 0 && !settings->denoiseOnCpu) {
+        code->denoise = compile_glsl(
+            "denoise_shader",
+            settings->denoiseCode,
+            "main",
+            settings->wgSize
+        );
+        if (code->denoise.size == 0) {
+            ERROR("failed to compile denoise code");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+typedef struct ProgramCacheEntry {
+    mc_Device* dev;
+    uint64_t hash;   ///< Hash of the SPIR-V, hits compare the whole code
+    SPIRVCode code;  ///< Own copy of the SPIR-V
+    mc_Program* program;
+    struct ProgramCacheEntry* next;
+} ProgramCacheEntry;
+
+// programs are kept around between renders, so repeated renders (e.g. in
+// daemon mode) don't have to create their pipelines again, ordered from the
+// most to the least recently used
+static ProgramCacheEntry* programCache = NULL;
+static uint programCacheCount = 0;
+
+static void program_entry_free(ProgramCacheEntry* entry) {
+    mc_program_destroy(entry->program);
+    free(entry->code.code);
+    free(entry);
+}
+
+static mc_Program* get_program(mc_Device* dev, SPIRVCode code) {
+    uint64_t hash = hash_bytes(HASH_INIT, code.code, code.size);
+    ProgramCacheEntry** prev = &programCache;
+    for (ProgramCacheEntry* e = programCache; e != NULL; e = e->next) {
+        if (e->dev == dev && e->hash == hash && e->code.size == code.size
+            && memcmp(e->code.code, code.code, code.size) == 0) {
+            // move to the front
+            *prev = e->next;
+            e->next = programCache;
+            programCache = e;
+            return e->program;
+        }
+        prev = &e->next;
+    }
+
+    mc_Program* program = mc_program_create(dev, code.size, code.code, "main");
+    if (!program) return NULL;
+
+    ProgramCacheEntry* entry = malloc(sizeof *entry);
+    *entry = (ProgramCacheEntry){
+        .dev = dev,
+        .hash = hash,
+        .code = {code.size, malloc(code.size)},
+        .program = program,
+        .next = programCache,
+    };
+    memcpy(entry->code.code, code.code, code.size);
+    programCache = entry;
+
+    if (++programCacheCount > PROGRAM_CACHE_SIZE) {
+        ProgramCacheEntry** last = &programCache;
+        while ((*last)->next != NULL) last = &(*last)->next;
+        DEBUG("destroying least recently used program");
+        program_entry_free(*last);
+        *last = NULL;
+        programCacheCount--;
+    }
+    return program;
+}
+
+bool render_prepare(RenderSettings settings, SceneCreateInfo scene) {
+    // the other shaders are compiled for the tuned workgroup size
+    if (settings.wgSize.x == 0 || settings.wgSize.y == 0) {
+        SPIRVCode iter = compile_glsl(
+            "iteration_shader",
+            settings.iterationCode,
+            "main",
+            (uvec2){1, 1}
+        );
+        return iter.size > 0;
+    }
+
+    RenderCode code;
+    return compile_code(&settings, &scene, &code);
+}
+
+void render_release_programs(void) {
+    while (programCache != NULL) {
+        ProgramCacheEntry* next = programCache->next;
+        program_entry_free(programCache);
+        programCache = next;
     }
+    programCacheCount = 0;
+}
+
+static bool create_programs(
+    mc_Device* dev,
+    RenderCode* code,
+    RenderPrograms* programs
+) {
+    *programs = (RenderPrograms){0};
 
-    mc_Program* outputProgram
-        = mc_program_create(dev, outputCode.size, outputCode.code, "main");
+    programs->render = get_program(dev, code->render);
+    if (!programs->render) {
+        ERROR("failed to create render program");
+        return false;
+    }
 
-    if (!outputProgram) {
+    programs->iter = get_program(dev, code->iter);
+    if (!programs->iter) {
+        ERROR("failed to create iteration program");
+        return false;
+    }
+
+    programs->output = get_program(dev, code->output);
+    if (!programs->output) {
         ERROR("failed to create output program");
-        return NULL;
+        return false;
     }
 
-    mce_HBuffer* fImageBuff = mce_hybrid_buffer_create(
-        dev,
-        settings.imageSize.x * settings.imageSize.y * sizeof(vec3)
-    );
+    if (code->denoise.size > 0) {
+        programs->denoise = get_program(dev, code->denoise);
+        if (!programs->denoise) {
+            ERROR("failed to create denoise program");
+            return false;
+        }
+    }
 
-    mce_HBuffer* iImageBuff = mce_hybrid_buffer_create(
-        dev,
-        settings.imageSize.x * settings.imageSize.y * sizeof(int)
-    );
+    return true;
+}
 
-    mce_HBuffer* infoBuff = mce_hybrid_buffer_create(dev, sizeof(RenderInfo));
+static ImageBuffers image_buffers_create(
+    mc_Device* dev,
+    uint pixelCount,
+    bool aovs
+) {
+    // only the denoiser reads the AOVs, so they can stay tiny otherwise
+    size_t imageSize = pixelCount * sizeof(vec3);
+    size_t aovSize = (aovs ? pixelCount : 1) * sizeof(vec3);
+    ImageBuffers buffers = {
+        .fImageBuff = mce_hybrid_buffer_create(dev, imageSize),
+        .albedoBuff = mce_hybrid_buffer_create(dev, aovSize),
+        .normalBuff = mce_hybrid_buffer_create(dev, aovSize),
+    };
 
-    INFO("starting render (%d iterations):", settings.iterations);
-    double start = mc_get_time();
+    MemoryUsage usage = {.device = imageSize + aovSize * 2};
+    memory_update(MEMORY_RENDER_IMAGES, &buffers.memory, usage);
+    return buffers;
+}
 
-    RenderInfo info = {settings.maxRayDepth, 0, (float)(start - floor(start))};
-    mce_hybrid_buffer_write(infoBuff, 0, sizeof info, &info);
+static void image_buffers_destroy(ImageBuffers* buffers) {
+    if (buffers->fImageBuff) mce_hybrid_buffer_destroy(buffers->fImageBuff);
+    if (buffers->albedoBuff) mce_hybrid_buffer_destroy(buffers->albedoBuff);
+    if (buffers->normalBuff) mce_hybrid_buffer_destroy(buffers->normalBuff);
+    memory_update(MEMORY_RENDER_IMAGES, &buffers->memory, (MemoryUsage){0});
+    *buffers = (ImageBuffers){0};
+}
 
-    for (uint i = 0; i < settings.iterations; i++) {
-        float progress = (float)(i + 1) / (float)settings.iterations * 100.0f;
-        INFO("- %d/%d (%.2f%%)", i + 1, settings.iterations, progress);
+// workgroup sizes tried by the tuner
+static const uvec2 wgCandidates[] = {
+    {{4, 4}},
+    {{8, 4}},
+    {{8, 8}},
+    {{16, 8}},
+    {{8, 16}},
+    {{16, 16}},
+    {{32, 4}},
+    {{32, 8}},
+    {{8, 32}},
+    {{64, 4}},
+    {{32, 16}},
+    {{16, 32}},
+    {{32, 32}},
+};
 
-        mc_program_run(iterProgram, 1, 1, 1, infoBuff);
-        
+static bool workgroup_size_usable(
+    mc_Device* dev,
+    RenderSettings* settings,
+    uvec2 wgSize
+) {
+    uint maxWGSizeTotal = mc_device_get_max_workgroup_size_total(dev);
+    uint* maxWGSizeShape = mc_device_get_max_workgroup_size_shape(dev);
+
+    // sizes that don't divide the image would leave parts of it unrendered
+    return wgSize.x * wgSize.y <= maxWGSizeTotal
+        && wgSize.x <= maxWGSizeShape[0] && wgSize.y <= maxWGSizeShape[1]
+        && settings->imageSize.x % wgSize.x == 0
+        && settings->imageSize.y % wgSize.y == 0;
+}
+
+static double time_workgroup_size(
+    RenderDevice* device,
+    RenderSettings* settings,
+    SPIRVCode code,
+    uvec2 wgSize
+) {
+    // not added to the program cache, only the winner is used afterwards
+    mc_Program* program
+        = mc_program_create(device->dev, code.size, code.code, "main");
+    if (!program) return -1.0;
+
+    uint pixelCount = settings->imageSize.x * settings->imageSize.y;
+    ImageBuffers buffers = image_buffers_create(device->dev, pixelCount, false);
+    mce_HBuffer* infoBuff
+        = mce_hybrid_buffer_create(device->dev, sizeof(RenderInfo));
+    mce_HBuffer* primaryHitBuff
+        = mce_hybrid_buffer_create(device->dev, sizeof(uvec2));
+
+    Instances* instances = scene_get_instances(device->scene);
+
+    RenderInfo info = {
+        .maxRayDepth = settings->maxRayDepth,
+        .iter = 1,
+        .seed = settings->seed,
+        .imageSize = settings->imageSize,
+        .batchSize = 1,
+        .lodBounce = settings->lodBounce,
+        .lodDistance = settings->lodDistance,
+        .preview = settings->preview,
+    };
+    mce_hybrid_buffer_write(infoBuff, 0, sizeof info, &info);
+
+    // the first run is not timed, it includes the pipeline warm up
+    double start = 0.0;
+    for (uint i = 0; i <= AUTOTUNE_ITERATIONS; i++) {
+        if (i == 1) start = mc_get_time();
         mc_program_run(
-            renderProgram,
-            settings.imageSize.x / settings.wgSize.x,
-            settings.imageSize.y / settings.wgSize.y,
+            program,
+            settings->imageSize.x / wgSize.x,
+            settings->imageSize.y / wgSize.y,
             1,
             infoBuff,
-            fImageBuff,
-            scene_get_data_buff(scene),
-            scene_get_material_buff(scene),
-            scene_get_voxel_buff(scene),
-            camera_get_data_buff(camera)
+            buffers.fImageBuff,
+            scene_get_data_buff(device->scene),
+            scene_get_material_buff(device->scene),
+            scene_get_voxel_buff(device->scene),
+            camera_get_data_buff(device->camera),
+            buffers.albedoBuff,
+            buffers.normalBuff,
+            primaryHitBuff,
+            buffers.fImageBuff,
+            instances_get_model_buff(instances),
+            instances_get_model_voxel_buff(instances),
+            instances_get_instance_buff(instances),
+            instances_get_grid_buff(instances),
+            scene_get_lod_buff(device->scene)
         );
     }
+    double time = (mc_get_time() - start) / AUTOTUNE_ITERATIONS;
 
-    double elapsed = mc_get_time() - start;
-    double rate = elapsed / settings.iterations;
-    INFO(
-        "finished render in %.02fs (%.02f ms/iteration)",
-        elapsed,
-        rate * 1000.0
+    mce_hybrid_buffer_destroy(infoBuff);
+    mce_hybrid_buffer_destroy(primaryHitBuff);
+    image_buffers_destroy(&buffers);
+    mc_program_destroy(program);
+    return time;
+}
+
+// the candidates are the render shader variant that is actually used (with
+// the accumulation format and scene macros), only the winner stays cached
+static uvec2 tune_workgroup_size(
+    RenderDevice* device,
+    RenderSettings* settings,
+    SceneCreateInfo* scene
+) {
+    const char* name = mc_device_get_name(device->dev);
+    uint64_t shaderHash = hash_bytes(
+        HASH_INIT,
+        settings->rendererCode,
+        strlen(settings->rendererCode)
+    );
+    shaderHash = hash_bytes(
+        shaderHash,
+        &settings->accumFormat,
+        sizeof settings->accumFormat
+    );
+    shaderHash = hash_bytes(
+        shaderHash,
+        &settings->specialize,
+        sizeof settings->specialize
     );
 
-    INFO("converting image into bytes");
+    // an empty file name disables the cache as well
+    const char* cacheFile = settings->wgCacheFile;
+    if (cacheFile != NULL && cacheFile[0] == '\0') cacheFile = NULL;
+
+    uvec2 best = {0};
+    if (cacheFile
+        && autotune_cache_lookup(cacheFile, name, shaderHash, &best)
+        && workgroup_size_usable(device->dev, settings, best)) {
+        INFO("using cached workgroup size %dx%d", best.x, best.y);
+        return best;
+    }
+
+    INFO("tuning workgroup size on \"%s\":", name);
+    double bestTime = INFINITY;
+    SPIRVCode bestCode = {0};
+    uint candidateCount = sizeof wgCandidates / sizeof *wgCandidates;
+
+    for (uint i = 0; i < candidateCount; i++) {
+        uvec2 wgSize = wgCandidates[i];
+        if (!workgroup_size_usable(device->dev, settings, wgSize)) continue;
+
+        RenderSettings candidate = *settings;
+        candidate.wgSize = wgSize;
+        SPIRVCode code = compile_render_code(&candidate, scene);
+        if (code.size == 0) continue;
 
-    unsigned char* image
-        = malloc(settings.imageSize.x * settings.imageSize.y * 4);
+        double time = time_workgroup_size(device, settings, code, wgSize);
+        if (time >= 0.0) {
+            double ms = time * 1000.0;
+            INFO("- %dx%d: %.03f ms/iteration", wgSize.x, wgSize.y, ms);
+        }
+        if (time < 0.0 || time >= bestTime) {
+            shader_cache_release(code);
+            continue;
+        }
+
+        if (bestCode.size > 0) shader_cache_release(bestCode);
+        bestCode = code;
+        bestTime = time;
+        best = wgSize;
+    }
+
+    if (bestTime == INFINITY) {
+        ERROR("no workgroup size candidate fits the device and image");
+        return (uvec2){0};
+    }
+
+    INFO("using workgroup size %dx%d", best.x, best.y);
+    if (cacheFile) autotune_cache_store(cacheFile, name, shaderHash, best);
+    return best;
+}
+
+typedef struct {
+    mce_HBuffer* info;
+    mce_HBuffer* accumBuff;
+    mce_HBuffer* primaryHitBuff;
+    ImageBuffers image;
+} BandBuffers;
+
+static void run_render_program(
+    RenderWorker* worker,
+    uint bandHeight,
+    BandBuffers* buffers
+) {
+    RenderSettings* settings = worker->settings;
+    RenderDevice* device = worker->device;
+    Instances* instances = scene_get_instances(device->scene);
 
     mc_program_run(
-        outputProgram,
-        settings.imageSize.x / settings.wgSize.x,
-        settings.imageSize.y / settings.wgSize.y,
+        worker->programs.render,
+        settings->imageSize.x / settings->wgSize.x,
+        bandHeight / settings->wgSize.y,
         1,
-        fImageBuff,
-        iImageBuff
+        buffers->info,
+        buffers->accumBuff,
+        scene_get_data_buff(device->scene),
+        scene_get_material_buff(device->scene),
+        scene_get_voxel_buff(device->scene),
+        camera_get_data_buff(device->camera),
+        buffers->image.albedoBuff,
+        buffers->image.normalBuff,
+        buffers->primaryHitBuff,
+        buffers->image.fImageBuff,
+        instances_get_model_buff(instances),
+        instances_get_model_voxel_buff(instances),
+        instances_get_instance_buff(instances),
+        instances_get_grid_buff(instances),
+        scene_get_lod_buff(device->scene)
+    );
+}
+
+static void set_batch_size(BandBuffers* buffers, RenderInfo* info, uint size) {
+    if (info->batchSize == size) return;
+    info->batchSize = size;
+    mce_hybrid_buffer_write(
+        buffers->info,
+        offsetof(RenderInfo, batchSize),
+        sizeof info->batchSize,
+        &info->batchSize
     );
+}
 
+static void set_resolve(BandBuffers* buffers, RenderInfo* info, bool resolve) {
+    info->resolve = resolve;
+    mce_hybrid_buffer_write(
+        buffers->info,
+        offsetof(RenderInfo, resolve),
+        sizeof info->resolve,
+        &info->resolve
+    );
+}
+
+// converts the accumulated image into the vec3 image (if they differ)
+static void resolve_band(
+    RenderWorker* worker,
+    uint bandHeight,
+    BandBuffers* buffers,
+    RenderInfo* info
+) {
+    if (buffers->accumBuff == buffers->image.fImageBuff) return;
+    set_resolve(buffers, info, true);
+    run_render_program(worker, bandHeight, buffers);
+    set_resolve(buffers, info, false);
+}
+
+// the samples rendered after the first snapshot are independent of the ones
+// before it, the difference of their means gives the per-sample variance and
+// with it the remaining noise
+typedef struct {
+    vec3* first;       ///< The rows after firstSamples samples
+    vec3* current;     ///< The rows at the latest check
+    uint rows;         ///< The number of rows read back from the band
+    uint pixelCount;   ///< The number of pixels in those rows
+    uint firstSamples; ///< The samples in the first image (0: not taken yet)
+    uint nextCheck;    ///< The sample count of the next check
+    float noise;       ///< The latest estimate (negative: none yet)
+    uint noiseSamples; ///< The sample count of the latest estimate
+} NoiseEstimator;
+
+static float estimate_noise(NoiseEstimator* estimator, uint samples) {
+    double n = estimator->firstSamples;
+    double m = samples;
+    double sqDiff = 0.0;
+    double sum = 0.0;
+
+    for (uint i = 0; i < estimator->pixelCount; i++) {
+        vec3 a = estimator->first[i];
+        vec3 b = estimator->current[i];
+        float av[3] = {a.r, a.g, a.b};
+        float bv[3] = {b.r, b.g, b.b};
+        for (int c = 0; c < 3; c++) {
+            double later = (m * bv[c] - n * av[c]) / (m - n);
+            sqDiff += (av[c] - later) * (av[c] - later);
+            sum += bv[c];
+        }
+    }
+
+    // relative rms error of the current image
+    double values = estimator->pixelCount * 3.0;
+    double variance = sqDiff / values / (1.0 / n + 1.0 / (m - n));
+    double mean = sum / values;
+    return mean > 0.0 ? (float)(sqrt(variance / m) / mean) : 0.0f;
+}
+
+// reads the estimator rows of the band, the noise of a subset of the rows is
+// a good enough estimate without waiting for the whole band to be copied
+static void read_noise_rows(
+    RenderWorker* worker,
+    uint bandHeight,
+    BandBuffers* buffers,
+    NoiseEstimator* estimator,
+    vec3* rows
+) {
+    uint width = worker->settings->imageSize.x;
+    size_t rowSize = width * sizeof(vec3);
+    for (uint i = 0; i < estimator->rows; i++) {
+        uint row = i * bandHeight / estimator->rows;
+        mce_hybrid_buffer_read(
+            buffers->image.fImageBuff,
+            row * rowSize,
+            rowSize,
+            rows + i * width
+        );
+    }
+}
+
+static void check_noise(
+    RenderWorker* worker,
+    uint bandHeight,
+    BandBuffers* buffers,
+    RenderInfo* info,
+    NoiseEstimator* estimator,
+    uint samples
+) {
+    resolve_band(worker, bandHeight, buffers, info);
+
+    // without a noise target the estimate is only logged, so it is taken once
+    // more at the end
+    float target = worker->settings->targetNoise;
+    if (estimator->firstSamples == 0) {
+        vec3* first = estimator->first;
+        read_noise_rows(worker, bandHeight, buffers, estimator, first);
+        estimator->firstSamples = samples;
+        estimator->nextCheck = target > 0.0f ? samples * 2 : UINT32_MAX;
+        return;
+    }
+
+    read_noise_rows(worker, bandHeight, buffers, estimator, estimator->current);
+    estimator->noise = estimate_noise(estimator, samples);
+    estimator->noiseSamples = samples;
+
+    // the noise falls with the square root of the sample count
+    if (target > 0.0f && estimator->noise > target) {
+        float ratio = estimator->noise / target;
+        float needed = ceilf(samples * ratio * ratio);
+        uint max = worker->settings->iterations;
+        estimator->nextCheck = needed < (float)max ? (uint)needed : max;
+    } else {
+        estimator->nextCheck = target > 0.0f ? samples * 2 : UINT32_MAX;
+    }
+    DEBUG("- noise %.4f after %d samples", estimator->noise, samples);
+}
+
+static bool stream_due(
+    RenderSettings* settings,
+    uint samples,
+    uint lastSamples,
+    double lastTime
+) {
+    if (settings->streamIterations > 0
+        && samples - lastSamples >= settings->streamIterations)
+        return true;
+    return settings->streamInterval > 0.0f
+        && mc_get_time() - lastTime >= settings->streamInterval;
+}
+
+// copies the band into the stream image, the stream converts and writes it on
+// its own thread and the frame is skipped if it is still busy with the last one
+static bool stream_band(
+    RenderWorker* worker,
+    uint bandOffset,
+    uint bandHeight,
+    BandBuffers* buffers,
+    RenderInfo* info,
+    uint samples
+) {
+    vec3* image = frame_stream_try_lock(worker->stream);
+    if (image == NULL) return false;
+
+    uint width = worker->settings->imageSize.x;
+    resolve_band(worker, bandHeight, buffers, info);
     mce_hybrid_buffer_read(
-        iImageBuff,
+        buffers->image.fImageBuff,
         0,
-        settings.imageSize.x * settings.imageSize.y * 4,
-        image
+        width * bandHeight * sizeof(vec3),
+        image + bandOffset * width
     );
+    frame_stream_unlock(worker->stream, samples);
+    return true;
+}
+
+// the largest batch that fits the remaining time, sample limit and next noise
+// check, 0 if the deadline has been reached
+static uint next_batch_size(
+    RenderWorker* worker,
+    NoiseEstimator* estimator,
+    uint samples,
+    double sampleTime
+) {
+    RenderSettings* settings = worker->settings;
+    uint size = settings->batchSize;
+    if (settings->iterations - samples < size)
+        size = settings->iterations - samples;
+    if (estimator && estimator->nextCheck - samples < size)
+        size = estimator->nextCheck - samples;
+
+    if (worker->deadline > 0.0) {
+        // the first batch is a single sample, which measures the sample cost
+        if (sampleTime <= 0.0) return 1;
+        double remaining = worker->deadline - mc_get_time();
+        double fit = remaining / sampleTime;
+        if (fit < 1.0) return samples == 0 ? 1 : 0;
+        if (fit < size) size = (uint)fit;
+    }
+
+    return size;
+}
+
+// blocks until every band has proposed its next batch size, returns the
+// smallest one or 0 once all bands reached the noise target
+static uint agree_batch_size(SampleSync* sync, uint batch, bool converged) {
+    pthread_mutex_lock(&sync->mutex);
+    if (batch < sync->batch) sync->batch = batch;
+    sync->converged = sync->converged && converged;
+
+    uint round = sync->round;
+    if (++sync->arrived == sync->bandCount) {
+        sync->agreed = sync->converged ? 0 : sync->batch;
+        sync->arrived = 0;
+        sync->batch = UINT32_MAX;
+        sync->converged = true;
+        sync->round++;
+        pthread_cond_broadcast(&sync->cond);
+    } else {
+        while (sync->round == round) {
+            pthread_cond_wait(&sync->cond, &sync->mutex);
+        }
+    }
+
+    uint agreed = sync->agreed;
+    pthread_mutex_unlock(&sync->mutex);
+    return agreed;
+}
+
+// logs at most once per interval, and once the whole image is done
+static void add_progress(Progress* progress, uint rows, uint samples) {
+    pthread_mutex_lock(&progress->mutex);
+    progress->done += (uint64_t)rows * samples;
+    double now = mc_get_time();
+    bool last = progress->done == progress->total;
+    if (last || now - progress->lastLog >= PROGRESS_INTERVAL) {
+        uint done = (uint)(progress->done / progress->rows);
+        float percent = (float)progress->done / progress->total * 100.0f;
+        INFO("- %d/%d (%.2f%%)", done, progress->iterations, percent);
+        progress->lastLog = now;
+    }
+    pthread_mutex_unlock(&progress->mutex);
+}
+
+static ImageBuffers render_band(
+    RenderWorker* worker,
+    uint bandOffset,
+    uint bandHeight
+) {
+    RenderSettings* settings = worker->settings;
+    RenderDevice* device = worker->device;
+    bool aovs = settings->denoisePasses > 0;
+
+    uint pixelCount = settings->imageSize.x * bandHeight;
+    ImageBuffers buffers = image_buffers_create(device->dev, pixelCount, aovs);
+
+    mce_HBuffer* infoBuff
+        = mce_hybrid_buffer_create(device->dev, sizeof(RenderInfo));
+
+    // one packed hit (distance, normal and material) per pixel
+    mce_HBuffer* primaryHitBuff = mce_hybrid_buffer_create(
+        device->dev,
+        (settings->cachePrimary ? pixelCount : 1) * sizeof(uvec2)
+    );
+
+    // vec3 images are accumulated in place, other formats are converted into
+    // one at the end
+    mce_HBuffer* accumBuff = buffers.fImageBuff;
+    if (settings->accumFormat != ACCUM_FORMAT_VEC3) {
+        size_t accumSize = accum_format_size(settings->accumFormat);
+        accumBuff
+            = mce_hybrid_buffer_create(device->dev, pixelCount * accumSize);
+    }
+
+    BandBuffers bandBuffers = {
+        .info = infoBuff,
+        .accumBuff = accumBuff,
+        .primaryHitBuff = primaryHitBuff,
+        .image = buffers,
+    };
+
+    RenderInfo info = {
+        .maxRayDepth = settings->maxRayDepth,
+        .iter = 0,
+        .seed = settings->seed,
+        .writeAOVs = aovs,
+        .imageSize = settings->imageSize,
+        .bandOffset = bandOffset,
+        .cachePrimary = settings->cachePrimary,
+        .batchSize = settings->batchSize,
+        .lodBounce = settings->lodBounce,
+        .lodDistance = settings->lodDistance,
+        .preview = settings->preview,
+        .firstIteration = settings->firstIteration,
+    };
+    mce_hybrid_buffer_write(infoBuff, 0, sizeof info, &info);
+
+    MemoryUsage bandMemory = {0};
+    MemoryUsage bandUsage = {
+        .device = sizeof(RenderInfo)
+                + (settings->cachePrimary ? pixelCount : 1) * sizeof(uvec2),
+    };
+    if (accumBuff != buffers.fImageBuff) {
+        bandUsage.device
+            += pixelCount * accum_format_size(settings->accumFormat);
+    }
+
+    // budgeted renders estimate their noise from snapshots of the image
+    uint noiseRows = bandHeight < NOISE_ROWS ? bandHeight : NOISE_ROWS;
+    NoiseEstimator noise = {
+        .rows = noiseRows,
+        .pixelCount = noiseRows * settings->imageSize.x,
+        .nextCheck = NOISE_FIRST_CHECK,
+        .noise = -1.0f,
+    };
+    NoiseEstimator* estimator = NULL;
+    if (worker->deadline > 0.0 || settings->targetNoise > 0.0f) {
+        noise.first = malloc(noise.pixelCount * sizeof(vec3));
+        noise.current = malloc(noise.pixelCount * sizeof(vec3));
+        estimator = &noise;
+        bandUsage.host = noise.pixelCount * sizeof(vec3) * 2;
+    }
+    memory_update(MEMORY_RENDER_ACCUM, &bandMemory, bandUsage);
+
+    double lastStream = mc_get_time();
+    uint lastStreamSamples = 0;
+    double sampleTime = 0.0;
+    uint samples = 0;
+    bool converged = false;
+
+    // every dispatch renders a batch of samples, so the per-dispatch submit
+    // and wait cost is paid once per batch instead of once per sample
+    while (samples < settings->iterations) {
+        uint batchSize
+            = next_batch_size(worker, estimator, samples, sampleTime);
+        if (worker->sync) {
+            batchSize = agree_batch_size(worker->sync, batchSize, converged);
+        } else if (converged) {
+            break;
+        }
+        if (batchSize == 0) break;
+        set_batch_size(&bandBuffers, &info, batchSize);
+
+        uint done = samples + batchSize;
+        add_progress(worker->progress, bandHeight, batchSize);
+
+        // the iteration program does next to no work, so its run time is
+        // practically all submission overhead
+        double submitStart = mc_get_time();
+        mc_program_run(worker->programs.iter, 1, 1, 1, infoBuff);
+        worker->submitTime += mc_get_time() - submitStart;
+        worker->dispatches++;
+
+        run_render_program(worker, bandHeight, &bandBuffers);
+        worker->iterations += batchSize;
+        samples = done;
+
+        // per-sample cost including the submission, smoothed over batches
+        double batchTime = (mc_get_time() - submitStart) / batchSize;
+        sampleTime = sampleTime > 0.0 ? (sampleTime + batchTime) / 2.0
+                                      : batchTime;
+
+        if (worker->stream
+            && stream_due(settings, samples, lastStreamSamples, lastStream)
+            && stream_band(
+                worker,
+                bandOffset,
+                bandHeight,
+                &bandBuffers,
+                &info,
+                samples
+            )) {
+            lastStream = mc_get_time();
+            lastStreamSamples = samples;
+        }
+
+        if (estimator && samples >= noise.nextCheck) {
+            check_noise(
+                worker,
+                bandHeight,
+                &bandBuffers,
+                &info,
+                &noise,
+                samples
+            );
+            float target = settings->targetNoise;
+            converged = target > 0.0f && noise.noise >= 0.0f
+                     && noise.noise <= target;
+        }
+    }
+
+    // the last estimate may be from before the final batches
+    if (estimator && noise.firstSamples > 0 && noise.firstSamples < samples
+        && noise.noiseSamples != samples) {
+        check_noise(worker, bandHeight, &bandBuffers, &info, &noise, samples);
+    }
+
+    worker->samples = samples;
+    worker->noise = noise.noise;
+    free(noise.first);
+    free(noise.current);
+
+    // the later passes only read vec3 images
+    resolve_band(worker, bandHeight, &bandBuffers, &info);
+    if (bandBuffers.accumBuff != buffers.fImageBuff) {
+        mce_hybrid_buffer_destroy(bandBuffers.accumBuff);
+    }
 
-    DEBUG("cleaning up render");
-    mc_program_destroy(renderProgram);
-    mc_program_destroy(iterProgram);
-    mc_program_destroy(outputProgram);
     mce_hybrid_buffer_destroy(infoBuff);
-    mce_hybrid_buffer_destroy(fImageBuff);
+    mce_hybrid_buffer_destroy(primaryHitBuff);
+    memory_update(MEMORY_RENDER_ACCUM, &bandMemory, (MemoryUsage){0});
+    return buffers;
+}
+
+static void* render_worker(void* arg) {
+    RenderWorker* worker = arg;
+    RenderSettings* settings = worker->settings;
+    uint width = settings->imageSize.x;
+    double start = mc_get_time();
+
+    // bands are handed out one at a time, so faster devices simply end up
+    // taking more of them
+    uint band;
+    while ((band = atomic_fetch_add(worker->nextBand, 1)) < worker->bandCount) {
+        uint offset = band * worker->bandHeight;
+        uint height = worker->bandHeight;
+        if (offset + height > worker->imageRows)
+            height = worker->imageRows - offset;
+
+        ImageBuffers buffers = render_band(worker, offset, height);
+        worker->rows += height;
+
+        if (worker->bandCount == 1) {
+            worker->buffers = buffers;
+            break;
+        }
+
+        size_t size = width * height * sizeof(vec3);
+        size_t first = offset * width;
+        mce_hybrid_buffer_read(
+            buffers.fImageBuff,
+            0,
+            size,
+            worker->fImage + first
+        );
+        if (settings->denoisePasses > 0) {
+            mce_hybrid_buffer_read(
+                buffers.albedoBuff,
+                0,
+                size,
+                worker->albedo + first
+            );
+            mce_hybrid_buffer_read(
+                buffers.normalBuff,
+                0,
+                size,
+                worker->normal + first
+            );
+        }
+
+        image_buffers_destroy(&buffers);
+        DEBUG(
+            "band %d/%d done on \"%s\"",
+            band + 1,
+            worker->bandCount,
+            mc_device_get_name(worker->device->dev)
+        );
+
+        // a second band would start after the deadline
+        if (worker->deadline > 0.0) break;
+    }
+
+    worker->time = mc_get_time() - start;
+    return NULL;
+}
+
+static void destroy_workers(RenderWorker* workers, uint count) {
+    for (uint i = 0; i < count; i++) {
+        image_buffers_destroy(&workers[i].buffers);
+    }
+    free(workers);
+}
+
+unsigned char* render_finish_cpu(
+    vec3* image,
+    const vec3* albedo,
+    const vec3* normal,
+    uvec2 size,
+    uint denoisePasses
+) {
+    CHECK_NULL(image, NULL)
+    uint pixelCount = size.x * size.y;
+
+    if (denoisePasses > 0 && albedo != NULL && normal != NULL) {
+        INFO("denoising on the cpu (%d passes)", denoisePasses);
+        denoise_cpu(image, albedo, normal, size, denoisePasses);
+    }
+
+    INFO("converting image into bytes");
+    unsigned char* bytes = malloc(pixelCount * 4);
+    image_to_bytes(image, pixelCount, bytes);
+    return bytes;
+}
+
+// the image is dumped before it is denoised, along with the AOVs
+static void write_partial(
+    RenderSettings* settings,
+    vec3* fImage,
+    vec3* albedo,
+    vec3* normal
+) {
+    PartialImage partial = {
+        .size = settings->imageSize,
+        .firstIteration = settings->firstIteration,
+        .samples = settings->iterations,
+        .seed = settings->seed,
+        .image = fImage,
+        .albedo = albedo,
+        .normal = normal,
+    };
+
+    INFO(
+        "writing iterations %d to %d to \"%s\"",
+        settings->firstIteration,
+        settings->firstIteration + settings->iterations - 1,
+        settings->partialFile
+    );
+    if (!partial_write(settings->partialFile, &partial)) {
+        WARN("partial render was not written");
+    }
+}
+
+static unsigned char* finish_on_gpu(
+    RenderSettings* settings,
+    mc_Device* dev,
+    RenderPrograms* programs,
+    ImageBuffers* buffers
+) {
+    uint pixelCount = settings->imageSize.x * settings->imageSize.y;
+    mce_HBuffer* resultBuff = buffers->fImageBuff;
+    mce_HBuffer* tmpBuff = NULL;
+
+    if (programs->denoise) {
+        INFO("denoising on the gpu (%d passes)", settings->denoisePasses);
+        tmpBuff = mce_hybrid_buffer_create(dev, pixelCount * sizeof(vec3));
+        mce_HBuffer* denoiseInfoBuff
+            = mce_hybrid_buffer_create(dev, sizeof(DenoiseInfo));
+
+        mce_HBuffer* outBuff = tmpBuff;
+
+        for (uint i = 0; i < settings->denoisePasses; i++) {
+            DenoiseInfo denoiseInfo = denoise_pass_info(i);
+            mce_hybrid_buffer_write(
+                denoiseInfoBuff,
+                0,
+                sizeof denoiseInfo,
+                &denoiseInfo
+            );
+
+            mc_program_run(
+                programs->denoise,
+                settings->imageSize.x / settings->wgSize.x,
+                settings->imageSize.y / settings->wgSize.y,
+                1,
+                denoiseInfoBuff,
+                resultBuff,
+                outBuff,
+                buffers->albedoBuff,
+                buffers->normalBuff
+            );
+
+            mce_HBuffer* swap = resultBuff;
+            resultBuff = outBuff;
+            outBuff = swap;
+        }
+
+        mce_hybrid_buffer_destroy(denoiseInfoBuff);
+    }
+
+    INFO("converting image into bytes");
+
+    mce_HBuffer* iImageBuff
+        = mce_hybrid_buffer_create(dev, pixelCount * sizeof(int));
+
+    mc_program_run(
+        programs->output,
+        settings->imageSize.x / settings->wgSize.x,
+        settings->imageSize.y / settings->wgSize.y,
+        1,
+        resultBuff,
+        iImageBuff
+    );
+
+    unsigned char* image = malloc(pixelCount * 4);
+    mce_hybrid_buffer_read(iImageBuff, 0, pixelCount * 4, image);
+
     mce_hybrid_buffer_destroy(iImageBuff);
+    if (tmpBuff) mce_hybrid_buffer_destroy(tmpBuff);
+
+    return image;
+}
+
+unsigned char* render(
+    RenderDevice* devices,
+    uint deviceCount,
+    RenderSettings settings
+) {
+    CHECK_NULL(devices, NULL)
+    if (deviceCount == 0) {
+        ERROR("no devices to render with");
+        return NULL;
+    }
+
+    INFO("preparing render with settings:");
+    for (uint i = 0; i < deviceCount; i++) {
+        INFO("- device: \"%s\"", mc_device_get_name(devices[i].dev));
+    }
+    if (settings.wgSize.x == 0 || settings.wgSize.y == 0) {
+        INFO("- work group size: auto");
+    } else {
+        INFO("- work group size: %dx%d", settings.wgSize.x, settings.wgSize.y);
+    }
+    INFO("- image size: %dx%d", settings.imageSize.x, settings.imageSize.y);
+    INFO("- iterations: %d", settings.iterations);
+    if (settings.firstIteration > 0) {
+        INFO("- first iteration: %d", settings.firstIteration);
+    }
+    INFO("- seed: %u", settings.seed);
+    INFO("- max ray depth: %d", settings.maxRayDepth);
+    INFO("- cache primary hits: %s", settings.cachePrimary ? "yes" : "no");
+    INFO("- specialize shader: %s", settings.specialize ? "yes" : "no");
+    INFO("- preview shading: %s", settings.preview ? "yes" : "no");
+    INFO("- samples per dispatch: %d", settings.batchSize);
+    if (settings.timeBudgetMs > 0) {
+        INFO("- time budget: %d ms", settings.timeBudgetMs);
+    }
+    if (settings.targetNoise > 0.0f) {
+        INFO("- target noise: %.4f", settings.targetNoise);
+    }
+    INFO(
+        "- accumulation format: %s (%d bytes/pixel)",
+        accum_format_name(settings.accumFormat),
+        (int)accum_format_size(settings.accumFormat)
+    );
+    INFO(
+        "- coarse level after: %d bounces, %.2f distance",
+        settings.lodBounce,
+        settings.lodDistance
+    );
+    INFO(
+        "- denoise passes: %d (%s)",
+        settings.denoisePasses,
+        settings.denoiseOnCpu ? "cpu" : "gpu"
+    );
+
+    if (settings.batchSize == 0) {
+        ERROR("samples per dispatch must be at least 1");
+        return NULL;
+    }
+
+    // partial renders must cover an exact iteration range to be merged
+    bool partial = settings.partialFile && settings.partialFile[0] != '\0';
+    if (partial && (settings.timeBudgetMs > 0 || settings.targetNoise > 0.0f)) {
+        ERROR("partial renders can't have a time budget or noise target");
+        return NULL;
+    }
+
+    for (uint i = 0; i < deviceCount; i++) {
+        CHECK_NULL(devices[i].dev, NULL)
+        CHECK_NULL(devices[i].scene, NULL)
+        CHECK_NULL(devices[i].camera, NULL)
+    }
+
+    INFO("updating scene and camera");
+    for (uint i = 0; i < deviceCount; i++) {
+        scene_update_data(devices[i].scene);
+        scene_update_materials(devices[i].scene);
+        if (!scene_update_voxels(devices[i].scene)) {
+            ERROR("failed to update scene voxels");
+            return NULL;
+        }
+        scene_update_instances(devices[i].scene);
+        camera_update(devices[i].camera);
+    }
+
+    // the shaders only depend on these properties of the scene
+    Scene* scene = devices[0].scene;
+    SceneCreateInfo sceneInfo = {
+        .size = scene_get_size(scene),
+        .bg = scene_get_bg(scene),
+        .layout = scene_get_layout(scene),
+        .format = scene_get_format(scene),
+    };
+
+    // all devices share one workgroup size, it is tuned on the first one
+    // (which also finishes the image)
+    if (settings.wgSize.x == 0 || settings.wgSize.y == 0) {
+        settings.wgSize
+            = tune_workgroup_size(&devices[0], &settings, &sceneInfo);
+        if (settings.wgSize.x == 0) return NULL;
+    }
+
+    for (uint i = 0; i < deviceCount; i++) {
+        if (!check_workgroup_size(devices[i].dev, settings.wgSize)) return NULL;
+    }
+
+    RenderCode code;
+    if (!compile_code(&settings, &sceneInfo, &code)) return NULL;
+
+    // split the image into bands of whole workgroup rows, with a few bands per
+    // device so that the work can be balanced between them
+    uint wgRows = settings.imageSize.y / settings.wgSize.y;
+    if (wgRows == 0) {
+        ERROR("image is smaller than a workgroup");
+        return NULL;
+    }
+
+    // budgeted renders give every device a single band, which is sampled
+    // until the deadline (or noise target) like a single device render, and
+    // the bands take the same batches so that there are no seams between them
+    bool budgeted = settings.timeBudgetMs > 0 || settings.targetNoise > 0.0f;
+    uint bandCount = deviceCount == 1 || budgeted ? deviceCount
+                                                   : deviceCount * 4;
+    if (bandCount > wgRows) bandCount = wgRows;
+    uint bandWGRows = (wgRows + bandCount - 1) / bandCount;
+    bandCount = (wgRows + bandWGRows - 1) / bandWGRows;
+
+    uint pixelCount = settings.imageSize.x * settings.imageSize.y;
+    bool aovs = settings.denoisePasses > 0;
+    vec3* fImage = NULL;
+    vec3* albedo = NULL;
+    vec3* normal = NULL;
+
+    // host copies of the image, for merging bands or denoising on the cpu
+    MemoryUsage hostMemory = {0};
+    MemoryUsage hostUsage = {
+        .host = pixelCount * sizeof(vec3) * (aovs ? 3 : 1),
+    };
+
+    if (bandCount > 1) {
+        fImage = calloc(pixelCount, sizeof(vec3));
+        albedo = aovs ? calloc(pixelCount, sizeof(vec3)) : NULL;
+        normal = aovs ? calloc(pixelCount, sizeof(vec3)) : NULL;
+        memory_update(MEMORY_RENDER_IMAGES, &hostMemory, hostUsage);
+    }
+
+    double start = mc_get_time();
+    double deadline = settings.timeBudgetMs > 0
+                        ? start + settings.timeBudgetMs / 1000.0
+                        : 0.0;
+    atomic_uint nextBand = 0;
+    SampleSync sync = {
+        .bandCount = bandCount,
+        .batch = UINT32_MAX,
+        .converged = true,
+    };
+    bool synced = budgeted && bandCount > 1;
+    if (synced) {
+        pthread_mutex_init(&sync.mutex, NULL);
+        pthread_cond_init(&sync.cond, NULL);
+    }
+    Progress progress = {
+        .total = (uint64_t)wgRows * settings.wgSize.y * settings.iterations,
+        .iterations = settings.iterations,
+        .rows = wgRows * settings.wgSize.y,
+        .lastLog = start,
+    };
+    pthread_mutex_init(&progress.mutex, NULL);
+    RenderWorker* workers = calloc(deviceCount, sizeof *workers);
+    bool failed = false;
+
+    for (uint i = 0; i < deviceCount; i++) {
+        workers[i] = (RenderWorker){
+            .settings = &settings,
+            .device = &devices[i],
+            .bandCount = bandCount,
+            .bandHeight = bandWGRows * settings.wgSize.y,
+            .imageRows = wgRows * settings.wgSize.y,
+            .nextBand = &nextBand,
+            .fImage = fImage,
+            .albedo = albedo,
+            .normal = normal,
+            .deadline = deadline,
+            .sync = synced ? &sync : NULL,
+            .progress = &progress,
+        };
+
+        if (!create_programs(devices[i].dev, &code, &workers[i].programs)) {
+            failed = true;
+        }
+    }
+
+    FrameStream* stream = NULL;
+    if (!failed && settings.streamTarget && settings.streamTarget[0] != '\0') {
+        stream = frame_stream_create(settings.streamTarget, settings.imageSize);
+        if (stream == NULL) WARN("rendering without streaming frames");
+        for (uint i = 0; i < deviceCount; i++) workers[i].stream = stream;
+    }
+
+    if (failed) {
+        if (synced) {
+            pthread_mutex_destroy(&sync.mutex);
+            pthread_cond_destroy(&sync.cond);
+        }
+        pthread_mutex_destroy(&progress.mutex);
+        destroy_workers(workers, deviceCount);
+        memory_update(MEMORY_RENDER_IMAGES, &hostMemory, (MemoryUsage){0});
+        free(fImage);
+        free(albedo);
+        free(normal);
+        return NULL;
+    }
+
+    INFO(
+        "starting render (%d iterations, %d band(s)):",
+        settings.iterations,
+        bandCount
+    );
+
+    pthread_t* threads = malloc(sizeof *threads * deviceCount);
+    for (uint i = 1; i < deviceCount; i++) {
+        pthread_create(&threads[i], NULL, render_worker, &workers[i]);
+    }
+    render_worker(&workers[0]);
+    for (uint i = 1; i < deviceCount; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    if (synced) {
+        pthread_mutex_destroy(&sync.mutex);
+        pthread_cond_destroy(&sync.cond);
+    }
+    pthread_mutex_destroy(&progress.mutex);
+
+    // budgeted renders may stop early, workers without a band have no samples
+    uint maxSamples = 0;
+    for (uint i = 0; i < deviceCount; i++) {
+        if (workers[i].samples > maxSamples) maxSamples = workers[i].samples;
+    }
+
+    double elapsed = mc_get_time() - start;
+    double rate = maxSamples > 0 ? elapsed / maxSamples : 0.0;
+    INFO(
+        "finished render in %.02fs (%.02f ms/iteration)",
+        elapsed,
+        rate * 1000.0
+    );
+
+    for (uint i = 0; i < deviceCount; i++) {
+        RenderWorker* worker = &workers[i];
+        double samples
+            = (double)worker->rows * settings.imageSize.x * worker->samples;
+        // each batch submits two dispatches (iteration and render), batches
+        // are cut short by the sample limit, deadline and noise checks
+        double submit = worker->dispatches > 0
+                          ? worker->submitTime / worker->dispatches
+                          : 0.0;
+        double submitPerIteration
+            = worker->iterations > 0
+                ? worker->submitTime * 2 / worker->iterations
+                : 0.0;
+        INFO(
+            "- \"%s\": %d rows, %.02f Msamples/s, %.03f ms/submit "
+            "(%.03f ms/iteration)",
+            mc_device_get_name(devices[i].dev),
+            worker->rows,
+            worker->time > 0 ? samples / worker->time / 1e6 : 0.0,
+            submit * 1000.0,
+            submitPerIteration * 1000.0
+        );
+
+        if (budgeted && worker->noise >= 0.0f) {
+            INFO(
+                "  %d samples/pixel, estimated noise: %.4f",
+                worker->samples,
+                worker->noise
+            );
+        } else if (budgeted) {
+            INFO("  %d samples/pixel (too few for noise)", worker->samples);
+        }
+
+        // an estimate, every batch reads and writes each pixel of the
+        // accumulation buffer, budgeted renders have a single band with
+        // batches of varying size
+        uint batches = budgeted ? worker->dispatches
+                                : (settings.iterations + settings.batchSize - 1)
+                                      / settings.batchSize;
+        double traffic = (double)worker->rows * settings.imageSize.x * batches
+                       * accum_format_size(settings.accumFormat) * 2;
+        INFO(
+            "  accumulation traffic (estimated): %.02f GB (%.02f GB/s)",
+            traffic / 1e9,
+            worker->time > 0 ? traffic / worker->time / 1e9 : 0.0
+        );
+    }
+
+    // a single band stays on whichever device rendered it, merged bands are
+    // finished on the first device
+    RenderWorker* owner = &workers[0];
+    for (uint i = 0; i < deviceCount; i++) {
+        if (workers[i].buffers.fImageBuff) owner = &workers[i];
+    }
+
+    mc_Device* dev = owner->device->dev;
+    ImageBuffers buffers = owner->buffers;
+
+    if (bandCount == 1 && (settings.denoiseOnCpu || partial)) {
+        size_t size = pixelCount * sizeof(vec3);
+        fImage = malloc(size);
+        mce_hybrid_buffer_read(buffers.fImageBuff, 0, size, fImage);
+        memory_update(MEMORY_RENDER_IMAGES, &hostMemory, hostUsage);
+        if (aovs) {
+            albedo = malloc(size);
+            normal = malloc(size);
+            mce_hybrid_buffer_read(buffers.albedoBuff, 0, size, albedo);
+            mce_hybrid_buffer_read(buffers.normalBuff, 0, size, normal);
+        }
+    } else if (bandCount > 1 && !settings.denoiseOnCpu) {
+        buffers = (ImageBuffers){
+            .fImageBuff = mce_hybrid_buffer_create_from(
+                dev,
+                pixelCount * sizeof(vec3),
+                fImage
+            ),
+            .albedoBuff = mce_hybrid_buffer_create_from(
+                dev,
+                (aovs ? pixelCount : 1) * sizeof(vec3),
+                aovs ? (void*)albedo : (void*)fImage
+            ),
+            .normalBuff = mce_hybrid_buffer_create_from(
+                dev,
+                (aovs ? pixelCount : 1) * sizeof(vec3),
+                aovs ? (void*)normal : (void*)fImage
+            ),
+        };
+        MemoryUsage usage = {
+            .device = pixelCount * sizeof(vec3)
+                    + (aovs ? pixelCount : 1) * sizeof(vec3) * 2,
+        };
+        memory_update(MEMORY_RENDER_IMAGES, &buffers.memory, usage);
+    }
+
+    if (partial) write_partial(&settings, fImage, albedo, normal);
+
+    unsigned char* image;
+    if (settings.denoiseOnCpu) {
+        image = render_finish_cpu(
+            fImage,
+            albedo,
+            normal,
+            settings.imageSize,
+            settings.denoisePasses
+        );
+    } else {
+        image = finish_on_gpu(&settings, dev, &owner->programs, &buffers);
+    }
+
+    if (bandCount > 1) image_buffers_destroy(&buffers);
+
+    // the final (denoised) image replaces the last progress frame
+    if (stream) frame_stream_destroy(stream, image, maxSamples);
+
+    DEBUG("cleaning up render");
+    destroy_workers(workers, deviceCount);
+    memory_update(MEMORY_RENDER_IMAGES, &hostMemory, (MemoryUsage){0});
+    free(fImage);
+    free(albedo);
+    free(normal);
 
     return image;
 }
\ No newline at end of file
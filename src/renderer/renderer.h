@@ -1,30 +1,97 @@
 #pragma once
 
+#include <stdbool.h>
+
 #include "world/camera.h"
 #include "world/scene.h"
 
+typedef enum {
+    ACCUM_FORMAT_VEC3,   ///< 3 floats padded to 16 bytes (std430 vec3)
+    ACCUM_FORMAT_PACKED, ///< 3 tightly packed floats (12 bytes)
+    ACCUM_FORMAT_HALF,   ///< 4 half floats (8 bytes)
+} AccumFormat;
+
 typedef struct {
     char* rendererCode;  ///< The renderer shader code
     char* iterationCode; ///< The iteration shader code
     char* outputCode;    ///< The output shader code
-    uvec2 wgSize;        ///< The workgroup size
+    char* denoiseCode;   ///< The denoise shader code
+    uvec2 wgSize;        ///< The workgroup size (0x0 to tune it)
+    char* wgCacheFile;   ///< The file tuned sizes are kept in (NULL for none)
     uvec2 imageSize;     ///< The size of the image
-    uint iterations;     ///< The number of iterations
+    uint iterations;     ///< The number of iterations (at most if budgeted)
+    uint batchSize;      ///< The number of iterations rendered per dispatch
     uint maxRayDepth;    ///< The maximum ray depth
+    uint denoisePasses;  ///< The number of denoise passes (0 to disable)
+    bool denoiseOnCpu;   ///< Whether to denoise on the CPU instead of the GPU
+    bool cachePrimary;   ///< Whether to trace primary rays only once
+    bool specialize;     ///< Whether to bake scene constants into the shader
+
+    AccumFormat accumFormat; ///< The format of the accumulated image
+    uint firstIteration;     ///< The index of the first iteration
+    uint seed;               ///< The seed the samples are derived from
+    uint timeBudgetMs;       ///< Stop sampling after this long (0: no limit)
+    float targetNoise;       ///< Stop at this relative noise (0: no target)
+    uint lodBounce;          ///< Bounces before the coarse level (0: never)
+    float lodDistance;       ///< Distance before the coarse level (0: never)
+    bool preview;            ///< Whether to shade the primary hit directly
+    char* streamTarget;      ///< Where to publish progress ("": nowhere)
+    float streamInterval;    ///< Seconds between published frames
+    uint streamIterations;   ///< Iterations between published frames
+    char* partialFile;       ///< Where the unfinished image goes ("": nowhere)
 } RenderSettings;
 
+typedef struct {
+    mc_Device* dev; ///< The device to render with
+    Scene* scene;   ///< The scene, created on the device
+    Camera* camera; ///< The camera, created on the device
+} RenderDevice;
+
 /**
- * @brief Render a scene
- * @param dev The device to render with
+ * @brief Render a scene, splitting the image between one or more devices
+ * @param devices The devices to render with, each with its own copy of the
+ * scene and camera
+ * @param deviceCount The number of devices
  * @param settings The settings for the render
- * @param scene The scene to render
- * @param camera The camera to render from
  * @return The rendered image on success, NULL on failure (must be freed by the
  * caller)
  */
 unsigned char* render(
-    mc_Device* dev,
-    RenderSettings settings,
-    Scene* scene,
-    Camera* camera
+    RenderDevice* devices,
+    uint deviceCount,
+    RenderSettings settings
 );
+
+/**
+ * @brief Compile the shaders render will use into the shader cache ahead of
+ * time, e.g. on another thread while the scene is built (but not while render
+ * runs), only the iteration shader is compiled if the workgroup size is tuned
+ * @param settings The settings of the render
+ * @param scene The create info of the scene that will be rendered
+ * @return true on success, false if a shader failed to compile
+ */
+bool render_prepare(RenderSettings settings, SceneCreateInfo scene);
+
+/**
+ * @brief Denoise a float image on the CPU and convert it into bytes, the same
+ * way render does with denoiseOnCpu
+ * @param image The image, overwritten when it is denoised
+ * @param albedo The first-hit albedo (NULL to skip denoising)
+ * @param normal The first-hit normals (NULL to skip denoising)
+ * @param size The size of the image
+ * @param denoisePasses The number of denoise passes (0 to disable)
+ * @return The image, 4 bytes per pixel (must be freed by the caller)
+ */
+unsigned char* render_finish_cpu(
+    vec3* image,
+    const vec3* albedo,
+    const vec3* normal,
+    uvec2 size,
+    uint denoisePasses
+);
+
+/**
+ * @brief Destroy the programs that were created (and kept) by render, must be
+ * called before the devices are destroyed
+ */
+void render_release_programs(void);
\ No newline at end of file
@@ -1,10 +1,37 @@
+#include <pthread.h>
 #include <shaderc/shaderc.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "logger/logger.h"
 #include "shader_compiler.h"
 
+#ifdef EMBED_SHADERS
+#include "embedded_shaders.h"
+#endif
+
+// the least recently used shaders are dropped beyond this, which must be more
+// than the shaders of one render
+#define SHADER_CACHE_SIZE 32
+
+// the hash only speeds up the lookup, hits are compared by their whole key
+typedef struct ShaderCacheEntry {
+    uint64_t hash;
+    char* code;
+    char* entrypoint;
+    uvec2 wgSize;
+    ShaderMacro* macros; ///< Own copies of the names and values
+    uint macroCount;
+    SPIRVCode spirv;
+    struct ShaderCacheEntry* next;
+} ShaderCacheEntry;
+
+// ordered from the most to the least recently used
+static ShaderCacheEntry* shaderCache = NULL;
+static uint shaderCacheCount = 0;
+static pthread_mutex_t shaderCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
 char* int_to_string(int i) {
     int len = snprintf(NULL, 0, "%d", i);
     char* str = malloc(len + 1);
@@ -12,14 +39,28 @@ char* int_to_string(int i) {
     return str;
 }
 
-SPIRVCode compile_glsl(
+static void add_macro(
+    shaderc_compile_options_t options,
+    const char* name,
+    const char* value
+) {
+    shaderc_compile_options_add_macro_definition(
+        options,
+        name,
+        strlen(name),
+        value,
+        strlen(value)
+    );
+}
+
+static SPIRVCode compile_glsl_uncached(
     const char* name,
     const char* code,
     const char* entrypoint,
-    uvec2 wgSize
+    uvec2 wgSize,
+    const ShaderMacro* macros,
+    uint macroCount
 ) {
-    CHECK_NULL(code, (SPIRVCode){0, NULL});
-    CHECK_NULL(entrypoint, (SPIRVCode){0, NULL});
     INFO("compiling shader \"%s\", entrypoint: \"%s\"", name, entrypoint);
 
     shaderc_compile_options_t options = shaderc_compile_options_initialize();
@@ -29,25 +70,17 @@ SPIRVCode compile_glsl(
     }
 
     char* wgSizeX = int_to_string((int)wgSize.x);
-    shaderc_compile_options_add_macro_definition(
-        options,
-        "WORKGROUP_SIZE_X",
-        strlen("WORKGROUP_SIZE_X"),
-        wgSizeX,
-        strlen(wgSizeX)
-    );
+    add_macro(options, "WORKGROUP_SIZE_X", wgSizeX);
     free(wgSizeX);
 
     char* wgSizeY = int_to_string((int)wgSize.y);
-    shaderc_compile_options_add_macro_definition(
-        options,
-        "WORKGROUP_SIZE_Y",
-        strlen("WORKGROUP_SIZE_Y"),
-        wgSizeY,
-        strlen(wgSizeY)
-    );
+    add_macro(options, "WORKGROUP_SIZE_Y", wgSizeY);
     free(wgSizeY);
 
+    for (uint i = 0; i < macroCount; i++) {
+        add_macro(options, macros[i].name, macros[i].value);
+    }
+
     shaderc_compile_options_set_optimization_level(
         options,
         shaderc_optimization_level_performance
@@ -88,4 +121,252 @@ SPIRVCode compile_glsl(
     shaderc_compiler_release(compiler);
 
     return (SPIRVCode){size, spirv};
+}
+
+static uint64_t shader_hash(
+    const char* code,
+    const char* entrypoint,
+    uvec2 wgSize,
+    const ShaderMacro* macros,
+    uint macroCount
+) {
+    uint64_t hash = hash_bytes(HASH_INIT, code, strlen(code));
+    hash = hash_bytes(hash, entrypoint, strlen(entrypoint));
+    hash = hash_bytes(hash, &wgSize, sizeof wgSize);
+    for (uint i = 0; i < macroCount; i++) {
+        // include the terminators so that "AB" "C" and "A" "BC" differ
+        hash = hash_bytes(hash, macros[i].name, strlen(macros[i].name) + 1);
+        hash = hash_bytes(hash, macros[i].value, strlen(macros[i].value) + 1);
+    }
+    return hash;
+}
+
+static bool macros_equal(
+    const ShaderMacro* a,
+    uint countA,
+    const ShaderMacro* b,
+    uint countB
+) {
+    if (countA != countB) return false;
+    for (uint i = 0; i < countA; i++) {
+        if (strcmp(a[i].name, b[i].name) != 0) return false;
+        if (strcmp(a[i].value, b[i].value) != 0) return false;
+    }
+    return true;
+}
+
+static bool entry_matches(
+    const ShaderCacheEntry* entry,
+    uint64_t hash,
+    const char* code,
+    const char* entrypoint,
+    uvec2 wgSize,
+    const ShaderMacro* macros,
+    uint macroCount
+) {
+    return entry->hash == hash && entry->wgSize.x == wgSize.x
+        && entry->wgSize.y == wgSize.y
+        && macros_equal(entry->macros, entry->macroCount, macros, macroCount)
+        && strcmp(entry->entrypoint, entrypoint) == 0
+        && strcmp(entry->code, code) == 0;
+}
+
+static void entry_free(ShaderCacheEntry* entry) {
+    for (uint i = 0; i < entry->macroCount; i++) {
+        free((char*)entry->macros[i].name);
+        free((char*)entry->macros[i].value);
+    }
+    free(entry->macros);
+    free(entry->code);
+    free(entry->entrypoint);
+    free(entry->spirv.code);
+    free(entry);
+}
+
+// the stock shaders may have been compiled at build time, the copy is owned by
+// the cache like compiled code
+static SPIRVCode find_embedded(
+    const char* name,
+    const char* code,
+    const char* entrypoint,
+    uvec2 wgSize,
+    const ShaderMacro* macros,
+    uint macroCount
+) {
+#ifdef EMBED_SHADERS
+    for (uint i = 0; i < embeddedShaderCount; i++) {
+        const EmbeddedShader* shader = &embeddedShaders[i];
+        ShaderMacro macro = {shader->macroName, shader->macroValue};
+        uint count = shader->macroName ? 1 : 0;
+        if (shader->wgSize.x != wgSize.x || shader->wgSize.y != wgSize.y
+            || !macros_equal(&macro, count, macros, macroCount)
+            || strcmp(entrypoint, "main") != 0
+            || strcmp(shader->glsl, code) != 0)
+            continue;
+
+        INFO("using precompiled shader \"%s\"", name);
+        char* spirv = malloc(shader->size);
+        memcpy(spirv, shader->spirv, shader->size);
+        return (SPIRVCode){shader->size, spirv};
+    }
+#endif
+    return (SPIRVCode){0, NULL};
+}
+
+SPIRVCode compile_glsl(
+    const char* name,
+    const char* code,
+    const char* entrypoint,
+    uvec2 wgSize
+) {
+    return compile_glsl_variant(name, code, entrypoint, wgSize, NULL, 0);
+}
+
+SPIRVCode compile_glsl_variant(
+    const char* name,
+    const char* code,
+    const char* entrypoint,
+    uvec2 wgSize,
+    const ShaderMacro* macros,
+    uint macroCount
+) {
+    CHECK_NULL(code, (SPIRVCode){0, NULL});
+    CHECK_NULL(entrypoint, (SPIRVCode){0, NULL});
+
+    uint64_t hash = shader_hash(code, entrypoint, wgSize, macros, macroCount);
+
+    pthread_mutex_lock(&shaderCacheMutex);
+    ShaderCacheEntry** prev = &shaderCache;
+    for (ShaderCacheEntry* e = shaderCache; e != NULL; e = e->next) {
+        if (entry_matches(
+                e,
+                hash,
+                code,
+                entrypoint,
+                wgSize,
+                macros,
+                macroCount
+            )) {
+            // move to the front, the entry may be evicted by another thread
+            // as soon as the lock is released
+            *prev = e->next;
+            e->next = shaderCache;
+            shaderCache = e;
+            SPIRVCode spirv = e->spirv;
+            pthread_mutex_unlock(&shaderCacheMutex);
+            DEBUG("using cached shader \"%s\"", name);
+            return spirv;
+        }
+        prev = &e->next;
+    }
+    pthread_mutex_unlock(&shaderCacheMutex);
+
+    SPIRVCode spirv = find_embedded(
+        name,
+        code,
+        entrypoint,
+        wgSize,
+        macros,
+        macroCount
+    );
+    if (spirv.size == 0) {
+        spirv = compile_glsl_uncached(
+            name,
+            code,
+            entrypoint,
+            wgSize,
+            macros,
+            macroCount
+        );
+    }
+    if (spirv.size == 0) return spirv;
+
+    ShaderCacheEntry* entry = malloc(sizeof *entry);
+    *entry = (ShaderCacheEntry){
+        .hash = hash,
+        .code = strdup(code),
+        .entrypoint = strdup(entrypoint),
+        .wgSize = wgSize,
+        .macros = malloc(sizeof *entry->macros * (macroCount + 1)),
+        .macroCount = macroCount,
+        .spirv = spirv,
+    };
+    for (uint i = 0; i < macroCount; i++) {
+        entry->macros[i].name = strdup(macros[i].name);
+        entry->macros[i].value = strdup(macros[i].value);
+    }
+
+    pthread_mutex_lock(&shaderCacheMutex);
+    entry->next = shaderCache;
+    shaderCache = entry;
+    if (++shaderCacheCount > SHADER_CACHE_SIZE) {
+        ShaderCacheEntry** last = &shaderCache;
+        while ((*last)->next != NULL) last = &(*last)->next;
+        DEBUG("dropping least recently used shader from the cache");
+        entry_free(*last);
+        *last = NULL;
+        shaderCacheCount--;
+    }
+    pthread_mutex_unlock(&shaderCacheMutex);
+
+    return spirv;
+}
+
+void shader_cache_release(SPIRVCode code) {
+    pthread_mutex_lock(&shaderCacheMutex);
+    ShaderCacheEntry** prev = &shaderCache;
+    for (ShaderCacheEntry* e = shaderCache; e != NULL; e = e->next) {
+        if (e->spirv.code == code.code) {
+            *prev = e->next;
+            entry_free(e);
+            shaderCacheCount--;
+            break;
+        }
+        prev = &e->next;
+    }
+    pthread_mutex_unlock(&shaderCacheMutex);
+}
+
+// whether the entry was compiled with every one of the macros (and maybe more)
+static bool entry_has_macros(
+    const ShaderCacheEntry* entry,
+    const ShaderMacro* macros,
+    uint macroCount
+) {
+    for (uint i = 0; i < macroCount; i++) {
+        bool found = false;
+        for (uint j = 0; j < entry->macroCount && !found; j++) {
+            found = strcmp(entry->macros[j].name, macros[i].name) == 0
+                 && strcmp(entry->macros[j].value, macros[i].value) == 0;
+        }
+        if (!found) return false;
+    }
+    return true;
+}
+
+void shader_cache_release_variant(const ShaderMacro* macros, uint macroCount) {
+    pthread_mutex_lock(&shaderCacheMutex);
+    ShaderCacheEntry** prev = &shaderCache;
+    while (*prev != NULL) {
+        ShaderCacheEntry* e = *prev;
+        if (entry_has_macros(e, macros, macroCount)) {
+            *prev = e->next;
+            entry_free(e);
+            shaderCacheCount--;
+        } else {
+            prev = &e->next;
+        }
+    }
+    pthread_mutex_unlock(&shaderCacheMutex);
+}
+
+void shader_cache_clear(void) {
+    pthread_mutex_lock(&shaderCacheMutex);
+    while (shaderCache != NULL) {
+        ShaderCacheEntry* next = shaderCache->next;
+        entry_free(shaderCache);
+        shaderCache = next;
+    }
+    shaderCacheCount = 0;
+    pthread_mutex_unlock(&shaderCacheMutex);
 }
\ No newline at end of file
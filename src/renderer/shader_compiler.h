@@ -8,6 +8,22 @@ typedef struct SPIRVCode {
     char* code;
 } SPIRVCode;
 
+typedef struct ShaderMacro {
+    const char* name;  ///< The name of the macro
+    const char* value; ///< The value of the macro
+} ShaderMacro;
+
+/**
+ * @brief Compile GLSL compute shader code into SPIR-V, results are cached so
+ * compiling the same code again is free (the cache keeps the most recently
+ * used shaders, the returned code stays valid until a few dozen other shaders
+ * were compiled or it is released)
+ * @param name The name of the shader (for error messages)
+ * @param code The GLSL code
+ * @param entrypoint The entrypoint of the shader
+ * @param wgSize The workgroup size (WORKGROUP_SIZE_X/Y macros)
+ * @return The SPIR-V code (owned by the cache), size 0 on failure
+ */
 SPIRVCode compile_glsl(
     const char* name,
     const char* code,
@@ -15,4 +31,44 @@ SPIRVCode compile_glsl(
     uvec2 wgSize
 );
 
+/**
+ * @brief Compile a variant of GLSL compute shader code with extra macro
+ * definitions, cached like compile_glsl (per code and set of macros)
+ * @param name The name of the shader (for error messages)
+ * @param code The GLSL code
+ * @param entrypoint The entrypoint of the shader
+ * @param wgSize The workgroup size (WORKGROUP_SIZE_X/Y macros)
+ * @param macros The extra macros
+ * @param macroCount The number of extra macros
+ * @return The SPIR-V code (owned by the cache), size 0 on failure
+ */
+SPIRVCode compile_glsl_variant(
+    const char* name,
+    const char* code,
+    const char* entrypoint,
+    uvec2 wgSize,
+    const ShaderMacro* macros,
+    uint macroCount
+);
+
+/**
+ * @brief Drop compiled code from the cache and free it, for code that won't be
+ * used again (e.g. losing workgroup size candidates)
+ * @param code The code returned by compile_glsl or compile_glsl_variant
+ */
+void shader_cache_release(SPIRVCode code);
+
+/**
+ * @brief Drop every cached shader compiled with (at least) the given macros,
+ * whatever its code, workgroup size and other macros
+ * @param macros The macros of the variant
+ * @param macroCount The number of macros
+ */
+void shader_cache_release_variant(const ShaderMacro* macros, uint macroCount);
+
+/**
+ * @brief Free all cached SPIR-V code
+ */
+void shader_cache_clear(void);
+
 #endif // COMPILER_H
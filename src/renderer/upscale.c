@@ -0,0 +1,76 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "upscale.h"
+
+// the color difference to the nearest sample (in 8 bit units) at which the
+// weight of a sample is halved
+#define UPSCALE_SIGMA 24.0f
+
+// a rational falloff, it is evaluated 4 times per output pixel and is much
+// cheaper than a gaussian
+static float range_weight(const unsigned char* a, const unsigned char* b) {
+    float d = 0.0f;
+    for (int c = 0; c < 3; c++) {
+        float diff = (float)a[c] - (float)b[c];
+        d += diff * diff;
+    }
+    return 1.0f / (1.0f + d / (UPSCALE_SIGMA * UPSCALE_SIGMA));
+}
+
+static int clamp_int(int v, int max) {
+    return v < 0 ? 0 : v > max ? max : v;
+}
+
+unsigned char* upscale_image(
+    const unsigned char* image,
+    uvec2 size,
+    uvec2 targetSize
+) {
+    unsigned char* out = malloc(targetSize.x * targetSize.y * 4);
+    float scaleX = (float)size.x / (float)targetSize.x;
+    float scaleY = (float)size.y / (float)targetSize.y;
+    int maxX = (int)size.x - 1;
+    int maxY = (int)size.y - 1;
+
+    for (uint y = 0; y < targetSize.y; y++) {
+        float sy = ((float)y + 0.5f) * scaleY - 0.5f;
+        int y0 = (int)floorf(sy);
+        float fy = sy - (float)y0;
+
+        for (uint x = 0; x < targetSize.x; x++) {
+            float sx = ((float)x + 0.5f) * scaleX - 0.5f;
+            int x0 = (int)floorf(sx);
+            float fx = sx - (float)x0;
+
+            int nearestX = clamp_int(x0 + (fx >= 0.5f), maxX);
+            int nearestY = clamp_int(y0 + (fy >= 0.5f), maxY);
+            const unsigned char* nearest
+                = image + (nearestY * (int)size.x + nearestX) * 4;
+
+            float sum[4] = {0};
+            float weightSum = 0.0f;
+            for (int i = 0; i < 4; i++) {
+                int dx = i & 1;
+                int dy = i >> 1;
+                int px = clamp_int(x0 + dx, maxX);
+                int py = clamp_int(y0 + dy, maxY);
+                const unsigned char* p = image + (py * (int)size.x + px) * 4;
+
+                float w = (dx ? fx : 1.0f - fx) * (dy ? fy : 1.0f - fy);
+                w *= range_weight(nearest, p);
+                for (int c = 0; c < 4; c++) sum[c] += (float)p[c] * w;
+                weightSum += w;
+            }
+
+            // the nearest sample is one of the four with a range weight of 1,
+            // so the weights never sum to 0
+            unsigned char* o = out + (y * targetSize.x + x) * 4;
+            for (int c = 0; c < 4; c++) {
+                o[c] = (unsigned char)(sum[c] / weightSum + 0.5f);
+            }
+        }
+    }
+
+    return out;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "vector.h"
+
+/**
+ * @brief Upscale an RGBA image with edge-aware bilinear filtering, samples
+ * that differ a lot from the nearest one get less weight so that edges stay
+ * sharp instead of being blurred
+ * @param image The image to upscale (4 bytes per pixel)
+ * @param size The size of the image
+ * @param targetSize The size to upscale to
+ * @return The upscaled image (must be freed by the caller)
+ */
+unsigned char* upscale_image(
+    const unsigned char* image,
+    uvec2 size,
+    uvec2 targetSize
+);
\ No newline at end of file
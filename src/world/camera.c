@@ -8,12 +8,18 @@
 typedef struct {
     vec3 pos;
     vec3 dir;
+} CameraView;
+
+// followed by viewCount CameraViews in the data buffer
+typedef struct {
     vec2 sensorSize;
     float focalLength;
+    uint viewCount;
 } CameraData;
 
 struct Camera {
     CameraData data;
+    CameraView* views;
     mce_HBuffer* dataBuff;
 };
 
@@ -29,24 +35,30 @@ Camera* camera_create(mc_Device* device, CameraCreateInfo cameraCreateInfo) {
     CHECK_NULL(device, NULL)
     INFO("creating camera");
 
+    uint viewCount = cameraCreateInfo.viewCount;
     Camera* camera = malloc(sizeof *camera);
     *camera = (Camera) {
         .data = {
-            .pos = {0, 0, 0},
-            .dir = {0, 0, 0},
             .sensorSize = cameraCreateInfo.sensorSize,
             .focalLength = cameraCreateInfo.focalLength,
+            .viewCount = viewCount > 0 ? viewCount : 1,
         },
     };
+    camera->views = calloc(camera->data.viewCount, sizeof *camera->views);
 
-    camera->dataBuff = mce_hybrid_buffer_create_from(
+    if (viewCount == 0) {
+        camera_set(camera, cameraCreateInfo.pos, cameraCreateInfo.rot);
+    }
+    for (uint i = 0; i < viewCount; i++) {
+        CameraViewInfo view = cameraCreateInfo.views[i];
+        camera_set_view(camera, i, view.pos, view.rot);
+    }
+
+    camera->dataBuff = mce_hybrid_buffer_create(
         device,
-        sizeof camera->data,
-        &camera->data
+        sizeof camera->data + sizeof *camera->views * camera->data.viewCount
     );
 
-    camera_set(camera, cameraCreateInfo.pos, cameraCreateInfo.rot);
-
     return camera;
 }
 
@@ -55,6 +67,7 @@ void camera_destroy(Camera* camera) {
     DEBUG("destroying camera");
 
     mce_hybrid_buffer_destroy(camera->dataBuff);
+    free(camera->views);
     free(camera);
 }
 
@@ -67,12 +80,33 @@ void camera_update(Camera* camera) {
         sizeof camera->data,
         &camera->data
     );
+    mce_hybrid_buffer_write(
+        camera->dataBuff,
+        sizeof camera->data,
+        sizeof *camera->views * camera->data.viewCount,
+        camera->views
+    );
 }
 
 void camera_set(Camera* camera, vec3 pos, vec3 dir) {
+    camera_set_view(camera, 0, pos, dir);
+}
+
+void camera_set_view(Camera* camera, uint view, vec3 pos, vec3 dir) {
     CHECK_NULL(camera)
-    camera->data.pos = pos;
-    camera->data.dir = (vec3){deg2rad(dir.x), deg2rad(dir.y), deg2rad(dir.z)};
+    if (view >= camera->data.viewCount) {
+        ERROR("camera has no view %d", view);
+        return;
+    }
+    camera->views[view] = (CameraView){
+        .pos = pos,
+        .dir = {deg2rad(dir.x), deg2rad(dir.y), deg2rad(dir.z)},
+    };
+}
+
+uint camera_get_view_count(Camera* camera) {
+    CHECK_NULL(camera, 0)
+    return camera->data.viewCount;
 }
 
 mce_HBuffer* camera_get_data_buff(Camera* camera) {
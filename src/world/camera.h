@@ -7,15 +7,25 @@
 
 typedef struct Camera Camera;
 
+// a position and rotation to render the scene from
+typedef struct CameraViewInfo {
+    vec3 pos;
+    vec3 rot;
+} CameraViewInfo;
+
 typedef struct CameraCreateInfo {
     vec2 sensorSize;
     float focalLength;
     vec3 pos;
     vec3 rot;
+    uint viewCount;        ///< Extra views replacing pos and rot (0 for none)
+    CameraViewInfo* views; ///< The extra views
 } CameraCreateInfo;
 
 /**
- * @brief Create a new camera
+ * @brief Create a new camera, cameras with several views render all of them in
+ * the same image (stacked vertically, each one the height of the image divided
+ * by the number of views)
  * @param device The device to create the camera on
  * @param cameraCreateInfo The camera creation info
  * @return A new camera
@@ -35,13 +45,29 @@ void camera_destroy(Camera* camera);
 void camera_update(Camera* camera);
 
 /**
- * @brief Set the position and rotation of a camera
+ * @brief Set the position and rotation of a camera (its first view)
  * @param camera The camera to set
  * @param pos The new position of the camera
  * @param rot The new rotation of the camera in degrees (LR, UD, _)
  */
 void camera_set(Camera* camera, vec3 pos, vec3 rot);
 
+/**
+ * @brief Set the position and rotation of one view of a camera
+ * @param camera The camera to set
+ * @param view The index of the view
+ * @param pos The new position of the view
+ * @param rot The new rotation of the view in degrees (LR, UD, _)
+ */
+void camera_set_view(Camera* camera, uint view, vec3 pos, vec3 rot);
+
+/**
+ * @brief Get the number of views of a camera
+ * @param camera The camera to get the number of views of
+ * @return The number of views
+ */
+uint camera_get_view_count(Camera* camera);
+
 /**
  * @brief Get the data buffer of a camera
  * @param camera The camera to get the data buffer of
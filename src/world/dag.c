@@ -0,0 +1,255 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dag.h"
+#include "hash.h"
+#include "logger/logger.h"
+
+#define DAG_MAX_THREADS 64
+
+// the grid of bottom nodes is kept while the next level is built, this keeps
+// it at 512 MiB
+#define DAG_MAX_LEVELS 10
+
+#define NODE_SIZE 8
+
+// a deduplicated set of nodes, the table holds node index + 1 (0: free slot)
+typedef struct {
+    uint* nodes;
+    uint count;
+    uint capacity;
+    uint* table;
+    uint tableSize; ///< Always a power of two
+} NodeSet;
+
+// one thread's share of a level: whole z slices of the node grid
+typedef struct {
+    dag_voxel_fn* voxel;
+    const void* arg;
+    const uint* children; ///< Node IDs of the level below (NULL: voxels)
+    uint grid;            ///< Nodes per axis of this level
+    uint* ids;            ///< Per node, local index + 1 and then global index
+    uint zBegin;
+    uint zEnd;
+    NodeSet local;
+    const uint* remap; ///< Local to global index, set for the second pass
+} LevelJob;
+
+static void node_set_init(NodeSet* set) {
+    *set = (NodeSet){
+        .capacity = 64,
+        .tableSize = 128,
+    };
+    set->nodes = malloc(sizeof(uint) * NODE_SIZE * set->capacity);
+    set->table = calloc(set->tableSize, sizeof(uint));
+}
+
+static void node_set_free(NodeSet* set) {
+    free(set->nodes);
+    free(set->table);
+}
+
+static uint node_hash(const uint* node) {
+    return (uint)hash_bytes(HASH_INIT, node, sizeof(uint) * NODE_SIZE);
+}
+
+// kept at most half full
+static void node_set_grow(NodeSet* set) {
+    uint tableSize = set->tableSize * 2;
+    uint* table = calloc(tableSize, sizeof(uint));
+    for (uint i = 0; i < set->count; i++) {
+        uint slot = node_hash(set->nodes + i * NODE_SIZE) & (tableSize - 1);
+        while (table[slot] != 0) slot = (slot + 1) & (tableSize - 1);
+        table[slot] = i + 1;
+    }
+    free(set->table);
+    set->table = table;
+    set->tableSize = tableSize;
+}
+
+// returns the index of the node, which is added if it isn't in the set yet
+static uint node_set_insert(NodeSet* set, const uint* node) {
+    size_t nodeBytes = sizeof(uint) * NODE_SIZE;
+    uint slot = node_hash(node) & (set->tableSize - 1);
+    while (set->table[slot] != 0) {
+        uint index = set->table[slot] - 1;
+        if (memcmp(set->nodes + index * NODE_SIZE, node, nodeBytes) == 0) {
+            return index;
+        }
+        slot = (slot + 1) & (set->tableSize - 1);
+    }
+
+    if (set->count == set->capacity) {
+        set->capacity *= 2;
+        set->nodes = realloc(set->nodes, nodeBytes * set->capacity);
+    }
+    memcpy(set->nodes + set->count * NODE_SIZE, node, nodeBytes);
+    set->table[slot] = ++set->count;
+
+    if (set->count * 2 > set->tableSize) node_set_grow(set);
+    return set->count - 1;
+}
+
+static void* build_slices(void* arg) {
+    LevelJob* job = arg;
+    uint grid = job->grid;
+    uint childGrid = grid * 2;
+
+    for (uint z = job->zBegin; z < job->zEnd; z++) {
+        for (uint y = 0; y < grid; y++) {
+            for (uint x = 0; x < grid; x++) {
+                uint node[NODE_SIZE];
+                bool empty = true;
+                for (uint i = 0; i < NODE_SIZE; i++) {
+                    uvec3 pos = {{
+                        x * 2 + (i & 1),
+                        y * 2 + (i >> 1 & 1),
+                        z * 2 + (i >> 2),
+                    }};
+                    node[i] = job->children
+                                ? job->children[(pos.z * childGrid + pos.y)
+                                                    * childGrid
+                                                + pos.x]
+                                : job->voxel(job->arg, pos);
+                    if (node[i] != 0) empty = false;
+                }
+
+                uint id = (z * grid + y) * grid + x;
+                job->ids[id]
+                    = empty ? 0 : node_set_insert(&job->local, node) + 1;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void* remap_slices(void* arg) {
+    LevelJob* job = arg;
+    uint grid = job->grid;
+    uint begin = job->zBegin * grid * grid;
+    uint end = job->zEnd * grid * grid;
+    for (uint i = begin; i < end; i++) {
+        if (job->ids[i] != 0) job->ids[i] = job->remap[job->ids[i] - 1];
+    }
+    return NULL;
+}
+
+// the first job runs on the calling thread, as do jobs that can't get one
+static void run_jobs(LevelJob* jobs, uint count, void* (*fn)(void*)) {
+    pthread_t threads[DAG_MAX_THREADS];
+    bool started[DAG_MAX_THREADS] = {0};
+    for (uint i = 1; i < count; i++) {
+        started[i] = pthread_create(&threads[i], NULL, fn, &jobs[i]) == 0;
+        if (!started[i]) fn(&jobs[i]);
+    }
+    fn(&jobs[0]);
+    for (uint i = 1; i < count; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+    }
+}
+
+// builds the nodes of one level in parallel, each thread deduplicates its own
+// slices first so that only their unique nodes are merged on this thread
+static uint* build_level(
+    LevelJob* jobs,
+    uint jobCount,
+    const uint* children,
+    uint grid,
+    NodeSet* global
+) {
+    uint* ids = malloc(sizeof(uint) * grid * grid * grid);
+    if (jobCount > grid) jobCount = grid;
+    for (uint i = 0; i < jobCount; i++) {
+        jobs[i].children = children;
+        jobs[i].grid = grid;
+        jobs[i].ids = ids;
+        jobs[i].zBegin = grid * i / jobCount;
+        jobs[i].zEnd = grid * (i + 1) / jobCount;
+        node_set_init(&jobs[i].local);
+    }
+
+    run_jobs(jobs, jobCount, build_slices);
+
+    uint** remaps = malloc(sizeof(uint*) * jobCount);
+    for (uint i = 0; i < jobCount; i++) {
+        NodeSet* local = &jobs[i].local;
+        remaps[i] = malloc(sizeof(uint) * (local->count + 1));
+        for (uint j = 0; j < local->count; j++) {
+            const uint* node = local->nodes + j * NODE_SIZE;
+            remaps[i][j] = node_set_insert(global, node);
+        }
+        jobs[i].remap = remaps[i];
+    }
+
+    run_jobs(jobs, jobCount, remap_slices);
+
+    for (uint i = 0; i < jobCount; i++) {
+        node_set_free(&jobs[i].local);
+        free(remaps[i]);
+    }
+    free(remaps);
+    return ids;
+}
+
+bool dag_build(
+    dag_voxel_fn* voxel,
+    const void* arg,
+    uvec3 size,
+    uint threadCount,
+    VoxelDag* dag
+) {
+    CHECK_NULL(voxel, false)
+    CHECK_NULL(dag, false)
+
+    uint max = size.x > size.y ? size.x : size.y;
+    if (size.z > max) max = size.z;
+    uint levels = 1;
+    while ((1u << levels) < max) levels++;
+    if (levels > DAG_MAX_LEVELS) {
+        ERROR("dag scenes can be at most %d voxels wide", 1 << DAG_MAX_LEVELS);
+        return false;
+    }
+
+    if (threadCount == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threadCount = cores > 0 ? (uint)cores : 1;
+    }
+    if (threadCount > DAG_MAX_THREADS) threadCount = DAG_MAX_THREADS;
+
+    // node 0 is the empty node, all-zero nodes are never inserted again
+    NodeSet global;
+    node_set_init(&global);
+    uint empty[NODE_SIZE] = {0};
+    node_set_insert(&global, empty);
+
+    LevelJob jobs[DAG_MAX_THREADS];
+    for (uint i = 0; i < threadCount; i++) {
+        jobs[i] = (LevelJob){.voxel = voxel, .arg = arg};
+    }
+
+    uint* children = NULL;
+    for (uint level = 0; level < levels; level++) {
+        uint grid = 1u << (levels - level - 1);
+        uint* ids = build_level(jobs, threadCount, children, grid, &global);
+        free(children);
+        children = ids;
+    }
+
+    *dag = (VoxelDag){
+        .nodes = global.nodes,
+        .nodeCount = global.count,
+        .root = children[0],
+        .levels = levels,
+    };
+    free(children);
+    free(global.table);
+    return true;
+}
+
+void dag_free(VoxelDag* dag) {
+    if (dag == NULL) return;
+    free(dag->nodes);
+    *dag = (VoxelDag){0};
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "vector.h"
+
+/**
+ * @brief Get a voxel of the scene a DAG is built from, called from several
+ * threads at once
+ * @param arg The argument given to dag_build
+ * @param pos The position of the voxel, may be outside of the scene
+ * @return The material ID of the voxel, 0 if it is empty or out of bounds
+ */
+typedef uint dag_voxel_fn(const void* arg, uvec3 pos);
+
+/**
+ * @brief A sparse voxel DAG: an octree whose identical subtrees are stored
+ * once, each node has 8 entries indexed by x | y << 1 | z << 2, the entries of
+ * the bottom level are material IDs, above that they are node indices (0 for
+ * an empty subtree)
+ */
+typedef struct {
+    uint* nodes;    ///< 8 entries per node, node 0 is the empty node
+    uint nodeCount; ///< The number of nodes, including the empty one
+    uint root;      ///< The index of the root node
+    uint levels;    ///< The DAG covers 2^levels voxels along each axis
+} VoxelDag;
+
+/**
+ * @brief Build a sparse voxel DAG from a dense scene, deduplicating identical
+ * subtrees (including their material IDs)
+ * @param voxel Gets the voxels of the scene
+ * @param arg The argument passed to voxel
+ * @param size The size of the scene
+ * @param threadCount The number of threads to build with (0: one per core)
+ * @param dag Filled with the DAG, free it with dag_free
+ * @return true on success, false if the scene is too large
+ */
+bool dag_build(
+    dag_voxel_fn* voxel,
+    const void* arg,
+    uvec3 size,
+    uint threadCount,
+    VoxelDag* dag
+);
+
+/**
+ * @brief Free the nodes of a DAG
+ * @param dag The DAG to free
+ */
+void dag_free(VoxelDag* dag);
\ No newline at end of file
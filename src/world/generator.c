@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "generator.h"
+#include "logger/logger.h"
+#include "renderer/shader_compiler.h"
+
+// each workgroup fills a 4x4x4 block
+#define GENERATOR_WG_SIZE 4
+
+// the generator code goes between the two parts, the voxel index and packing
+// must match coord_to_index and voxel_store in scene.c
+static const char* generatorHead
+    = "#version 430\n"
+      "\n"
+      "layout (local_size_x = WORKGROUP_SIZE_X,\n"
+      "        local_size_y = WORKGROUP_SIZE_Y,\n"
+      "        local_size_z = WORKGROUP_SIZE_Z) in;\n"
+      "\n"
+      "struct Material {\n"
+      "    vec3 color;\n"
+      "    vec3 properties;\n"
+      "};\n"
+      "\n"
+      "layout (std430, binding = 0) readonly buffer buff0 {\n"
+      "    uvec3 sceneSize;\n"
+      "    Material bg;\n"
+      "    uint voxelLayout;\n"
+      "    uint lodLevel;\n"
+      "    uint voxelFormat;\n"
+      "};\n"
+      "\n"
+      "layout (std430, binding = 1) buffer buff1 {\n"
+      "    uint voxels[];\n"
+      "};\n"
+      "\n"
+      "uint part_by_2(uint v) {\n"
+      "    v &= 0x3ff;\n"
+      "    v = (v | v << 16) & 0x030000ff;\n"
+      "    v = (v | v << 8) & 0x0300f00f;\n"
+      "    v = (v | v << 4) & 0x030c30c3;\n"
+      "    v = (v | v << 2) & 0x09249249;\n"
+      "    return v;\n"
+      "}\n"
+      "\n"
+      "uint voxel_index(uvec3 pos) {\n"
+      "    if (voxelLayout == 1) {\n"
+      "        return part_by_2(pos.x) | part_by_2(pos.y) << 1\n"
+      "             | part_by_2(pos.z) << 2;\n"
+      "    }\n"
+      "    if (voxelLayout == 2) {\n"
+      "        uvec3 bricks = (sceneSize + 7) / 8;\n"
+      "        uvec3 brick = pos >> 3;\n"
+      "        uvec3 local = pos & 7;\n"
+      "        uint index = (brick.z * bricks.y + brick.y) * bricks.x\n"
+      "                   + brick.x;\n"
+      "        return index << 9 | local.z << 6 | local.y << 3 | local.x;\n"
+      "    }\n"
+      "    return (pos.z * sceneSize.y + pos.y) * sceneSize.x + pos.x;\n"
+      "}\n"
+      "\n"
+      "// narrow voxels share a uint with their neighbours\n"
+      "void store_voxel(uint index, uint value) {\n"
+      "    if (voxelFormat == 0) {\n"
+      "        voxels[index] = value;\n"
+      "        return;\n"
+      "    }\n"
+      "    uint bits = voxelFormat == 1 ? 16u : 8u;\n"
+      "    uint perWord = 32u / bits;\n"
+      "    uint shift = (index % perWord) * bits;\n"
+      "    uint mask = ((1u << bits) - 1u) << shift;\n"
+      "    atomicAnd(voxels[index / perWord], ~mask);\n"
+      "    atomicOr(voxels[index / perWord], (value << shift) & mask);\n"
+      "}\n"
+      "\n"
+      "#line 1\n";
+
+static const char* generatorTail
+    = "\n"
+      "void main() {\n"
+      "    uvec3 pos = gl_GlobalInvocationID;\n"
+      "    if (any(greaterThanEqual(pos, sceneSize))) return;\n"
+      "    store_voxel(voxel_index(pos), generate(pos));\n"
+      "}\n";
+
+static uint groups(uint size) {
+    return (size + GENERATOR_WG_SIZE - 1) / GENERATOR_WG_SIZE;
+}
+
+bool generate_voxels(
+    mc_Device* device,
+    const char* generator,
+    mce_HBuffer* dataBuff,
+    mce_HBuffer* voxelBuff,
+    uvec3 size
+) {
+    CHECK_NULL(device, false)
+    CHECK_NULL(generator, false)
+
+    size_t codeSize
+        = strlen(generatorHead) + strlen(generator) + strlen(generatorTail) + 1;
+    char* code = malloc(codeSize);
+    snprintf(code, codeSize, "%s%s%s", generatorHead, generator, generatorTail);
+
+    // the compiler only defines the x and y size, the generator runs in cubes
+    char wgSizeZ[16];
+    snprintf(wgSizeZ, sizeof wgSizeZ, "%d", GENERATOR_WG_SIZE);
+    ShaderMacro macro = {"WORKGROUP_SIZE_Z", wgSizeZ};
+    uvec2 wgSize = {{GENERATOR_WG_SIZE, GENERATOR_WG_SIZE}};
+    SPIRVCode spirv = compile_glsl_variant(
+        "voxel_generator",
+        code,
+        "main",
+        wgSize,
+        &macro,
+        1
+    );
+    free(code);
+    if (spirv.size == 0) {
+        ERROR("failed to compile voxel generator");
+        return false;
+    }
+
+    mc_Program* program
+        = mc_program_create(device, spirv.size, spirv.code, "main");
+    if (!program) {
+        ERROR("failed to create voxel generator program");
+        return false;
+    }
+
+    double start = mc_get_time();
+    mc_program_run(
+        program,
+        groups(size.x),
+        groups(size.y),
+        groups(size.z),
+        dataBuff,
+        voxelBuff
+    );
+    INFO("generated voxels in %.3fs", mc_get_time() - start);
+
+    mc_program_destroy(program);
+    return true;
+}
\ No newline at end of file
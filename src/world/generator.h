@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "microcompute.h"
+#include "microcompute_extra.h"
+
+#include "vector.h"
+
+/**
+ * @brief Fill the voxels of a scene on the device with a GLSL generator
+ * @param device The device the scene buffers are on
+ * @param generator GLSL code defining `uint generate(uvec3 pos)`, which returns
+ * the material ID of the voxel at pos (0 for empty)
+ * @param dataBuff The scene data buffer (size, background, layout and format)
+ * @param voxelBuff The voxel buffer to fill
+ * @param size The size of the scene
+ * @return true on success
+ */
+bool generate_voxels(
+    mc_Device* device,
+    const char* generator,
+    mce_HBuffer* dataBuff,
+    mce_HBuffer* voxelBuff,
+    uvec3 size
+);
\ No newline at end of file
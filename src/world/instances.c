@@ -0,0 +1,412 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "instances.h"
+#include "logger/logger.h"
+#include "memory/memory.h"
+
+// the side length of an instance grid cell in voxels
+#define GRID_CELL_SIZE 16
+
+typedef struct {
+    ivec4 offset; ///< The lowest corner (xyz) and the model ID (w)
+    ivec4 rot[3]; ///< The rows of the world to model rotation
+    uvec4 size;   ///< The size of the rotated model (xyz)
+} InstanceData;
+
+struct Instances {
+    mc_Device* device;
+    uvec4* models; ///< The size (xyz) and voxel offset (w) of each model
+    uint modelCount;
+    uint modelCapacity;
+    uint* voxels;
+    uint voxelCount;
+    InstanceData* instances;
+    uint instanceCount;
+    uint instanceCapacity;
+    bool dirty;
+    mce_HBuffer* modelBuff;
+    mce_HBuffer* voxelBuff;
+    mce_HBuffer* instanceBuff;
+    mce_HBuffer* gridBuff;
+    size_t deviceSize; ///< The size of all buffers together
+    MemoryUsage memory;
+};
+
+static void* grow(void* array, uint* capacity, uint count, size_t size) {
+    if (count < *capacity) return array;
+    *capacity = *capacity == 0 ? 8 : *capacity * 2;
+    return realloc(array, size * *capacity);
+}
+
+static void track_memory(Instances* instances) {
+    MemoryUsage usage = {
+        .host = sizeof *instances
+              + sizeof *instances->models * instances->modelCapacity
+              + sizeof *instances->voxels * instances->voxelCount
+              + sizeof *instances->instances * instances->instanceCapacity,
+        .device = instances->deviceSize,
+    };
+    memory_update(MEMORY_INSTANCES, &instances->memory, usage);
+}
+
+// quarter turns around x, y and z (model to world)
+static const int quarterTurns[3][3][3] = {
+    {{1, 0, 0}, {0, 0, -1}, {0, 1, 0}},
+    {{0, 0, 1}, {0, 1, 0}, {-1, 0, 0}},
+    {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}},
+};
+
+static void rotation_matrix(ivec3 rot, int m[3][3]) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) m[i][j] = i == j;
+    }
+
+    int turns[3] = {rot.x, rot.y, rot.z};
+    for (int axis = 0; axis < 3; axis++) {
+        for (int t = 0; t < ((turns[axis] % 4) + 4) % 4; t++) {
+            const int(*q)[3] = quarterTurns[axis];
+            int r[3][3];
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 3; j++) {
+                    r[i][j] = q[i][0] * m[0][j] + q[i][1] * m[1][j]
+                            + q[i][2] * m[2][j];
+                }
+            }
+            memcpy(m, r, sizeof r);
+        }
+    }
+}
+
+Instances* instances_create(mc_Device* device) {
+    Instances* instances = malloc(sizeof *instances);
+    *instances = (Instances){.device = device, .dirty = true};
+    track_memory(instances);
+    return instances;
+}
+
+Instances* instances_clone(Instances* instances, mc_Device* device) {
+    CHECK_NULL(instances, NULL)
+
+    Instances* clone = instances_create(device);
+    clone->modelCount = clone->modelCapacity = instances->modelCount;
+    clone->voxelCount = instances->voxelCount;
+    clone->instanceCount = instances->instanceCount;
+    clone->instanceCapacity = instances->instanceCount;
+
+    size_t modelSize = sizeof *clone->models * clone->modelCount;
+    size_t voxelSize = sizeof *clone->voxels * clone->voxelCount;
+    size_t instanceSize = sizeof *clone->instances * clone->instanceCount;
+
+    clone->models = malloc(modelSize);
+    clone->voxels = malloc(voxelSize);
+    clone->instances = malloc(instanceSize);
+    if (modelSize) memcpy(clone->models, instances->models, modelSize);
+    if (voxelSize) memcpy(clone->voxels, instances->voxels, voxelSize);
+    if (instanceSize) {
+        memcpy(clone->instances, instances->instances, instanceSize);
+    }
+
+    track_memory(clone);
+    return clone;
+}
+
+void instances_destroy(Instances* instances) {
+    CHECK_NULL(instances)
+
+    memory_update(MEMORY_INSTANCES, &instances->memory, (MemoryUsage){0});
+    free(instances->models);
+    free(instances->voxels);
+    free(instances->instances);
+    if (instances->modelBuff) mce_hybrid_buffer_destroy(instances->modelBuff);
+    if (instances->voxelBuff) mce_hybrid_buffer_destroy(instances->voxelBuff);
+    if (instances->instanceBuff)
+        mce_hybrid_buffer_destroy(instances->instanceBuff);
+    if (instances->gridBuff) mce_hybrid_buffer_destroy(instances->gridBuff);
+    free(instances);
+}
+
+uint instances_register_model(Instances* instances, uvec3 size) {
+    CHECK_NULL(instances, INVALID_MODEL)
+
+    // the device finds the voxels of every model by a 32 bit offset
+    uint64_t available = UINT32_MAX - instances->voxelCount;
+    uint64_t area = (uint64_t)size.x * size.y;
+    if (area > 0 && size.z > available / area) {
+        ERROR("models can have at most %u voxels in total", UINT32_MAX);
+        return INVALID_MODEL;
+    }
+
+    instances->models = grow(
+        instances->models,
+        &instances->modelCapacity,
+        instances->modelCount,
+        sizeof *instances->models
+    );
+
+    uint voxelCount = size.x * size.y * size.z;
+    instances->voxels = realloc(
+        instances->voxels,
+        sizeof *instances->voxels * (instances->voxelCount + voxelCount)
+    );
+    memset(
+        instances->voxels + instances->voxelCount,
+        0,
+        sizeof *instances->voxels * voxelCount
+    );
+
+    DEBUG("registering model %d", instances->modelCount);
+
+    instances->models[instances->modelCount] = (uvec4){
+        .x = size.x,
+        .y = size.y,
+        .z = size.z,
+        .w = instances->voxelCount,
+    };
+    instances->voxelCount += voxelCount;
+    instances->dirty = true;
+    track_memory(instances);
+    return instances->modelCount++;
+}
+
+void instances_model_set(
+    Instances* instances,
+    uint model,
+    uvec3 pos,
+    uint materialID
+) {
+    CHECK_NULL(instances)
+    if (model >= instances->modelCount) {
+        ERROR("unknown model %d", model);
+        return;
+    }
+
+    uvec4 m = instances->models[model];
+    if (pos.x >= m.x || pos.y >= m.y || pos.z >= m.z) return;
+
+    instances->voxels[m.w + (pos.z * m.y + pos.y) * m.x + pos.x] = materialID;
+    instances->dirty = true;
+}
+
+void instances_place(Instances* instances, uint model, ivec3 pos, ivec3 rot) {
+    CHECK_NULL(instances)
+    if (model >= instances->modelCount) {
+        ERROR("unknown model %d", model);
+        return;
+    }
+
+    int m[3][3];
+    rotation_matrix(rot, m);
+
+    uvec4 modelSize = instances->models[model];
+    uint size[3] = {modelSize.x, modelSize.y, modelSize.z};
+    InstanceData instance = {
+        .offset = {.x = pos.x, .y = pos.y, .z = pos.z, .w = (int)model},
+    };
+
+    // the world to model rotation is the transpose of the model to world one
+    uint worldSize[3];
+    for (int i = 0; i < 3; i++) {
+        instance.rot[i] = (ivec4){.x = m[0][i], .y = m[1][i], .z = m[2][i]};
+        worldSize[i] = abs(m[i][0]) * size[0] + abs(m[i][1]) * size[1]
+                     + abs(m[i][2]) * size[2];
+    }
+    instance.size = (uvec4){
+        .x = worldSize[0],
+        .y = worldSize[1],
+        .z = worldSize[2],
+    };
+
+    instances->instances = grow(
+        instances->instances,
+        &instances->instanceCapacity,
+        instances->instanceCount,
+        sizeof *instances->instances
+    );
+    instances->instances[instances->instanceCount++] = instance;
+    instances->dirty = true;
+    track_memory(instances);
+}
+
+// layout: cell counts (xyz) and cell size (w), the first instance of each
+// cell (plus one past the last cell), then the instance indices
+static uint* build_grid(Instances* instances, uvec3 sceneSize, size_t* size) {
+    int scene[3] = {sceneSize.x, sceneSize.y, sceneSize.z};
+    uint cells[3];
+    for (int i = 0; i < 3; i++) {
+        cells[i] = (scene[i] + GRID_CELL_SIZE - 1) / GRID_CELL_SIZE;
+        if (instances->instanceCount == 0) cells[i] = 0;
+    }
+
+    uint cellCount = cells[0] * cells[1] * cells[2];
+    uint* starts = calloc(cellCount + 1, sizeof *starts);
+
+    // clipped cell range of each instance
+    uint(*ranges)[2][3] = malloc(sizeof *ranges * instances->instanceCount);
+    for (uint i = 0; i < instances->instanceCount; i++) {
+        InstanceData* instance = &instances->instances[i];
+        ivec4 offset = instance->offset;
+        uvec4 instanceSize = instance->size;
+        int lows[3] = {offset.x, offset.y, offset.z};
+        int sizes[3] = {instanceSize.x, instanceSize.y, instanceSize.z};
+        bool outside = false;
+
+        for (int a = 0; a < 3; a++) {
+            int low = lows[a];
+            int high = low + sizes[a] - 1;
+            if (low < 0) low = 0;
+            if (high >= scene[a]) high = scene[a] - 1;
+            if (high < low) outside = true;
+            ranges[i][0][a] = outside ? 0 : low / GRID_CELL_SIZE;
+            ranges[i][1][a] = outside ? 0 : high / GRID_CELL_SIZE;
+        }
+
+        // an empty range on every axis, the loops below go over all three
+        if (outside) {
+            for (int a = 0; a < 3; a++) {
+                ranges[i][0][a] = 1;
+                ranges[i][1][a] = 0;
+            }
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        uint* indices = starts + cellCount + 1;
+        for (uint i = 0; i < instances->instanceCount; i++) {
+            uint* low = ranges[i][0];
+            uint* high = ranges[i][1];
+            for (uint z = low[2]; z <= high[2]; z++) {
+                for (uint y = low[1]; y <= high[1]; y++) {
+                    for (uint x = low[0]; x <= high[0]; x++) {
+                        uint cell = (z * cells[1] + y) * cells[0] + x;
+                        if (pass == 0) starts[cell + 1]++;
+                        else indices[starts[cell]++] = i;
+                    }
+                }
+            }
+        }
+
+        if (pass == 0) {
+            for (uint c = 0; c < cellCount; c++) starts[c + 1] += starts[c];
+            uint total = starts[cellCount];
+            starts = realloc(starts, sizeof *starts * (cellCount + 1 + total));
+        } else {
+            // filling moved every start to the start of the next cell
+            memmove(starts + 1, starts, sizeof *starts * cellCount);
+            starts[0] = 0;
+        }
+    }
+
+    free(ranges);
+
+    uint total = starts[cellCount];
+    *size = sizeof(uint) * (4 + cellCount + 1 + total);
+    uint* grid = malloc(*size);
+    grid[0] = cells[0];
+    grid[1] = cells[1];
+    grid[2] = cells[2];
+    grid[3] = GRID_CELL_SIZE;
+    memcpy(grid + 4, starts, sizeof *starts * (cellCount + 1 + total));
+    free(starts);
+
+    DEBUG("built instance grid with %d entries", total);
+    return grid;
+}
+
+// buffers are recreated with the new contents, bound buffers may not be empty
+static size_t upload(
+    mc_Device* device,
+    mce_HBuffer** buff,
+    size_t size,
+    void* data
+) {
+    static uint empty[4] = {0};
+    if (*buff) mce_hybrid_buffer_destroy(*buff);
+    if (size == 0) {
+        *buff = mce_hybrid_buffer_create_from(device, sizeof empty, empty);
+        return sizeof empty;
+    }
+    *buff = mce_hybrid_buffer_create_from(device, size, data);
+    return size;
+}
+
+void instances_update(Instances* instances, uvec3 sceneSize) {
+    CHECK_NULL(instances)
+    CHECK_NULL(instances->device)
+    if (!instances->dirty) return;
+
+    INFO(
+        "updating instances (%d models, %d instances)",
+        instances->modelCount,
+        instances->instanceCount
+    );
+
+    size_t gridSize;
+    uint* grid = build_grid(instances, sceneSize, &gridSize);
+
+    mc_Device* device = instances->device;
+    instances->deviceSize = upload(
+        device,
+        &instances->modelBuff,
+        sizeof *instances->models * instances->modelCount,
+        instances->models
+    );
+    instances->deviceSize += upload(
+        device,
+        &instances->voxelBuff,
+        sizeof *instances->voxels * instances->voxelCount,
+        instances->voxels
+    );
+    instances->deviceSize += upload(
+        device,
+        &instances->instanceBuff,
+        sizeof *instances->instances * instances->instanceCount,
+        instances->instances
+    );
+    instances->deviceSize
+        += upload(device, &instances->gridBuff, gridSize, grid);
+
+    free(grid);
+    instances->dirty = false;
+    track_memory(instances);
+}
+
+uint64_t instances_hash(Instances* instances, uint64_t hash) {
+    CHECK_NULL(instances, hash)
+    hash = hash_bytes(
+        hash,
+        instances->models,
+        sizeof *instances->models * instances->modelCount
+    );
+    hash = hash_bytes(
+        hash,
+        instances->voxels,
+        sizeof *instances->voxels * instances->voxelCount
+    );
+    return hash_bytes(
+        hash,
+        instances->instances,
+        sizeof *instances->instances * instances->instanceCount
+    );
+}
+
+mce_HBuffer* instances_get_model_buff(Instances* instances) {
+    CHECK_NULL(instances, NULL)
+    return instances->modelBuff;
+}
+
+mce_HBuffer* instances_get_model_voxel_buff(Instances* instances) {
+    CHECK_NULL(instances, NULL)
+    return instances->voxelBuff;
+}
+
+mce_HBuffer* instances_get_instance_buff(Instances* instances) {
+    CHECK_NULL(instances, NULL)
+    return instances->instanceBuff;
+}
+
+mce_HBuffer* instances_get_grid_buff(Instances* instances) {
+    CHECK_NULL(instances, NULL)
+    return instances->gridBuff;
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "microcompute.h"
+#include "microcompute_extra.h"
+
+#include "vector.h"
+
+#define INVALID_MODEL UINT32_MAX // returned when a model can't be created
+
+/**
+ * Voxel models that are stored once and placed any number of times. On the
+ * device the instances are found through a coarse grid over the scene, each
+ * cell listing the instances that overlap it.
+ */
+typedef struct Instances Instances;
+
+/**
+ * @brief Create an empty set of models and instances
+ * @param device The device to upload to, or NULL to only keep them on the host
+ * @return A new set of models and instances
+ */
+Instances* instances_create(mc_Device* device);
+
+/**
+ * @brief Copy models and instances to another device
+ * @param instances The models and instances to copy
+ * @param device The device to create the copy on
+ * @return A copy of the models and instances
+ */
+Instances* instances_clone(Instances* instances, mc_Device* device);
+
+/**
+ * @brief Destroy a set of models and instances
+ * @param instances The models and instances to destroy
+ */
+void instances_destroy(Instances* instances);
+
+/**
+ * @brief Create a new (empty) voxel model
+ * @param instances The set to create the model in
+ * @param size The size of the model in voxels
+ * @return The ID of the model, INVALID_MODEL if the voxels of all models
+ * together would not fit in 32 bit indices
+ */
+uint instances_register_model(Instances* instances, uvec3 size);
+
+/**
+ * @brief Set a voxel of a model
+ * @param instances The set the model is in
+ * @param model The ID of the model
+ * @param pos The position of the voxel in the model
+ * @param materialID The material ID of the voxel (a scene material)
+ */
+void instances_model_set(
+    Instances* instances,
+    uint model,
+    uvec3 pos,
+    uint materialID
+);
+
+/**
+ * @brief Place an instance of a model
+ * @param instances The set the model is in
+ * @param model The ID of the model
+ * @param pos The lowest corner of the placed (rotated) model
+ * @param rot The number of quarter turns around the x, y and z axes (applied
+ * in that order)
+ */
+void instances_place(Instances* instances, uint model, ivec3 pos, ivec3 rot);
+
+/**
+ * @brief Upload the models, instances and instance grid to the GPU (if they
+ * changed since the last upload)
+ * @param instances The models and instances to update
+ * @param sceneSize The size of the scene, which the instance grid covers
+ */
+void instances_update(Instances* instances, uvec3 sceneSize);
+
+/**
+ * @brief Continue a hash with the models and instances
+ * @param instances The models and instances to hash
+ * @param hash The hash to continue from
+ * @return The updated hash
+ */
+uint64_t instances_hash(Instances* instances, uint64_t hash);
+
+/**
+ * @brief Get the model buffer (size and voxel offset of each model)
+ * @param instances The models and instances
+ * @return The model buffer
+ */
+mce_HBuffer* instances_get_model_buff(Instances* instances);
+
+/**
+ * @brief Get the model voxel buffer (the voxels of all models)
+ * @param instances The models and instances
+ * @return The model voxel buffer
+ */
+mce_HBuffer* instances_get_model_voxel_buff(Instances* instances);
+
+/**
+ * @brief Get the instance buffer
+ * @param instances The models and instances
+ * @return The instance buffer
+ */
+mce_HBuffer* instances_get_instance_buff(Instances* instances);
+
+/**
+ * @brief Get the instance grid buffer
+ * @param instances The models and instances
+ * @return The instance grid buffer
+ */
+mce_HBuffer* instances_get_grid_buff(Instances* instances);
\ No newline at end of file
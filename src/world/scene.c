@@ -1,32 +1,157 @@
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "dag.h"
+#include "generator.h"
+#include "hash.h"
 #include "logger/logger.h"
+#include "memory/memory.h"
 #include "scene.h"
 
+// the largest morton scene, the padded cube already takes 512 MiB
+#define MORTON_MAX_SIZE 512
+
+#define BRICK_SIZE 8
+
+// the largest dag scene, its bottom level of nodes alone takes 512 MiB while
+// it is built
+#define DAG_MAX_SIZE 1024
+
+#define DAG_NODE_SIZE (8 * sizeof(uint))
+
+// each level of detail halves the size, more than this leaves next to nothing
+#define LOD_MAX_LEVEL 6
+
 typedef struct {
     uvec3 size;
     Material bg;
+    uint layout;
+    uint lodLevel;
+    uint format;
+    uint dagRoot;   ///< Root node of dag scenes, set once it was built
+    uint dagLevels; ///< Levels of dag scenes, set once it was built
 } SceneData;
 
+// a cell of a level of detail while it is built
+typedef struct {
+    vec3 color;
+    float emission;
+    float coverage;
+} LodCell;
+
 struct Scene {
     SceneData data;
     uint materialCapacity;
     uint materialCount;
     Material* materials;
-    uint* voxels;
+    void* voxels; ///< NULL once released, the device copy is the only one then
+    bool materialsDirty;
+    bool voxelsDirty;
+    bool releaseHostCopy;
+    char* generator; ///< NULL for scenes that are built on the host
+    bool generatorReadback;
+    bool generated;
+    uint dagNodeCount; ///< Nodes in the device voxel buffer of dag scenes
+    MemoryUsage voxelMemory;
+    MemoryUsage materialMemory;
+    MemoryUsage lodMemory;
+    Instances* instances;
+    mc_Device* device;
     mce_HBuffer* dataBuff;
     mce_HBuffer* materialBuff;
     mce_HBuffer* voxelBuff;
+    mce_HBuffer* lodBuff;
 };
 
-static uint voxels_count(Scene* scene) {
-    return scene->data.size.x * scene->data.size.y * scene->data.size.z;
+static uint next_power_of_two(uint v) {
+    uint p = 1;
+    while (p < v) p <<= 1;
+    return p;
+}
+
+static uint bricks(uint size) {
+    return (size + BRICK_SIZE - 1) / BRICK_SIZE;
+}
+
+// spreads the low 10 bits of v out so that there are 2 zero bits between each
+static uint part_by_2(uint v) {
+    v &= 0x3ff;
+    v = (v | v << 16) & 0x030000ff;
+    v = (v | v << 8) & 0x0300f00f;
+    v = (v | v << 4) & 0x030c30c3;
+    v = (v | v << 2) & 0x09249249;
+    return v;
 }
 
-static uint voxels_size(Scene* scene) {
-    return sizeof *scene->voxels * voxels_count(scene);
+// includes the padding of the morton and brick layouts, in size_t since the
+// host copy of the largest scenes takes 4 GiB or more
+static size_t voxels_count(Scene* scene) {
+    uvec3 size = scene->data.size;
+    switch (scene->data.layout) {
+        case VOXEL_LAYOUT_MORTON: {
+            uint max = size.x > size.y ? size.x : size.y;
+            size_t n = next_power_of_two(max > size.z ? max : size.z);
+            return n * n * n;
+        }
+        case VOXEL_LAYOUT_BRICK:
+            return (size_t)bricks(size.x) * bricks(size.y) * bricks(size.z)
+                 * BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+        default: return (size_t)size.x * size.y * size.z;
+    }
+}
+
+static uint voxel_bytes(Scene* scene) {
+    switch (scene->data.format) {
+        case VOXEL_FORMAT_R16: return sizeof(uint16_t);
+        case VOXEL_FORMAT_R8: return sizeof(uint8_t);
+        default: return sizeof(uint32_t);
+    }
+}
+
+static uint max_material(Scene* scene) {
+    switch (scene->data.format) {
+        case VOXEL_FORMAT_R16: return UINT16_MAX;
+        case VOXEL_FORMAT_R8: return UINT8_MAX;
+        default: return UINT32_MAX;
+    }
+}
+
+// rounded up to whole uints, the render shader reads the voxels as uints
+static size_t voxels_size(Scene* scene) {
+    return (voxels_count(scene) * voxel_bytes(scene) + 3) / 4 * 4;
+}
+
+// narrow voxels are packed into the uints starting at the lowest byte, which
+// is just an array of them on (little endian) hosts and devices
+static uint voxel_load(Scene* scene, const void* voxels, size_t index) {
+    switch (scene->data.format) {
+        case VOXEL_FORMAT_R16: return ((const uint16_t*)voxels)[index];
+        case VOXEL_FORMAT_R8: return ((const uint8_t*)voxels)[index];
+        default: return ((const uint32_t*)voxels)[index];
+    }
+}
+
+static void voxel_store(
+    Scene* scene,
+    void* voxels,
+    size_t index,
+    uint value
+) {
+    switch (scene->data.format) {
+        case VOXEL_FORMAT_R16: ((uint16_t*)voxels)[index] = value; break;
+        case VOXEL_FORMAT_R8: ((uint8_t*)voxels)[index] = value; break;
+        default: ((uint32_t*)voxels)[index] = value; break;
+    }
+}
+
+// dag scenes have their nodes on the device instead of the voxels
+static size_t device_voxels_size(Scene* scene) {
+    if (scene->data.layout != VOXEL_LAYOUT_DAG) return voxels_size(scene);
+    uint nodeCount = scene->dagNodeCount > 0 ? scene->dagNodeCount : 1;
+    return DAG_NODE_SIZE * nodeCount;
 }
 
 static bool coord_in_bounds(Scene* scene, uvec3 pos) {
@@ -34,26 +159,272 @@ static bool coord_in_bounds(Scene* scene, uvec3 pos) {
         && pos.z < scene->data.size.z;
 }
 
-static uint coord_to_index(Scene* scene, uvec3 pos) {
-    return pos.z * scene->data.size.x * scene->data.size.y
-         + pos.y * scene->data.size.x + pos.x;
+// must match get_voxel in the render shader
+static size_t coord_to_index(Scene* scene, uvec3 pos) {
+    uvec3 size = scene->data.size;
+    switch (scene->data.layout) {
+        case VOXEL_LAYOUT_MORTON:
+            return part_by_2(pos.x) | part_by_2(pos.y) << 1
+                 | part_by_2(pos.z) << 2;
+        case VOXEL_LAYOUT_BRICK: {
+            uint brickSize = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+            uint bx = pos.x / BRICK_SIZE;
+            uint by = pos.y / BRICK_SIZE;
+            uint bz = pos.z / BRICK_SIZE;
+            uint lx = pos.x % BRICK_SIZE;
+            uint ly = pos.y % BRICK_SIZE;
+            uint lz = pos.z % BRICK_SIZE;
+            size_t brick
+                = ((size_t)bz * bricks(size.y) + by) * bricks(size.x) + bx;
+            uint local = (lz * BRICK_SIZE + ly) * BRICK_SIZE + lx;
+            return brick * brickSize + local;
+        }
+        default:
+            return ((size_t)pos.z * size.y + pos.y) * size.x + pos.x;
+    }
+}
+
+// size of the coarse level, each level halves the size (rounding up)
+static uvec3 lod_size(Scene* scene) {
+    uvec3 size = scene->data.size;
+    uint scale = 1u << scene->data.lodLevel;
+    return (uvec3){{
+        (size.x + scale - 1) / scale,
+        (size.y + scale - 1) / scale,
+        (size.z + scale - 1) / scale,
+    }};
+}
+
+static uint lod_count(Scene* scene) {
+    uvec3 size = lod_size(scene);
+    return size.x * size.y * size.z;
+}
+
+// scenes without a level of detail still need something to bind
+static size_t lod_buff_size(Scene* scene) {
+    return scene->data.lodLevel ? sizeof(uvec2) * lod_count(scene)
+                                : sizeof(uvec2);
+}
+
+static void track_memory(Scene* scene) {
+    size_t voxelsSize = voxels_size(scene);
+    size_t materialsSize = sizeof(Material) * scene->materialCapacity;
+
+    MemoryUsage voxels = {
+        .host = scene->voxels ? voxelsSize : 0,
+        .device = scene->voxelBuff ? device_voxels_size(scene) : 0,
+    };
+    MemoryUsage materials = {
+        .host = sizeof *scene + materialsSize,
+        .device = scene->materialBuff ? sizeof(SceneData) + materialsSize : 0,
+    };
+    MemoryUsage lod = {.device = scene->lodBuff ? lod_buff_size(scene) : 0};
+
+    memory_update(MEMORY_SCENE_VOXELS, &scene->voxelMemory, voxels);
+    memory_update(MEMORY_SCENE_MATERIALS, &scene->materialMemory, materials);
+    memory_update(MEMORY_SCENE_LOD, &scene->lodMemory, lod);
+}
+
+// whether the device voxels are up to date, generator scenes have no voxels
+// until they were generated on a device
+static bool voxels_on_device(Scene* scene) {
+    return scene->voxelBuff && (!scene->generator || scene->generated);
+}
+
+// released scenes only have their voxels on the device, they are read back for
+// the rare operations that need all of them (must be freed with put_voxels)
+static void* get_voxels(Scene* scene) {
+    if (scene->voxels) return scene->voxels;
+    if (!voxels_on_device(scene)) return calloc(voxels_size(scene), 1);
+    void* voxels = malloc(voxels_size(scene));
+    mce_hybrid_buffer_read(scene->voxelBuff, 0, voxels_size(scene), voxels);
+    return voxels;
+}
+
+static void put_voxels(Scene* scene, void* voxels) {
+    if (voxels != scene->voxels) free(voxels);
+}
+
+static LodCell voxel_lod_cell(Scene* scene, void* voxels, uvec3 pos) {
+    if (!coord_in_bounds(scene, pos)) return (LodCell){0};
+    uint materialID = voxel_load(scene, voxels, coord_to_index(scene, pos));
+    if (materialID == 0) return (LodCell){0};
+    Material material = scene->materials[materialID];
+    return (LodCell){material.color, material.properties.x, 1.0f};
+}
+
+static LodCell lod_cell_get(LodCell* cells, uvec3 size, uvec3 pos) {
+    if (pos.x >= size.x || pos.y >= size.y || pos.z >= size.z)
+        return (LodCell){0};
+    return cells[(pos.z * size.y + pos.y) * size.x + pos.x];
+}
+
+// averages the 2x2x2 cells of the previous level (the voxels for level 1),
+// colors are weighted by coverage so that empty cells don't darken them
+static LodCell lod_cell_build(
+    Scene* scene,
+    void* voxels,
+    LodCell* prev,
+    uvec3 prevSize,
+    uvec3 pos
+) {
+    LodCell sum = {0};
+    for (uint i = 0; i < 8; i++) {
+        uvec3 child = {{
+            pos.x * 2 + (i & 1),
+            pos.y * 2 + (i >> 1 & 1),
+            pos.z * 2 + (i >> 2),
+        }};
+        LodCell cell = prev ? lod_cell_get(prev, prevSize, child)
+                            : voxel_lod_cell(scene, voxels, child);
+        sum.color.r += cell.color.r * cell.coverage;
+        sum.color.g += cell.color.g * cell.coverage;
+        sum.color.b += cell.color.b * cell.coverage;
+        sum.emission += cell.emission * cell.coverage;
+        sum.coverage += cell.coverage;
+    }
+
+    if (sum.coverage > 0.0f) {
+        sum.color.r /= sum.coverage;
+        sum.color.g /= sum.coverage;
+        sum.color.b /= sum.coverage;
+        sum.emission /= sum.coverage;
+    }
+    sum.coverage /= 8.0f;
+    return sum;
+}
+
+static uint pack_unorm(float v) {
+    if (v < 0.0f) v = 0.0f;
+    if (v > 1.0f) v = 1.0f;
+    return (uint)(v * 255.0f + 0.5f);
+}
+
+// packed for the render shader as (rgb color | coverage << 24, emission bits)
+static uvec2 pack_lod_cell(LodCell cell) {
+    uvec2 packed;
+    packed.x = pack_unorm(cell.color.r) | pack_unorm(cell.color.g) << 8
+             | pack_unorm(cell.color.b) << 16 | pack_unorm(cell.coverage) << 24;
+    memcpy(&packed.y, &cell.emission, sizeof packed.y);
+    return packed;
+}
+
+// builds every level from the previous one, only the last one is uploaded
+static void update_lod(Scene* scene) {
+    if (scene->data.lodLevel == 0) return;
+    DEBUG("building level of detail %d", scene->data.lodLevel);
+
+    void* voxels = get_voxels(scene);
+    LodCell* prev = NULL;
+    uvec3 prevSize = scene->data.size;
+    for (uint level = 1; level <= scene->data.lodLevel; level++) {
+        uvec3 size = {{
+            (prevSize.x + 1) / 2,
+            (prevSize.y + 1) / 2,
+            (prevSize.z + 1) / 2,
+        }};
+        LodCell* cells = malloc(sizeof *cells * size.x * size.y * size.z);
+
+        uint i = 0;
+        for (uint z = 0; z < size.z; z++) {
+            for (uint y = 0; y < size.y; y++) {
+                for (uint x = 0; x < size.x; x++) {
+                    uvec3 pos = {{x, y, z}};
+                    cells[i++]
+                        = lod_cell_build(scene, voxels, prev, prevSize, pos);
+                }
+            }
+        }
+
+        free(prev);
+        prev = cells;
+        prevSize = size;
+    }
+    put_voxels(scene, voxels);
+
+    uint count = lod_count(scene);
+    uvec2* packed = malloc(sizeof *packed * count);
+    for (uint i = 0; i < count; i++) packed[i] = pack_lod_cell(prev[i]);
+    mce_hybrid_buffer_write(scene->lodBuff, 0, sizeof *packed * count, packed);
+
+    free(packed);
+    free(prev);
 }
 
 Scene* scene_create(mc_Device* device, SceneCreateInfo sceneCreateInfo) {
-    CHECK_NULL(device, NULL)
     INFO("creating scene");
 
+    uvec3 size = sceneCreateInfo.size;
+    if (sceneCreateInfo.layout == VOXEL_LAYOUT_MORTON
+        && (size.x > MORTON_MAX_SIZE || size.y > MORTON_MAX_SIZE
+            || size.z > MORTON_MAX_SIZE)) {
+        ERROR("morton scenes can be at most %d voxels wide", MORTON_MAX_SIZE);
+        return NULL;
+    }
+
+    if (sceneCreateInfo.layout == VOXEL_LAYOUT_DAG
+        && (size.x > DAG_MAX_SIZE || size.y > DAG_MAX_SIZE
+            || size.z > DAG_MAX_SIZE)) {
+        ERROR("dag scenes can be at most %d voxels wide", DAG_MAX_SIZE);
+        return NULL;
+    }
+
+    // the dag is built from the host voxels
+    if (sceneCreateInfo.layout == VOXEL_LAYOUT_DAG
+        && sceneCreateInfo.generator) {
+        ERROR("dag scenes can't have a voxel generator");
+        return NULL;
+    }
+
+    if (sceneCreateInfo.layout == VOXEL_LAYOUT_DAG
+        && sceneCreateInfo.releaseHostCopy) {
+        WARN("dag scenes keep their host copy of the voxels");
+        sceneCreateInfo.releaseHostCopy = false;
+    }
+
+    if (sceneCreateInfo.lodLevel > LOD_MAX_LEVEL) {
+        ERROR("the level of detail can be at most %d", LOD_MAX_LEVEL);
+        return NULL;
+    }
+
     Scene* scene = malloc(sizeof *scene);
     *scene = (Scene){
-        .data = {.size = sceneCreateInfo.size, .bg = sceneCreateInfo.bg},
+        .data = {
+            .size = sceneCreateInfo.size,
+            .bg = sceneCreateInfo.bg,
+            .layout = sceneCreateInfo.layout,
+            .lodLevel = sceneCreateInfo.lodLevel,
+            .format = sceneCreateInfo.format,
+        },
         .materialCapacity = 10,
         .materialCount = 1,
+        .materialsDirty = true,
+        .releaseHostCopy = sceneCreateInfo.releaseHostCopy,
+        .generatorReadback = sceneCreateInfo.generatorReadback,
+        .device = device,
     };
 
     scene->materials = malloc(sizeof(Material) * scene->materialCapacity);
+    scene->materials[0] = (Material){0};
+
+    // generated voxels only exist on the device (until they are read back)
+    if (sceneCreateInfo.generator) {
+        scene->generator = strdup(sceneCreateInfo.generator);
+        scene->voxelsDirty = true;
+    } else {
+        scene->voxels = calloc(voxels_size(scene), 1);
+        // the device has no dag before the first update, not even an empty one
+        if (sceneCreateInfo.layout == VOXEL_LAYOUT_DAG) {
+            scene->voxelsDirty = true;
+        }
+    }
 
-    scene->voxels = malloc(voxels_size(scene));
-    for (uint i = 0; i < voxels_count(scene); i++) scene->voxels[i] = 0;
+    scene->instances = instances_create(device);
+
+    if (!device) {
+        track_memory(scene);
+        return scene;
+    }
 
     scene->dataBuff = mce_hybrid_buffer_create_from(
         device,
@@ -64,29 +435,83 @@ Scene* scene_create(mc_Device* device, SceneCreateInfo sceneCreateInfo) {
         device,
         sizeof(Material) * scene->materialCapacity
     );
-    scene->voxelBuff = mce_hybrid_buffer_create_from(
-        device,
-        voxels_size(scene),
-        scene->voxels
-    );
+    if (scene->voxels && sceneCreateInfo.layout != VOXEL_LAYOUT_DAG) {
+        scene->voxelBuff = mce_hybrid_buffer_create_from(
+            device,
+            voxels_size(scene),
+            scene->voxels
+        );
+    } else {
+        scene->voxelBuff
+            = mce_hybrid_buffer_create(device, device_voxels_size(scene));
+    }
+
+    scene->lodBuff = mce_hybrid_buffer_create(device, lod_buff_size(scene));
 
+    track_memory(scene);
     return scene;
 }
 
+Scene* scene_clone(Scene* scene, mc_Device* device) {
+    CHECK_NULL(scene, NULL)
+    CHECK_NULL(device, NULL)
+
+    SceneCreateInfo sceneCreateInfo = {
+        .size = scene->data.size,
+        .bg = scene->data.bg,
+        .layout = scene->data.layout,
+        .format = scene->data.format,
+        .lodLevel = scene->data.lodLevel,
+        .releaseHostCopy = scene->releaseHostCopy,
+        .generator = scene->generator,
+        .generatorReadback = scene->generatorReadback,
+    };
+
+    Scene* clone = scene_create(device, sceneCreateInfo);
+    if (clone == NULL) return NULL;
+    for (uint i = 1; i < scene->materialCount; i++) {
+        scene_register_material(clone, scene->materials[i]);
+    }
+    // generator scenes are generated again on the new device
+    if (clone->voxels) {
+        void* voxels = get_voxels(scene);
+        memcpy(clone->voxels, voxels, voxels_size(scene));
+        put_voxels(scene, voxels);
+    }
+    clone->voxelsDirty = true;
+
+    instances_destroy(clone->instances);
+    clone->instances = instances_clone(scene->instances, device);
+
+    return clone;
+}
+
 void scene_destroy(Scene* scene) {
     CHECK_NULL(scene)
     DEBUG("destroying scene");
 
+    memory_update(MEMORY_SCENE_VOXELS, &scene->voxelMemory, (MemoryUsage){0});
+    memory_update(
+        MEMORY_SCENE_MATERIALS,
+        &scene->materialMemory,
+        (MemoryUsage){0}
+    );
+    memory_update(MEMORY_SCENE_LOD, &scene->lodMemory, (MemoryUsage){0});
+
     free(scene->materials);
     free(scene->voxels);
-    mce_hybrid_buffer_destroy(scene->dataBuff);
-    mce_hybrid_buffer_destroy(scene->materialBuff);
-    mce_hybrid_buffer_destroy(scene->voxelBuff);
+    free(scene->generator);
+    instances_destroy(scene->instances);
+    if (scene->dataBuff) mce_hybrid_buffer_destroy(scene->dataBuff);
+    if (scene->materialBuff) mce_hybrid_buffer_destroy(scene->materialBuff);
+    if (scene->voxelBuff) mce_hybrid_buffer_destroy(scene->voxelBuff);
+    if (scene->lodBuff) mce_hybrid_buffer_destroy(scene->lodBuff);
     free(scene);
 }
 
 void scene_update_data(Scene* scene) {
     CHECK_NULL(scene)
+    CHECK_NULL(scene->dataBuff)
     INFO("updating scene data");
     mce_hybrid_buffer_write(
         scene->dataBuff,
@@ -98,6 +523,8 @@ void scene_update_data(Scene* scene) {
 
 void scene_update_materials(Scene* scene) {
     CHECK_NULL(scene)
+    CHECK_NULL(scene->materialBuff)
+    if (!scene->materialsDirty) return;
     INFO("updating scene materials");
     mce_hybrid_buffer_write(
         scene->materialBuff,
@@ -105,43 +532,238 @@ void scene_update_materials(Scene* scene) {
         sizeof *scene->materials * scene->materialCount,
         scene->materials
     );
+    scene->materialsDirty = false;
 }
 
-void scene_update_voxels(Scene* scene) {
-    CHECK_NULL(scene)
-    INFO("updating scene voxels");
-    mce_hybrid_buffer_write(
+// fills the device voxels with the generator, a failed generator leaves the
+// scene ungenerated
+static bool generate(Scene* scene) {
+    bool res = generate_voxels(
+        scene->device,
+        scene->generator,
+        scene->dataBuff,
         scene->voxelBuff,
-        0,
-        voxels_size(scene),
-        scene->voxels
+        scene->data.size
     );
+    if (!res) return false;
+    scene->generated = true;
+
+    if (scene->generatorReadback) {
+        DEBUG("reading generated voxels back to the host");
+        size_t size = voxels_size(scene);
+        scene->voxels = malloc(size);
+        mce_hybrid_buffer_read(scene->voxelBuff, 0, size, scene->voxels);
+        track_memory(scene);
+    }
+    return true;
+}
+
+static uint dag_voxel(const void* arg, uvec3 pos) {
+    Scene* scene = (Scene*)arg;
+    if (!coord_in_bounds(scene, pos)) return 0;
+    return voxel_load(scene, scene->voxels, coord_to_index(scene, pos));
+}
+
+// rebuilds the whole dag, its root and level count go into the scene data
+static bool upload_dag(Scene* scene) {
+    double start = mc_get_time();
+    VoxelDag dag;
+    if (!dag_build(dag_voxel, scene, scene->data.size, 0, &dag)) {
+        ERROR("failed to build voxel dag");
+        return false;
+    }
+
+    size_t size = DAG_NODE_SIZE * dag.nodeCount;
+    if (dag.nodeCount != scene->dagNodeCount) {
+        scene->voxelBuff = mce_hybrid_buffer_realloc(scene->voxelBuff, size);
+    }
+    mce_hybrid_buffer_write(scene->voxelBuff, 0, size, dag.nodes);
+    scene->dagNodeCount = dag.nodeCount;
+    scene->data.dagRoot = dag.root;
+    scene->data.dagLevels = dag.levels;
+    scene_update_data(scene);
+    track_memory(scene);
+
+    INFO(
+        "built voxel dag in %.3fs: %d nodes, %.2f MiB (%.1fx smaller)",
+        mc_get_time() - start,
+        dag.nodeCount,
+        size / (1024.0 * 1024.0),
+        (double)voxels_size(scene) / size
+    );
+    dag_free(&dag);
+    return true;
+}
+
+bool scene_update_voxels(Scene* scene) {
+    CHECK_NULL(scene, false)
+    CHECK_NULL(scene->voxelBuff, false)
+    if (!scene->voxelsDirty) return true;
+    INFO("updating scene voxels");
+
+    // generated and released voxels are already on the device, only the level
+    // of detail is out of date
+    if (scene->generator && !scene->generated) {
+        if (!generate(scene)) return false;
+    } else if (scene->voxels && scene->data.layout == VOXEL_LAYOUT_DAG) {
+        if (!upload_dag(scene)) return false;
+    } else if (scene->voxels) {
+        mce_hybrid_buffer_write(
+            scene->voxelBuff,
+            0,
+            voxels_size(scene),
+            scene->voxels
+        );
+    }
+    update_lod(scene);
+    scene->voxelsDirty = false;
+
+    if (scene->releaseHostCopy && scene->voxels) {
+        DEBUG("releasing host copy of the scene voxels");
+        free(scene->voxels);
+        scene->voxels = NULL;
+        track_memory(scene);
+    }
+    return true;
+}
+
+void scene_update_instances(Scene* scene) {
+    CHECK_NULL(scene)
+    instances_update(scene->instances, scene->data.size);
 }
 
 uint scene_register_material(Scene* scene, Material material) {
     CHECK_NULL(scene, 0)
+    if (scene->materialCount > max_material(scene)) {
+        ERROR(
+            "the voxel format holds at most %u materials",
+            max_material(scene)
+        );
+        return 0;
+    }
+
     if (scene->materialCount == scene->materialCapacity) {
         scene->materialCapacity *= 2;
         scene->materials = realloc(
             scene->materials,
             sizeof *scene->materials * scene->materialCapacity
         );
-        scene->materialBuff = mce_hybrid_buffer_realloc(
-            scene->materialBuff,
-            sizeof *scene->materials * scene->materialCapacity
-        );
+        if (scene->materialBuff) {
+            scene->materialBuff = mce_hybrid_buffer_realloc(
+                scene->materialBuff,
+                sizeof *scene->materials * scene->materialCapacity
+            );
+        }
+        track_memory(scene);
     }
 
     DEBUG("registering material %d", scene->materialCount);
 
     scene->materials[scene->materialCount++] = material;
+    scene->materialsDirty = true;
     return scene->materialCount - 1;
 }
 
 void scene_set(Scene* scene, uvec3 pos, uint materialID) {
     CHECK_NULL(scene)
+    // registration stops at the largest ID the voxel format holds, so this
+    // also keeps IDs from being truncated into other materials
+    if (materialID >= scene->materialCount) {
+        ERROR("unknown material %d", materialID);
+        return;
+    }
     if (!coord_in_bounds(scene, pos)) return;
-    scene->voxels[coord_to_index(scene, pos)] = materialID;
+    // voxels are only set on host scenes, which keep their copy
+    if (!scene->voxels) return;
+    voxel_store(scene, scene->voxels, coord_to_index(scene, pos), materialID);
+    scene->voxelsDirty = true;
+}
+
+uint scene_register_model(Scene* scene, uvec3 size) {
+    CHECK_NULL(scene, INVALID_MODEL)
+    return instances_register_model(scene->instances, size);
+}
+
+void scene_model_set(Scene* scene, uint model, uvec3 pos, uint materialID) {
+    CHECK_NULL(scene)
+    if (materialID >= scene->materialCount) {
+        ERROR("unknown material %d", materialID);
+        return;
+    }
+    instances_model_set(scene->instances, model, pos, materialID);
+}
+
+void scene_place_model(Scene* scene, uint model, ivec3 pos, ivec3 rot) {
+    CHECK_NULL(scene)
+    instances_place(scene->instances, model, pos, rot);
+}
+
+uint scene_get(Scene* scene, uvec3 pos) {
+    CHECK_NULL(scene, 0)
+    if (!coord_in_bounds(scene, pos)) return 0;
+    size_t index = coord_to_index(scene, pos);
+    if (scene->voxels) return voxel_load(scene, scene->voxels, index);
+    if (!voxels_on_device(scene)) return 0;
+
+    uint bytes = voxel_bytes(scene);
+    uint materialID = 0;
+    mce_hybrid_buffer_read(scene->voxelBuff, bytes * index, bytes, &materialID);
+    return materialID;
+}
+
+size_t scene_voxel_index(Scene* scene, uvec3 pos) {
+    CHECK_NULL(scene, 0)
+    return coord_to_index(scene, pos);
+}
+
+uint64_t scene_hash(Scene* scene) {
+    CHECK_NULL(scene, 0)
+    // the dag fields depend on whether the scene was uploaded yet
+    size_t dataSize = offsetof(SceneData, dagRoot);
+    uint64_t hash = hash_bytes(HASH_INIT, &scene->data, dataSize);
+    hash = hash_bytes(
+        hash,
+        scene->materials,
+        sizeof *scene->materials * scene->materialCount
+    );
+    if (scene->generator) {
+        hash = hash_bytes(hash, scene->generator, strlen(scene->generator));
+    } else {
+        void* voxels = get_voxels(scene);
+        hash = hash_bytes(hash, voxels, voxels_size(scene));
+        put_voxels(scene, voxels);
+    }
+    return instances_hash(scene->instances, hash);
+}
+
+uvec3 scene_get_size(Scene* scene) {
+    CHECK_NULL(scene, (uvec3){0})
+    return scene->data.size;
+}
+
+uint scene_get_material_count(Scene* scene) {
+    CHECK_NULL(scene, 0)
+    return scene->materialCount;
+}
+
+Material scene_get_bg(Scene* scene) {
+    CHECK_NULL(scene, (Material){0})
+    return scene->data.bg;
+}
+
+VoxelLayout scene_get_layout(Scene* scene) {
+    CHECK_NULL(scene, VOXEL_LAYOUT_LINEAR)
+    return (VoxelLayout)scene->data.layout;
+}
+
+VoxelFormat scene_get_format(Scene* scene) {
+    CHECK_NULL(scene, VOXEL_FORMAT_R32)
+    return (VoxelFormat)scene->data.format;
+}
+
+Instances* scene_get_instances(Scene* scene) {
+    CHECK_NULL(scene, NULL)
+    return scene->instances;
 }
 
 mce_HBuffer* scene_get_data_buff(Scene* scene) {
@@ -157,4 +779,9 @@ mce_HBuffer* scene_get_material_buff(Scene* scene) {
 mce_HBuffer* scene_get_voxel_buff(Scene* scene) {
     CHECK_NULL(scene, NULL)
     return scene->voxelBuff;
+}
+
+mce_HBuffer* scene_get_lod_buff(Scene* scene) {
+    CHECK_NULL(scene, NULL)
+    return scene->lodBuff;
 }
\ No newline at end of file
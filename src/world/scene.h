@@ -3,24 +3,55 @@
 #include "microcompute.h"
 #include "microcompute_extra.h"
 
+#include <stdbool.h>
+
+#include "instances.h"
 #include "material.h"
 #include "vector.h"
 
 typedef struct Scene Scene;
 
+typedef enum {
+    VOXEL_LAYOUT_LINEAR, ///< Rows along x, then y, then z
+    VOXEL_LAYOUT_MORTON, ///< Z-order curve (padded to a power of two cube)
+    VOXEL_LAYOUT_BRICK,  ///< 8x8x8 bricks, linear inside and between bricks
+    VOXEL_LAYOUT_DAG,    ///< Sparse voxel DAG on the device, linear on the host
+} VoxelLayout;
+
+typedef enum {
+    VOXEL_FORMAT_R32, ///< 4 bytes per voxel
+    VOXEL_FORMAT_R16, ///< 2 bytes per voxel, at most 65535 materials
+    VOXEL_FORMAT_R8,  ///< 1 byte per voxel, at most 255 materials
+} VoxelFormat;
+
 typedef struct SceneCreateInfo {
     uvec3 size;
     Material bg;
+    VoxelLayout layout;
+    VoxelFormat format;
+    uint lodLevel;
+    bool releaseHostCopy;
+    char* generator;        ///< GLSL voxel generator (see generator.h), or NULL
+    bool generatorReadback; ///< Read generated voxels back to the host
 } SceneCreateInfo;
 
 /**
  * @brief Create a new scene
- * @param device The device to create the scene on
+ * @param device The device to create the scene on, or NULL for a scene that
+ * only lives on the host (it can be copied to a device with scene_clone)
  * @param sceneCreateInfo The scene creation info
  * @return A new scene
  */
 Scene* scene_create(mc_Device* device, SceneCreateInfo sceneCreateInfo);
 
+/**
+ * @brief Copy a scene to another device
+ * @param scene The scene to copy
+ * @param device The device to create the copy on
+ * @return A new scene with the same size, materials and voxels
+ */
+Scene* scene_clone(Scene* scene, mc_Device* device);
+
 /**
  * @brief Destroy a scene
  * @param scene The scene to destroy
@@ -34,33 +65,145 @@ void scene_destroy(Scene* scene);
 void scene_update_data(Scene* scene);
 
 /**
- * @brief Upload the scene materials to the GPU
+ * @brief Upload the scene materials to the GPU (if they changed since the last
+ * upload)
  * @param scene The scene to update
  */
 void scene_update_materials(Scene* scene);
 
 /**
- * @brief Upload the scene voxels to the GPU
+ * @brief Upload the scene voxels and their coarse level of detail to the GPU
+ * (if they changed since the last upload), scenes created with
+ * releaseHostCopy free their host copy of the voxels afterwards, scenes with a
+ * generator fill their voxels on the device instead (the scene data must be
+ * uploaded first)
  * @param scene The scene to update
+ * @return true on success, false if the generator or the dag failed (the
+ * voxels stay out of date)
  */
-void scene_update_voxels(Scene* scene);
+bool scene_update_voxels(Scene* scene);
+
+/**
+ * @brief Upload the scene models and instances to the GPU (if they changed
+ * since the last upload)
+ * @param scene The scene to update
+ */
+void scene_update_instances(Scene* scene);
 
 /**
  * @brief Create a new material in a scene
  * @param scene The scene to create the material in
  * @param material The material to create
- * @return The ID of the created material
+ * @return The ID of the created material, 0 if the voxel format of the scene
+ * can't hold more materials
  */
 uint scene_register_material(Scene* scene, Material material);
 
 /**
- * @brief Set a voxel in a scene
+ * @brief Set a voxel in a scene, ignored for scenes without a host copy of
+ * their voxels (released or generated without readback)
  * @param scene The scene to set the voxel in
  * @param pos The position of the voxel
- * @param materialID The material ID of the voxel
+ * @param materialID The material ID of the voxel (a registered material)
  */
 void scene_set(Scene* scene, uvec3 pos, uint materialID);
 
+/**
+ * @brief Create a new (empty) voxel model in a scene, which can be placed any
+ * number of times without taking up more memory
+ * @param scene The scene to create the model in
+ * @param size The size of the model in voxels
+ * @return The ID of the created model, INVALID_MODEL if the models of the scene
+ * would get too large
+ */
+uint scene_register_model(Scene* scene, uvec3 size);
+
+/**
+ * @brief Set a voxel of a model, positions outside of the model are ignored
+ * @param scene The scene the model is in
+ * @param model The ID of the model
+ * @param pos The position of the voxel in the model
+ * @param materialID The material ID of the voxel (a registered material)
+ */
+void scene_model_set(Scene* scene, uint model, uvec3 pos, uint materialID);
+
+/**
+ * @brief Place an instance of a model in a scene
+ * @param scene The scene to place the model in
+ * @param model The ID of the model
+ * @param pos The lowest corner of the placed (rotated) model
+ * @param rot The number of quarter turns around the x, y and z axes
+ */
+void scene_place_model(Scene* scene, uint model, ivec3 pos, ivec3 rot);
+
+/**
+ * @brief Get a voxel of a scene
+ * @param scene The scene to get the voxel from
+ * @param pos The position of the voxel
+ * @return The material ID of the voxel, 0 if it is out of bounds
+ */
+uint scene_get(Scene* scene, uvec3 pos);
+
+/**
+ * @brief Get the index of a voxel in the voxel buffer of a scene, which
+ * depends on the layout of the scene (dag scenes give the index in their host
+ * copy)
+ * @param scene The scene
+ * @param pos The position of the voxel (must be in bounds)
+ * @return The index of the voxel
+ */
+size_t scene_voxel_index(Scene* scene, uvec3 pos);
+
+/**
+ * @brief Hash the contents (size, background, materials and voxels) of a
+ * scene, scenes with a generator hash its code instead of their voxels
+ * @param scene The scene to hash
+ * @return The hash
+ */
+uint64_t scene_hash(Scene* scene);
+
+/**
+ * @brief Get the size of a scene
+ * @param scene The scene to get the size of
+ * @return The size of the scene in voxels
+ */
+uvec3 scene_get_size(Scene* scene);
+
+/**
+ * @brief Get the number of materials of a scene, including the empty one
+ * @param scene The scene to get the material count of
+ * @return The number of materials, valid material IDs are below it
+ */
+uint scene_get_material_count(Scene* scene);
+
+/**
+ * @brief Get the background material of a scene
+ * @param scene The scene to get the background of
+ * @return The background material
+ */
+Material scene_get_bg(Scene* scene);
+
+/**
+ * @brief Get the voxel layout of a scene
+ * @param scene The scene to get the layout of
+ * @return The voxel layout
+ */
+VoxelLayout scene_get_layout(Scene* scene);
+
+/**
+ * @brief Get the voxel format of a scene
+ * @param scene The scene to get the format of
+ * @return The voxel format
+ */
+VoxelFormat scene_get_format(Scene* scene);
+
+/**
+ * @brief Get the models and instances of a scene (for their buffers)
+ * @param scene The scene to get the models and instances of
+ * @return The models and instances
+ */
+Instances* scene_get_instances(Scene* scene);
+
 /**
  * @brief Get the data buffer of a scene
  * @param scene The scene to get the data buffer of
@@ -80,4 +223,12 @@ mce_HBuffer* scene_get_material_buff(Scene* scene);
  * @param scene The scene to get the voxel buffer of
  * @return The voxel buffer
  */
-mce_HBuffer* scene_get_voxel_buff(Scene* scene);
\ No newline at end of file
+mce_HBuffer* scene_get_voxel_buff(Scene* scene);
+
+/**
+ * @brief Get the level of detail buffer of a scene, which holds the averaged
+ * color, emission and coverage of each coarse cell
+ * @param scene The scene to get the level of detail buffer of
+ * @return The level of detail buffer
+ */
+mce_HBuffer* scene_get_lod_buff(Scene* scene);
\ No newline at end of file
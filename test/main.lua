@@ -24,7 +24,9 @@ end
 local root = run_command("pwd"):gsub("/[^/]*$", "/")
 
 return {
-    output_file = "output.bmp",
+    output_file = "output.png",
+    -- "bmp", "png" (compressed on every core) or "qoi" (faster, a bit larger)
+    output_format = "png",
 
     logger = function(lvl, src, file, line, msg)
         local colors = { "\27[34m", "\27[32m", "\27[33m", "\27[31m" }
@@ -42,6 +44,11 @@ return {
         print(color .. lvl .. " │ " .. src .. " │ " .. pos .. " │ " .. msg:gsub("\n", "") .. "\27[0m")
     end,
 
+    -- 0: debug, 1: info, 2: warn, 3: error
+    log_level = 1,
+
+    -- return a single device index, or a list of indices to split the image
+    -- between several devices
     device_selector = function(devices)
         local best = { index = 1, score = 0 }
         for i, device in ipairs(devices) do
@@ -59,15 +66,71 @@ return {
         renderer_code = read_file("../shader/renderer.glsl"),
         iteration_code = read_file("../shader/iteration.glsl"),
         output_code = read_file("../shader/output.glsl"),
-        workgroup_size = { 16, 16 },
+        denoise_code = read_file("../shader/denoise.glsl"),
+        -- either a fixed size like { 16, 16 } or "auto", tuned sizes are
+        -- kept per device and shader in the workgroup cache file ("" to
+        -- always tune)
+        workgroup_size = "auto",
+        workgroup_cache = "workgroup_cache.txt",
         image_size = { 1920, 1080 },
         iterations = 100,
+        -- the samples only depend on the seed and their iteration index, so
+        -- processes can render disjoint ranges (first_iteration to
+        -- first_iteration + iterations - 1) of the same frame
+        first_iteration = 0,
+        seed = 1,
+        -- sampling stops at whichever comes first: the iterations above, the
+        -- time budget or the estimated relative noise (0 = no limit)
+        time_budget_ms = 0,
+        target_noise = 0,
+        samples_per_dispatch = 4,
         max_depth = 5,
+        denoise_passes = 0,
+        denoise_on_cpu = false,
+        cache_primary = true,
+        -- bake the scene size, background and max depth into the shader,
+        -- builds with EMBED_SHADERS only compile the stock shaders at runtime
+        -- when this is on (or for workgroup sizes that were not embedded)
+        specialize = true,
+        -- "vec3" (16 bytes/pixel), "packed" (12) or "half" (8)
+        accumulation_format = "packed",
+        -- publishes the image while it renders, to "shm:/<name>" (POSIX shared
+        -- memory) or a file, whenever stream_interval seconds or
+        -- stream_iterations iterations passed (0 = never, "" = no streaming)
+        stream_target = "",
+        stream_interval = 0.5,
+        stream_iterations = 0,
+        -- also writes the image before denoising, for "merge" ("" = don't)
+        partial_file = "",
+        -- rays trace the scene's coarse level after this many bounces, or once
+        -- they start further than lod_distance from the camera (0 = never)
+        lod_bounce = 2,
+        lod_distance = 0,
     },
 
     scene = {
         size = { 50, 50, 50 },
         bg = { color = { 0.5, 0.5, 1.0 }, emission = 1 },
+        -- voxel memory layout: "linear", "morton", "brick" (8x8x8 bricks) or
+        -- "dag" (a sparse voxel DAG, identical blocks are stored once)
+        layout = "brick",
+        -- bytes per voxel: "r32", "r16" (at most 65535 materials) or "r8"
+        -- (at most 255), narrower voxels take less memory and bandwidth
+        voxel_format = "r8",
+        -- coarse level of detail for secondary rays, each level halves the
+        -- size of the scene (0 = none)
+        lod_level = 1,
+        -- frees the host copy of the device scenes once their voxels were
+        -- uploaded, the scene is still built on the host first, so the peak
+        -- includes that copy and the device copy
+        release_host_copy = true,
+        -- GLSL code defining "uint generate(uvec3 pos)", which fills the
+        -- voxels on the device with material IDs instead of the voxel placer
+        -- (which still registers the materials and models), e.g.
+        -- "uint generate(uvec3 pos) { return pos.y < 10 ? 1 : 0; }"
+        generator = "",
+        -- reads the generated voxels back to the host
+        generator_readback = false,
         voxel_placer = function(scene)
             local white = scene:register_material({ color = { 0.8, 0.8, 0.8 }, emission = 0 })
             local red = scene:register_material({ color = { 0.8, 0.1, 0.1 }, emission = 0 })
@@ -112,6 +175,17 @@ return {
                     end
                 end
             end
+
+            -- models are stored once, no matter how often they are placed
+            local pillar = scene:register_model({ 2, 6, 2 })
+            for y = 0, 6 - 1 do
+                scene:model_set(pillar, { 0, y, 0 }, red)
+                scene:model_set(pillar, { 1, y, 1 }, green)
+            end
+            for i = 0, 3 do
+                -- position of the lowest corner, quarter turns around x, y, z
+                scene:place(pillar, { 28 + i * 4, 43, 30 }, { 0, i, 0 })
+            end
         end,
     },
 
@@ -120,5 +194,12 @@ return {
         focal_length = 1,
         position = { 40, 10, -75 },
         rotation = { 5, 10, 0 },
+        -- optional views rendered together in one dispatch, each one written
+        -- to "<output>_<view>.<ext>": a list of views, e.g. a stereo pair
+        -- { { position = { 39.9, 10, -75 }, rotation = { 5, 10, 0 } },
+        --   { position = { 40.1, 10, -75 }, rotation = { 5, 10, 0 } } }
+        -- or "cubemap" (six views along the world axes from the position,
+        -- which needs a square image and sensor and focal_length = size / 2)
+        -- views = "cubemap",
     },
 }